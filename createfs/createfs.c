@@ -0,0 +1,512 @@
+/* createfs.c - Builds a file system image from a source directory
+ * vim:ts=4 noexpandtab
+ *
+ * The image is the MP3 format: a boot block holding the root directory,
+ * one 4KB block per inode and then the data blocks. Subdirectories are
+ * inodes whose data is a list of 64 byte entries like the boot block's,
+ * starting with their own "." entry. Images this program writes are
+ * also writable by the kernel: they carry spare inodes and spare data
+ * blocks, and a block bitmap at the start of the data area that the
+ * boot block points to. With -e the inodes hold extents, which lets
+ * files grow past the 4MB a block list can address. With -z every data
+ * block is LZ4 compressed on its own, and the image is read only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE		4096
+#define DENTRY_SIZE		64
+#define MAX_DENTRIES	63
+#define NAME_LEN		32
+#define INODE_BLOCKS	1023
+#define MAX_DEPTH		8
+
+#define TYPE_RTC		0
+#define TYPE_DIR		1
+#define TYPE_FILE		2
+
+/* Must match filesys.c */
+#define FS_MAGIC		0x31393357	/* "W391" */
+#define BOOT_MAGIC		3
+#define BOOT_BITMAP		4
+#define BOOT_BITMAP_LEN	5
+#define BOOT_FEATURES	6
+
+#define FEATURE_EXTENTS	0x1
+#define FEATURE_LZ4		0x2
+#define EXT_COUNT		1
+#define EXT_FIRST		2
+#define EXT_MAX_SIZE	0x7FFFF000
+
+#define BITS_PER_BLOCK	(BLOCK_SIZE * 8)
+
+/* LZ4 block format: a match is at least LZ4_MIN_MATCH bytes, starts
+ * LZ4_MFLIMIT or more bytes before the end of the block and leaves the
+ * last LZ4_LAST_LITERALS as literals */
+#define LZ4_MIN_MATCH		4
+#define LZ4_MFLIMIT			12
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MAX_OFFSET		65535
+#define LZ4_RUN_MASK		15
+#define LZ4_HASH_BITS		12
+#define LZ4_BOUND			(BLOCK_SIZE + BLOCK_SIZE / 255 + 16)
+
+#define DEFAULT_SPARE_INODES	16
+#define DEFAULT_SPARE_BLOCKS	256
+
+typedef struct entry {
+	char name[NAME_LEN + 1];
+	uint32_t type;
+	char* path;			/* source file, NULL for devices and directories */
+	uint32_t size;		/* bytes of data: the file, or a directory's entries */
+	uint32_t inode;
+	struct entry* children;	/* a directory's entries, "." first */
+	int nchildren;
+} entry_t;
+
+/* Set by -e: inodes hold extents instead of block lists */
+static int extents;
+/* Set by -z: data blocks are compressed */
+static int compress;
+
+/*
+ * usage
+ *   DESCRIPTION: prints how to run the program and exits
+ *   INPUTS: none
+ *   OUTPUTS: message on stderr
+ *   RETURN VALUE: does not return
+ *   SIDE EFFECTS: none
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: createfs <directory> [-o <output file>] "
+			"[-i <spare inodes>] [-b <spare blocks>] [-e] [-z]\n");
+	exit(1);
+}
+
+/*
+ * scan_dir
+ *   DESCRIPTION: collects the regular files, character devices and
+ *                subdirectories of a source directory, after its "."
+ *                entry, and the subdirectories' contents in turn
+ *   INPUTS: dirname -- source directory
+ *           max -- most entries it may have, 0 for no limit
+ *           depth -- levels below the root
+ *   OUTPUTS: dir -- children and nchildren filled in
+ *   RETURN VALUE: 0, -1 if the directory can't be read
+ *   SIDE EFFECTS: skips entries that don't fit, with a message
+ */
+static int scan_dir(const char* dirname, entry_t* dir, int max, int depth)
+{
+	DIR* d;
+	struct dirent* de;
+	struct stat st;
+	entry_t* e;
+	char* path;
+
+	if((d = opendir(dirname)) == NULL) {
+		fprintf(stderr, "opendir: Directory %s does not exist\n", dirname);
+		return -1;
+	}
+	dir->children = calloc(1, sizeof(entry_t));
+	strcpy(dir->children[0].name, ".");
+	dir->children[0].type = TYPE_DIR;
+	dir->nchildren = 1;
+
+	while((de = readdir(d)) != NULL) {
+		/* ".", ".." and hidden files such as .svn */
+		if(de->d_name[0] == '.')
+			continue;
+		path = malloc(strlen(dirname) + strlen(de->d_name) + 2);
+		sprintf(path, "%s/%s", dirname, de->d_name);
+		if(stat(path, &st) == -1) {
+			perror("stat");
+			free(path);
+			continue;
+		}
+		if(dir->nchildren == max || strlen(de->d_name) > NAME_LEN ||
+				!(S_ISREG(st.st_mode) || S_ISCHR(st.st_mode) || S_ISDIR(st.st_mode)) ||
+				(S_ISDIR(st.st_mode) && depth == MAX_DEPTH) ||
+				(S_ISREG(st.st_mode) && st.st_size > (extents ? EXT_MAX_SIZE : INODE_BLOCKS * BLOCK_SIZE))) {
+			fprintf(stderr, "Could not create an entry for %s, skipping it...\n", path);
+			free(path);
+			continue;
+		}
+		dir->children = realloc(dir->children, (dir->nchildren + 1) * sizeof(entry_t));
+		e = &dir->children[dir->nchildren++];
+		memset(e, 0, sizeof(entry_t));
+		strcpy(e->name, de->d_name);
+		if(S_ISCHR(st.st_mode)) {
+			e->type = TYPE_RTC;
+			free(path);
+		} else if(S_ISDIR(st.st_mode)) {
+			e->type = TYPE_DIR;
+			if(scan_dir(path, e, 0, depth + 1) == -1)
+				dir->nchildren--;
+			else
+				e->size = e->nchildren * DENTRY_SIZE;
+			free(path);
+		} else {
+			e->type = TYPE_FILE;
+			e->path = path;
+			e->size = st.st_size;
+		}
+	}
+	closedir(d);
+	return 0;
+}
+
+/*
+ * count
+ *   DESCRIPTION: numbers the inodes of everything below a directory and
+ *                adds up the blocks their data takes
+ *   INPUTS: dir -- directory
+ *   OUTPUTS: inodes -- next free inode, advanced
+ *            blocks -- running total of data blocks
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets each file's and subdirectory's inode, and the
+ *                 inode of each subdirectory's "." entry
+ */
+static void count(entry_t* dir, uint32_t* inodes, uint32_t* blocks)
+{
+	entry_t* e;
+	int i;
+
+	for(i = 1; i < dir->nchildren; i++) {
+		e = &dir->children[i];
+		if(e->type == TYPE_RTC)
+			continue;
+		e->inode = (*inodes)++;
+		*blocks += (e->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		if(e->type == TYPE_DIR) {
+			e->children[0].inode = e->inode;
+			count(e, inodes, blocks);
+		}
+	}
+}
+
+/*
+ * read_file
+ *   DESCRIPTION: copies a source file into its data blocks
+ *   INPUTS: e -- the file's entry
+ *           dst -- first of its blocks in the image
+ *   OUTPUTS: the file's bytes at dst
+ *   RETURN VALUE: 0, -1 on a read error
+ *   SIDE EFFECTS: none
+ */
+static int read_file(entry_t* e, uint8_t* dst)
+{
+	FILE* f = fopen(e->path, "rb");
+
+	if(f == NULL) {
+		perror(e->path);
+		return -1;
+	}
+	if(fread(dst, 1, e->size, f) != e->size) {
+		perror(e->path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+/* writes a directory's entries, 64 bytes each, starting at dst */
+static void write_entries(entry_t* dir, uint8_t* dst)
+{
+	int i;
+
+	for(i = 0; i < dir->nchildren; i++) {
+		memcpy(dst + DENTRY_SIZE * i, dir->children[i].name, strlen(dir->children[i].name));
+		*(uint32_t*)(dst + DENTRY_SIZE * i + NAME_LEN) = dir->children[i].type;
+		*(uint32_t*)(dst + DENTRY_SIZE * i + NAME_LEN + 4) = dir->children[i].inode;
+	}
+}
+
+/*
+ * place
+ *   DESCRIPTION: Gives the data of everything below a directory one
+ *                contiguous run of blocks each, in order, and fills in
+ *                their inodes
+ *   INPUTS: dir -- directory
+ *           image -- the image
+ *           data -- its first data block
+ *   OUTPUTS: block -- next free data block, advanced
+ *   RETURN VALUE: 0, -1 on a read error
+ *   SIDE EFFECTS: none
+ */
+static int place(entry_t* dir, uint8_t* image, uint8_t* data, uint32_t* block)
+{
+	uint32_t* node;
+	uint32_t n, i;
+	entry_t* e;
+	int j;
+
+	for(j = 1; j < dir->nchildren; j++) {
+		e = &dir->children[j];
+		if(e->type == TYPE_RTC)
+			continue;
+		node = (uint32_t*)(image + BLOCK_SIZE * (1 + e->inode));
+		node[0] = e->size;
+		n = (e->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		if(e->type == TYPE_DIR)
+			write_entries(e, data + BLOCK_SIZE * *block);
+		else if(read_file(e, data + BLOCK_SIZE * *block) == -1)
+			return -1;
+
+		if(extents && n != 0) {
+			/* every file is one run, so one extent */
+			node[EXT_COUNT] = 1;
+			node[EXT_FIRST] = *block;
+			node[EXT_FIRST + 1] = n;
+		} else if(!extents) {
+			for(i = 0; i < n; i++)
+				node[1 + i] = *block + i;
+		}
+		*block += n;
+		if(e->type == TYPE_DIR && place(e, image, data, block) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * build_image
+ *   DESCRIPTION: Lays the image out: boot block, inodes (one per file
+ *                and subdirectory, then the spares), the bitmap blocks,
+ *                every file and subdirectory in one contiguous run of
+ *                blocks, then the spare blocks
+ *   INPUTS: root -- the source tree
+ *           spare_inodes, spare_blocks -- room left for the kernel
+ *   OUTPUTS: size -- image length in bytes
+ *   RETURN VALUE: the image, NULL on error
+ *   SIDE EFFECTS: none
+ */
+static uint8_t* build_image(entry_t* root, uint32_t spare_inodes, uint32_t spare_blocks, size_t* size)
+{
+	uint32_t num_inodes = 0, file_blocks = 0, bitmap_len = 1;
+	uint32_t data_blocks, block, i;
+	uint32_t* boot;
+	uint8_t* image;
+	uint8_t* data;
+	uint8_t* bitmap;
+
+	count(root, &num_inodes, &file_blocks);
+	num_inodes += spare_inodes;
+	while(bitmap_len * BITS_PER_BLOCK < bitmap_len + file_blocks + spare_blocks)
+		bitmap_len++;
+	data_blocks = bitmap_len + file_blocks + spare_blocks;
+
+	*size = (size_t)BLOCK_SIZE * (1 + num_inodes + data_blocks);
+	if((image = calloc(1, *size)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	boot = (uint32_t*)image;
+	data = image + BLOCK_SIZE * (1 + num_inodes);
+	bitmap = data;
+
+	boot[0] = root->nchildren;
+	boot[1] = num_inodes;
+	boot[2] = data_blocks;
+	boot[BOOT_MAGIC] = FS_MAGIC;
+	boot[BOOT_BITMAP] = 0;
+	boot[BOOT_BITMAP_LEN] = bitmap_len;
+	boot[BOOT_FEATURES] = extents ? FEATURE_EXTENTS : 0;
+	write_entries(root, image + DENTRY_SIZE);
+
+	block = bitmap_len;
+	if(place(root, image, data, &block) == -1) {
+		free(image);
+		return NULL;
+	}
+	for(i = 0; i < block; i++)
+		bitmap[i / 8] |= 1 << (i % 8);
+	return image;
+}
+
+/* writes an LZ4 length's extra bytes, for a length past the token's 15 */
+static uint32_t lz4_put_length(uint8_t* dst, uint32_t out, uint32_t len)
+{
+	for(len -= LZ4_RUN_MASK; len >= 255; len -= 255)
+		dst[out++] = 255;
+	dst[out++] = len;
+	return out;
+}
+
+/*
+ * lz4_sequence
+ *   DESCRIPTION: writes one LZ4 sequence: literals, then a match
+ *   INPUTS: lit -- the literals
+ *           nlit -- how many
+ *           offset -- how far back the match starts, 0 for none
+ *           mlen -- match length
+ *   OUTPUTS: dst -- the sequence at out
+ *   RETURN VALUE: out, advanced past it
+ *   SIDE EFFECTS: none
+ */
+static uint32_t lz4_sequence(uint8_t* dst, uint32_t out, const uint8_t* lit, uint32_t nlit,
+		uint32_t offset, uint32_t mlen)
+{
+	uint32_t token = out++;
+
+	dst[token] = (nlit < LZ4_RUN_MASK ? nlit : LZ4_RUN_MASK) << 4;
+	if(nlit >= LZ4_RUN_MASK)
+		out = lz4_put_length(dst, out, nlit);
+	memcpy(dst + out, lit, nlit);
+	out += nlit;
+	if(offset == 0)
+		return out;
+	dst[out++] = offset & 0xFF;
+	dst[out++] = offset >> 8;
+	mlen -= LZ4_MIN_MATCH;
+	dst[token] |= mlen < LZ4_RUN_MASK ? mlen : LZ4_RUN_MASK;
+	if(mlen >= LZ4_RUN_MASK)
+		out = lz4_put_length(dst, out, mlen);
+	return out;
+}
+
+/*
+ * lz4_compress
+ *   DESCRIPTION: compresses a buffer as one LZ4 block, greedily taking
+ *                the last earlier position with the same four bytes
+ *   INPUTS: src -- the data
+ *           len -- its length, at most BLOCK_SIZE
+ *   OUTPUTS: dst -- the block, LZ4_BOUND bytes of room
+ *   RETURN VALUE: compressed length
+ *   SIDE EFFECTS: none
+ */
+static uint32_t lz4_compress(const uint8_t* src, uint32_t len, uint8_t* dst)
+{
+	uint32_t table[1 << LZ4_HASH_BITS];
+	uint32_t ip = 0, anchor = 0, out = 0, ref, seq, h, mlen;
+
+	memset(table, 0, sizeof(table));
+	while(len >= LZ4_MFLIMIT && ip <= len - LZ4_MFLIMIT) {
+		memcpy(&seq, src + ip, 4);
+		h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+		ref = table[h];
+		table[h] = ip + 1;	/* 0 means empty */
+		if(ref == 0 || ip - (ref - 1) > LZ4_MAX_OFFSET || memcmp(src + ref - 1, src + ip, 4) != 0) {
+			ip++;
+			continue;
+		}
+		ref--;
+		for(mlen = LZ4_MIN_MATCH; ip + mlen < len - LZ4_LAST_LITERALS && src[ref + mlen] == src[ip + mlen]; mlen++);
+		out = lz4_sequence(dst, out, src + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	return lz4_sequence(dst, out, src + anchor, len - anchor, 0, 0);
+}
+
+/*
+ * compress_image
+ *   DESCRIPTION: Compresses every data block of an image on its own.
+ *                The inodes are kept; after them come data_blocks + 1
+ *                offsets of the blocks in the packed area that follows,
+ *                padded to a block. A block that doesn't shrink is
+ *                stored as is.
+ *   INPUTS: image -- image from build_image
+ *   OUTPUTS: size -- length in bytes, updated
+ *   RETURN VALUE: the compressed image, NULL on error
+ *   SIDE EFFECTS: frees image
+ */
+static uint8_t* compress_image(uint8_t* image, size_t* size)
+{
+	uint32_t* boot = (uint32_t*)image;
+	uint32_t num_inodes = boot[1], data_blocks = boot[2];
+	uint32_t head = BLOCK_SIZE * (1 + num_inodes);
+	uint32_t table_len = ((data_blocks + 1) * 4 + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+	uint8_t* data = image + head;
+	uint8_t* out;
+	uint32_t* table;
+	uint32_t pos = 0, n, i;
+
+	if((out = calloc(1, head + table_len + (size_t)data_blocks * LZ4_BOUND)) == NULL) {
+		perror("malloc");
+		free(image);
+		return NULL;
+	}
+	memcpy(out, image, head);
+	((uint32_t*)out)[BOOT_FEATURES] |= FEATURE_LZ4;
+	table = (uint32_t*)(out + head);
+
+	for(i = 0; i < data_blocks; i++) {
+		table[i] = pos;
+		n = lz4_compress(data + BLOCK_SIZE * i, BLOCK_SIZE, out + head + table_len + pos);
+		if(n >= BLOCK_SIZE) {
+			memcpy(out + head + table_len + pos, data + BLOCK_SIZE * i, BLOCK_SIZE);
+			n = BLOCK_SIZE;
+		}
+		pos += n;
+	}
+	table[data_blocks] = pos;
+	printf("%u data blocks, %u bytes compressed to %u\n", data_blocks,
+			data_blocks * BLOCK_SIZE, pos);
+
+	free(image);
+	*size = head + table_len + pos;
+	return out;
+}
+
+int main(int argc, char** argv)
+{
+	const char* out = "fs.out";
+	const char* src = NULL;
+	uint32_t spare_inodes = DEFAULT_SPARE_INODES;
+	uint32_t spare_blocks = DEFAULT_SPARE_BLOCKS;
+	entry_t root;
+	uint8_t* image;
+	size_t size;
+	FILE* f;
+	int i, c;
+
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			out = argv[++i];
+		else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			spare_inodes = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			spare_blocks = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(argv[i], "-e") == 0)
+			extents = 1;
+		else if(strcmp(argv[i], "-z") == 0)
+			compress = 1;
+		else if(argv[i][0] != '-' && src == NULL)
+			src = argv[i];
+		else
+			usage();
+	}
+	if(src == NULL)
+		usage();
+
+	if((f = fopen(out, "rb")) != NULL) {
+		fclose(f);
+		printf("open: Output file %s exists, do you want to overwrite?\n(y/n): ", out);
+		c = getchar();
+		if(c != 'y' && c != 'Y')
+			return 1;
+	}
+
+	memset(&root, 0, sizeof(root));
+	/* nothing can be added to a compressed image */
+	if(compress)
+		spare_inodes = spare_blocks = 0;
+	if(scan_dir(src, &root, MAX_DENTRIES, 0) == -1 ||
+			(image = build_image(&root, spare_inodes, spare_blocks, &size)) == NULL ||
+			(compress && (image = compress_image(image, &size)) == NULL))
+		return 1;
+	if((f = fopen(out, "wb")) == NULL || fwrite(image, 1, size, f) != size) {
+		perror(out);
+		return 1;
+	}
+	fclose(f);
+	free(image);
+	return 0;
+}
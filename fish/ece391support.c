@@ -51,3 +51,94 @@ ece391_strncmp (const uint8_t* s1, const uint8_t* s2, uint32_t n)
     return ((int32_t)*s1) - ((int32_t)*s2);
 }
 
+/*
+ * Heap allocator.  Small requests are rounded up to one of NUM_CLASSES
+ * power-of-two sizes and each size keeps its own free list, so malloc
+ * and free are constant time.  An empty list is refilled with a page
+ * from sbrk cut into blocks; the kernel only backs a page once it is
+ * touched.  Requests bigger than the largest class get their own
+ * page-rounded chunk, kept on a first-fit list once freed.
+ */
+#define MIN_BLOCK   16
+#define NUM_CLASSES 9		/* 16 bytes to 4KB */
+#define PAGE_SIZE   4096
+
+struct block {
+    uint32_t size;		/* usable bytes after the header */
+    struct block* next;		/* free list link while free */
+};
+
+static struct block* free_lists[NUM_CLASSES];
+static struct block* big_free;
+
+/* Cuts fresh heap into blocks of class c; returns 0 or -1 */
+static int32_t
+refill (int32_t c)
+{
+    uint32_t size = MIN_BLOCK << c;
+    uint32_t step = sizeof (struct block) + size;
+    uint32_t chunk = (step < PAGE_SIZE ? PAGE_SIZE : step);
+    uint8_t* mem = ece391_sbrk (chunk);
+    struct block* b;
+
+    if ((uint8_t*)-1 == mem)
+	return -1;
+    for (; chunk >= step; mem += step, chunk -= step) {
+	b = (struct block*)mem;
+	b->size = size;
+	b->next = free_lists[c];
+	free_lists[c] = b;
+    }
+    return 0;
+}
+
+void*
+ece391_malloc (uint32_t size)
+{
+    struct block** list;
+    struct block* b;
+    int32_t c;
+
+    if (0 == size)
+	return 0;
+    for (c = 0; c < NUM_CLASSES && (MIN_BLOCK << c) < size; c++);
+    if (c < NUM_CLASSES) {
+	if (0 == free_lists[c] && -1 == refill (c))
+	    return 0;
+	list = &free_lists[c];
+    } else {
+	size = ((size + sizeof (struct block) + PAGE_SIZE - 1) &
+		~(PAGE_SIZE - 1)) - sizeof (struct block);
+	for (list = &big_free; 0 != *list && (*list)->size < size;
+	     list = &(*list)->next);
+	if (0 == *list) {
+	    b = ece391_sbrk (sizeof (struct block) + size);
+	    if ((void*)-1 == b)
+		return 0;
+	    b->size = size;
+	    return b + 1;
+	}
+    }
+    b = *list;
+    *list = b->next;
+    return b + 1;
+}
+
+void
+ece391_free (void* ptr)
+{
+    struct block* b;
+    int32_t c;
+
+    if (0 == ptr)
+	return;
+    b = (struct block*)ptr - 1;
+    for (c = 0; c < NUM_CLASSES && (MIN_BLOCK << c) != b->size; c++);
+    if (c < NUM_CLASSES) {
+	b->next = free_lists[c];
+	free_lists[c] = b;
+    } else {
+	b->next = big_free;
+	big_free = b;
+    }
+}
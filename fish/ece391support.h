@@ -7,5 +7,7 @@ extern void ece391_fdputs (int32_t fd, const uint8_t* s);
 extern int32_t ece391_strcmp (const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp (const uint8_t* s1, const uint8_t* s2, 
 			       uint32_t n);
+extern void* ece391_malloc (uint32_t size);
+extern void ece391_free (void* ptr);
 
 #endif /* ECE391SUPPORT_H */
@@ -19,6 +19,67 @@ extern int32_t ece391_open (const uint8_t* filename);
 extern int32_t ece391_close (int32_t fd);
 extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
+extern int32_t ece391_ioctl (int32_t fd, uint32_t cmd, uint32_t arg);
+
+/*
+ * Waits until one of nfds file descriptors is ready, or for timeout
+ * milliseconds (0 returns at once, -1 waits forever).  Returns the
+ * number of entries with revents set, 0 on timeout.
+ */
+struct pollfd {
+	int32_t fd;
+	int16_t events;
+	int16_t revents;
+};
+
+enum poll_events {
+	POLLIN = 0x01,
+	POLLOUT = 0x04,
+	POLLERR = 0x08,
+	POLLHUP = 0x10,
+	POLLNVAL = 0x20
+};
+
+extern int32_t ece391_poll (struct pollfd* fds, int32_t nfds, int32_t timeout);
+
+/*
+ * pipe fills in fds[0] (read end) and fds[1] (write end).  dup2 makes
+ * newfd a copy of oldfd, closing newfd first.  spawn starts a program
+ * that inherits the caller's fds and returns its pid without waiting;
+ * wait collects a spawned child's exit status.
+ */
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_dup2 (int32_t oldfd, int32_t newfd);
+extern int32_t ece391_spawn (const uint8_t* command);
+extern int32_t ece391_wait (int32_t pid);
+
+/*
+ * fork starts a copy of the caller that shares its pages until one of
+ * them writes; it returns the child's pid to the parent and 0 to the
+ * child, which must be collected with wait.  exec replaces the
+ * caller's program and only returns (with -1) if it can't be run.
+ */
+extern int32_t ece391_fork (void);
+extern int32_t ece391_exec (const uint8_t* command);
+
+/*
+ * sbrk moves the end of the heap by increment bytes and returns the old
+ * end, or (void*)-1 if there is no room.  New heap pages read as zero.
+ */
+extern void* ece391_sbrk (int32_t increment);
+
+/*
+ * Terminal ioctl commands.  Canonical mode (the default) returns one
+ * edited line per read.  Raw mode returns keystrokes as they arrive
+ * without echo: the argument holds VMIN in bits 0-7 and VTIME (tenths
+ * of a second) in bits 8-15, so TTY_SETRAW with 0 gives non-blocking
+ * reads and with 1 gives one key at a time.
+ */
+enum tty_cmds {
+	TTY_SETCANON = 0,
+	TTY_SETRAW,
+	TTY_GETMODE
+};
 
 #endif /* ECE391SYSCALL_H */
 
@@ -10,6 +10,7 @@ uint8_t *mp1_set_video_mode (void);
 void add_frames(uint8_t *, uint8_t *, int32_t);
 void ece391_memset(void* memory, char c, int n);
 int32_t ece391_memcpy(void* dest, const void* src, int32_t n);
+int32_t wait_tick(int32_t rtc_fd, int *garbage);
 
 uint8_t file0[] = "frame0.txt";
 uint8_t file1[] = "frame1.txt";
@@ -18,14 +19,11 @@ uint8_t file1[] = "frame1.txt";
 extern int mp1_ioctl(unsigned long arg, unsigned long cmd);
 extern void mp1_rtc_tasklet(unsigned long trash);
 
-static struct mp1_blink_struct blink_array[80*25];
-
 int main(void)
 {
-    int rtc_fd, ret_val, i, garbage;
+    int rtc_fd, ret_val, i, garbage, quit = 0;
     struct mp1_blink_struct blink_struct;
-
-    ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
+    uint8_t keys[32];
 
     if(mp1_set_video_mode() == NULL) {
         return -1;
@@ -33,13 +31,16 @@ int main(void)
 
     rtc_fd = ece391_open("rtc");
 
+    /* Any key ends the animation early */
+    ece391_ioctl(0, TTY_SETRAW, 0);
+
     add_frames(file0, file1, rtc_fd);
 
     ret_val = 32;
     ret_val = ece391_write(rtc_fd, &ret_val, 4);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
+    for(i=0; i<WAIT && !quit; i++) {
+        quit = wait_tick(rtc_fd, &garbage);
         mp1_rtc_tasklet(garbage);
     }
 
@@ -51,28 +52,32 @@ int main(void)
 
     mp1_ioctl((unsigned long)&blink_struct, RTC_ADD);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
+    for(i=0; i<WAIT && !quit; i++) {
+        quit = wait_tick(rtc_fd, &garbage);
         mp1_rtc_tasklet(garbage);
     }
 
     mp1_ioctl((40 << 16 | (6*80+60)), RTC_SYNC);
 
-    for(i=0; i<WAIT; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
+    for(i=0; i<WAIT && !quit; i++) {
+        quit = wait_tick(rtc_fd, &garbage);
         mp1_rtc_tasklet(garbage);
     }
 
     blink_struct.location = 60;
     mp1_ioctl(i, RTC_REMOVE);
 
-    for(i=0; i<80*25; i++) {
-        ece391_read(rtc_fd, &garbage, 4);
+    for(i=0; i<80*25 && !quit; i++) {
+        quit = wait_tick(rtc_fd, &garbage);
         mp1_rtc_tasklet(garbage);
     }
 
     ece391_close(rtc_fd);
 
+    /* Throw away the key that stopped us so the shell doesn't see it */
+    while(ece391_read(0, keys, sizeof(keys)) > 0);
+    ece391_ioctl(0, TTY_SETCANON, 0);
+
     return 0;
 }
 
@@ -148,6 +153,31 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
     }
 }
 
+/*
+ * Blocks until the next RTC interrupt or a keypress, whichever comes
+ * first.  Returns 1 if a key was pressed.
+ */
+int32_t
+wait_tick(int32_t rtc_fd, int *garbage)
+{
+    struct pollfd fds[2];
+
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    fds[1].fd = rtc_fd;
+    fds[1].events = POLLIN;
+
+    if(ece391_poll(fds, 2, -1) < 0) {
+        ece391_read(rtc_fd, garbage, 4);
+        return 0;
+    }
+    if(fds[0].revents & POLLIN) {
+        return 1;
+    }
+    ece391_read(rtc_fd, garbage, 4);
+    return 0;
+}
+
 uint8_t*
 mp1_set_video_mode (void)
 {
@@ -160,19 +190,12 @@ mp1_set_video_mode (void)
 
 void* mp1_malloc(int32_t size)
 {
-    int32_t i;
-    for(i=0; i< 80*25; i++) {
-        if(blink_array[i].location == 0) {
-            return &blink_array[i];
-        }
-    }
-
-    return NULL;
+    return ece391_malloc(size);
 }
 
 void mp1_free(void* memory)
 {
-    ece391_memset(memory, 0, sizeof(struct mp1_blink_struct));
+    ece391_free(memory);
 }
 
 void ece391_memset(void* memory, char c, int n)
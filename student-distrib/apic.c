@@ -0,0 +1,293 @@
+/* apic.c - Local APIC and I/O APIC
+ * vim:ts=4 noexpandtab
+ */
+
+#include "apic.h"
+#include "linkage.h"
+#include "pit.h"
+#include "lib.h"
+
+#define LAPIC_REG(reg)	lapic[(reg) / 4]
+
+/* PIT ticks the timer calibration runs for */
+#define CALIBRATE_TICKS	5
+
+volatile uint32_t* lapic;
+volatile uint32_t* ioapic;
+uint32_t lapic_timer_count;
+
+/* Where each ISA IRQ arrives on the I/O APIC, and where it goes */
+static uint32_t irq_gsi[NUM_IRQS];
+static uint32_t irq_flags[NUM_IRQS];
+static uint32_t irq_dest[NUM_IRQS];
+static int32_t irq_overridden[NUM_IRQS];
+
+static void ioapic_enable(uint32_t irq);
+static void ioapic_disable(uint32_t irq);
+static void ioapic_eoi(uint32_t irq);
+static int32_t ioapic_set_affinity(uint32_t irq, uint32_t apic_id);
+
+irq_chip_t ioapic_chip = { (int8_t*)"I/O APIC", ioapic_enable, ioapic_disable, ioapic_eoi, ioapic_set_affinity };
+
+/* 
+ * lapic_init
+ *   DESCRIPTION: Enables the calling processor's local APIC with the
+ *                spurious vector set and every priority accepted. The
+ *                LINT pins are left as the BIOS set them, so the 8259
+ *                keeps reaching the bootstrap processor.
+ *   INPUTS: base -- physical (and virtual) address of the registers
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+lapic_init(uint32_t base)
+{
+	lapic = (volatile uint32_t*)base;
+	LAPIC_REG(LAPIC_SVR) = LAPIC_SVR_ENABLE | SPURIOUS_VECTOR;
+	LAPIC_REG(LAPIC_TPR) = 0;
+	/* The error status register is cleared by back-to-back writes */
+	LAPIC_REG(LAPIC_ESR) = 0;
+	LAPIC_REG(LAPIC_ESR) = 0;
+	LAPIC_REG(LAPIC_EOI) = 0;
+}
+
+/* 
+ * lapic_id
+ *   DESCRIPTION: Reads the calling processor's APIC ID
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: APIC ID, 0 without an APIC
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+lapic_id(void)
+{
+	if(lapic == NULL)
+		return 0;
+	return LAPIC_REG(LAPIC_ID) >> 24;
+}
+
+/* 
+ * lapic_eoi
+ *   DESCRIPTION: Acknowledges the interrupt being serviced
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+lapic_eoi(void)
+{
+	LAPIC_REG(LAPIC_EOI) = 0;
+}
+
+/* 
+ * lapic_send_ipi
+ *   DESCRIPTION: Sends an inter-processor interrupt
+ *   INPUTS: apic_id -- destination, ignored for shorthand destinations
+ *           icr -- low word of the command: vector, delivery mode and
+ *                  destination shorthand
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+lapic_send_ipi(uint32_t apic_id, uint32_t icr)
+{
+	while(LAPIC_REG(LAPIC_ICR_LO) & ICR_PENDING);
+	LAPIC_REG(LAPIC_ICR_HI) = apic_id << 24;
+	LAPIC_REG(LAPIC_ICR_LO) = icr;
+}
+
+/* 
+ * lapic_timer_calibrate
+ *   DESCRIPTION: Counts how far the timer runs down in a few PIT ticks,
+ *                so every processor's timer can tick at PIT_HZ. They all
+ *                run off the same bus clock, so one measurement will do.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be enabled; busy-waits 50ms
+ */
+void
+lapic_timer_calibrate(void)
+{
+	uint32_t start;
+
+	if(lapic == NULL)
+		return;
+	LAPIC_REG(LAPIC_TIMER_DIV) = LAPIC_TIMER_DIV_16;
+	LAPIC_REG(LAPIC_LVT_TIMER) = LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR;
+
+	/* Start on a tick boundary */
+	start = pit_ticks;
+	while(pit_ticks == start);
+	LAPIC_REG(LAPIC_TIMER_INIT) = 0xFFFFFFFF;
+	start = pit_ticks;
+	while(pit_ticks - start < CALIBRATE_TICKS);
+	lapic_timer_count = (0xFFFFFFFF - LAPIC_REG(LAPIC_TIMER_CUR)) / CALIBRATE_TICKS;
+	LAPIC_REG(LAPIC_TIMER_INIT) = 0;
+}
+
+/* 
+ * lapic_timer_start
+ *   DESCRIPTION: Makes the calling processor's timer fire every PIT tick
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+lapic_timer_start(void)
+{
+	if(lapic == NULL || lapic_timer_count == 0)
+		return;
+	LAPIC_REG(LAPIC_TIMER_DIV) = LAPIC_TIMER_DIV_16;
+	LAPIC_REG(LAPIC_LVT_TIMER) = LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR;
+	LAPIC_REG(LAPIC_TIMER_INIT) = lapic_timer_count;
+}
+
+/* 
+ * ioapic_read
+ *   DESCRIPTION: Reads an I/O APIC register
+ *   INPUTS: reg -- register number
+ *   OUTPUTS: none
+ *   RETURN VALUE: its value
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+ioapic_read(uint32_t reg)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	return ioapic[IOAPIC_WINDOW / 4];
+}
+
+/* 
+ * ioapic_write
+ *   DESCRIPTION: Writes an I/O APIC register
+ *   INPUTS: reg -- register number
+ *           val -- value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+ioapic_write(uint32_t reg, uint32_t val)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	ioapic[IOAPIC_WINDOW / 4] = val;
+}
+
+/* Records the I/O APIC if its registers are in the mapped APIC page */
+void
+ioapic_found(uint32_t base)
+{
+	if((base & 0xFFC00000) == APIC_MMIO_BASE && ioapic == NULL)
+		ioapic = (volatile uint32_t*)base;
+}
+
+/* Records an MP or ACPI interrupt source override for an ISA IRQ */
+void
+ioapic_override(uint32_t irq, uint32_t gsi, uint32_t flags)
+{
+	if(irq >= NUM_IRQS)
+		return;
+	irq_gsi[irq] = gsi;
+	irq_flags[irq] = flags;
+	irq_overridden[irq] = 1;
+}
+
+/* 
+ * ioapic_init
+ *   DESCRIPTION: Masks every redirection entry and fills in the routes
+ *                of the ISA IRQs that no table overrode: same pin as the
+ *                IRQ number, active high, edge triggered
+ *   INPUTS: apic_id -- processor the IRQs go to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+ioapic_init(uint32_t apic_id)
+{
+	uint32_t pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+	uint32_t i;
+
+	for(i = 0; i < pins; i++) {
+		ioapic_write(IOAPIC_REDIR(i), IOAPIC_MASKED);
+		ioapic_write(IOAPIC_REDIR(i) + 1, 0);
+	}
+	for(i = 0; i < NUM_IRQS; i++) {
+		if(!irq_overridden[i]) {
+			irq_gsi[i] = i;
+			irq_flags[i] = 0;
+		}
+		irq_dest[i] = apic_id;
+	}
+}
+
+/* 
+ * ioapic_route
+ *   DESCRIPTION: Writes an ISA IRQ's redirection entry: its own vector,
+ *                fixed delivery to one processor, the pin's polarity and
+ *                trigger mode
+ *   INPUTS: irq -- ISA IRQ
+ *           masked -- nonzero to leave it masked
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+ioapic_route(uint32_t irq, int32_t masked)
+{
+	uint32_t low = IRQ_VECTOR(irq);
+
+	if((irq_flags[irq] & IRQ_FLAGS_POLARITY) == IRQ_FLAGS_LOW)
+		low |= IOAPIC_ACTIVE_LOW;
+	if((irq_flags[irq] & IRQ_FLAGS_TRIGGER) == IRQ_FLAGS_LEVEL)
+		low |= IOAPIC_LEVEL;
+	if(masked)
+		low |= IOAPIC_MASKED;
+	/* Mask while the destination changes so nothing is half-written */
+	ioapic_write(IOAPIC_REDIR(irq_gsi[irq]), IOAPIC_MASKED);
+	ioapic_write(IOAPIC_REDIR(irq_gsi[irq]) + 1, irq_dest[irq] << 24);
+	ioapic_write(IOAPIC_REDIR(irq_gsi[irq]), low);
+}
+
+/* Enable (unmask) the specified IRQ */
+static void
+ioapic_enable(uint32_t irq)
+{
+	/* The cascade only means something on the 8259 */
+	if(irq >= NUM_IRQS || irq == IRQ_CASCADE)
+		return;
+	ioapic_route(irq, 0);
+}
+
+/* Disable (mask) the specified IRQ */
+static void
+ioapic_disable(uint32_t irq)
+{
+	if(irq >= NUM_IRQS || irq == IRQ_CASCADE)
+		return;
+	ioapic_route(irq, 1);
+}
+
+/* Send end-of-interrupt signal: one register write to the local APIC */
+static void
+ioapic_eoi(uint32_t irq)
+{
+	lapic_eoi();
+}
+
+/* Sends an IRQ to another processor, keeping its mask */
+static int32_t
+ioapic_set_affinity(uint32_t irq, uint32_t apic_id)
+{
+	uint32_t low = ioapic_read(IOAPIC_REDIR(irq_gsi[irq]));
+
+	irq_dest[irq] = apic_id;
+	ioapic_route(irq, (low & IOAPIC_MASKED) != 0);
+	return 0;
+}
@@ -0,0 +1,105 @@
+/* apic.h - Local APIC and I/O APIC
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+/* Default physical address of the local APIC; the MP/ACPI tables may
+ * say otherwise. The 4MB around it is mapped uncached at boot. */
+#define LAPIC_DEFAULT_BASE	0xFEE00000
+#define APIC_MMIO_BASE		0xFEC00000
+
+/* Register offsets */
+#define LAPIC_ID		0x020
+#define LAPIC_VERSION	0x030
+#define LAPIC_TPR		0x080
+#define LAPIC_EOI		0x0B0
+#define LAPIC_SVR		0x0F0
+#define LAPIC_ESR		0x280
+#define LAPIC_ICR_LO	0x300
+#define LAPIC_ICR_HI	0x310
+#define LAPIC_LVT_TIMER	0x320
+#define LAPIC_TIMER_INIT	0x380
+#define LAPIC_TIMER_CUR	0x390
+#define LAPIC_TIMER_DIV	0x3E0
+
+/* Spurious vector register: software enable bit */
+#define LAPIC_SVR_ENABLE	0x100
+
+/* Timer: divide the bus clock by 16, fire periodically */
+#define LAPIC_TIMER_DIV_16	0x3
+#define LAPIC_LVT_MASKED	0x00010000
+#define LAPIC_TIMER_PERIODIC	0x00020000
+
+/* I/O APIC registers, reached through the select and window registers */
+#define IOAPIC_REGSEL	0x00
+#define IOAPIC_WINDOW	0x10
+#define IOAPIC_VER		0x01
+#define IOAPIC_REDIR(n)	(0x10 + 2 * (n))
+
+/* Redirection entry fields */
+#define IOAPIC_ACTIVE_LOW	0x00002000
+#define IOAPIC_LEVEL		0x00008000
+#define IOAPIC_MASKED		0x00010000
+
+/* Polarity and trigger bits of an MP or ACPI interrupt override; 0
+ * means the bus default, which for ISA is active high and edge */
+#define IRQ_FLAGS_POLARITY	0x3
+#define IRQ_FLAGS_LOW		0x3
+#define IRQ_FLAGS_TRIGGER	0xC
+#define IRQ_FLAGS_LEVEL		0xC
+
+/* Interrupt command register fields */
+#define ICR_INIT		0x00000500
+#define ICR_STARTUP		0x00000600
+#define ICR_PENDING		0x00001000
+#define ICR_ASSERT		0x00004000
+#define ICR_LEVEL		0x00008000
+#define ICR_ALL_BUT_SELF	0x000C0000
+
+/* Vectors used by the local APIC */
+#define IPI_RESCHED_VECTOR	0xF0
+#define LAPIC_TIMER_VECTOR	0xF1
+#define IPI_INVLPG_VECTOR	0xF2
+#define SPURIOUS_VECTOR		0xFF
+
+#ifndef ASM
+
+#include "types.h"
+#include "irq.h"
+
+/* Virtual address of the local APIC registers, 0 if there is none */
+extern volatile uint32_t* lapic;
+/* Same for the I/O APIC handling the ISA IRQs, 0 if there is none */
+extern volatile uint32_t* ioapic;
+/* Timer count per PIT tick, 0 until lapic_timer_calibrate() */
+extern uint32_t lapic_timer_count;
+
+/* The I/O APIC as an irq_chip; EOIs go to the local APIC */
+extern irq_chip_t ioapic_chip;
+
+/* Points lapic at the registers and enables this processor's APIC */
+extern void lapic_init(uint32_t base);
+/* This processor's APIC ID */
+extern uint32_t lapic_id(void);
+/* Signals end of interrupt for an APIC-delivered vector */
+extern void lapic_eoi(void);
+/* Sends an interrupt command, waiting for the previous one to leave */
+extern void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+/* Measures the timer against the PIT; interrupts must be enabled */
+extern void lapic_timer_calibrate(void);
+/* Starts this processor's timer at PIT_HZ on LAPIC_TIMER_VECTOR */
+extern void lapic_timer_start(void);
+
+/* Records the I/O APIC found in the MP or ACPI tables */
+extern void ioapic_found(uint32_t base);
+/* Records that ISA IRQ irq arrives on pin gsi with the given flags */
+extern void ioapic_override(uint32_t irq, uint32_t gsi, uint32_t flags);
+/* Masks every pin and sends the ISA IRQs to apic_id once enabled */
+extern void ioapic_init(uint32_t apic_id);
+
+#endif /* ASM */
+
+#endif /* _APIC_H */
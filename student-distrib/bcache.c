@@ -0,0 +1,155 @@
+/* bcache.c - Decompressed data blocks of a compressed image
+ * vim:ts=4 noexpandtab
+ */
+
+#include "bcache.h"
+#include "lz4.h"
+#include "spinlock.h"
+#include "lib.h"
+
+#define BCACHE_HASH(block)	((block) % BCACHE_BUCKETS)
+#define BCACHE_NONE			-1
+
+typedef struct bcache_entry {
+	uint32_t block;
+	int16_t used;
+	int16_t next;		/* next entry in the bucket */
+	int16_t newer;		/* neighbours in the LRU list */
+	int16_t older;
+} bcache_entry_t;
+
+uint32_t bcache_hits;
+uint32_t bcache_misses;
+
+static uint8_t blocks[BCACHE_BLOCKS][BCACHE_BLOCK];
+static bcache_entry_t entries[BCACHE_BLOCKS];
+static int16_t buckets[BCACHE_BUCKETS];
+/* Ends of the LRU list; the oldest entry is the next one replaced */
+static int16_t newest;
+static int16_t oldest;
+static int32_t initialized;
+/* read_data runs on any CPU without fs_lock held */
+static spinlock_t bcache_lock = SPINLOCK_INIT("bcache");
+
+/*
+ * bcache_init
+ *   DESCRIPTION: empties every bucket and puts every entry on the LRU
+ *                list the first time the cache is used
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bcache_init(void)
+{
+	int32_t i;
+
+	for(i = 0; i < BCACHE_BUCKETS; i++)
+		buckets[i] = BCACHE_NONE;
+	for(i = 0; i < BCACHE_BLOCKS; i++)
+	{
+		entries[i].used = 0;
+		entries[i].newer = i - 1;
+		entries[i].older = (i == BCACHE_BLOCKS - 1) ? BCACHE_NONE : i + 1;
+	}
+	newest = 0;
+	oldest = BCACHE_BLOCKS - 1;
+	initialized = 1;
+}
+
+/* moves an entry to the new end of the LRU list */
+static void bcache_touch(int32_t e)
+{
+	if(e == newest)
+		return;
+	entries[entries[e].newer].older = entries[e].older;
+	if(e == oldest)
+		oldest = entries[e].newer;
+	else
+		entries[entries[e].older].newer = entries[e].newer;
+	entries[e].newer = BCACHE_NONE;
+	entries[e].older = newest;
+	entries[newest].newer = e;
+	newest = e;
+}
+
+/*
+ * bcache_fill
+ *   DESCRIPTION: decompresses a block into the entry used longest ago,
+ *                dropping the block it held
+ *   INPUTS: block -- data block number
+ *           src -- its LZ4 form
+ *           srclen -- bytes at src
+ *   OUTPUTS: none
+ *   RETURN VALUE: the entry, BCACHE_NONE if the block is damaged
+ *   SIDE EFFECTS: called with bcache_lock held; a damaged block leaves
+ *                 the entry unused and oldest
+ */
+static int32_t bcache_fill(uint32_t block, const uint8_t* src, uint32_t srclen)
+{
+	int32_t e = oldest;
+	int16_t * link;
+
+	if(entries[e].used)
+	{
+		link = &buckets[BCACHE_HASH(entries[e].block)];
+		while(*link != e)
+			link = &entries[*link].next;
+		*link = entries[e].next;
+		entries[e].used = 0;
+	}
+	if(lz4_decompress(src, srclen, blocks[e], BCACHE_BLOCK) != BCACHE_BLOCK)
+		return BCACHE_NONE;
+
+	entries[e].block = block;
+	entries[e].used = 1;
+	entries[e].next = buckets[BCACHE_HASH(block)];
+	buckets[BCACHE_HASH(block)] = e;
+	return e;
+}
+
+/*
+ * bcache_read
+ *   DESCRIPTION: copies part of a data block out of the cache,
+ *                decompressing it into the entry used longest ago the
+ *                first time
+ *   INPUTS: block -- data block number
+ *           src -- its LZ4 form, only read on a miss
+ *           srclen -- bytes at src
+ *           offset -- first byte wanted
+ *           n -- bytes wanted, no further than the end of the block
+ *   OUTPUTS: buf -- the bytes
+ *   RETURN VALUE: 0, -1 if the block doesn't decompress to a whole block
+ *   SIDE EFFECTS: the block becomes the newest in the cache
+ */
+int32_t bcache_read(uint32_t block, const uint8_t* src, uint32_t srclen,
+		uint32_t offset, uint8_t* buf, uint32_t n)
+{
+	int32_t e;
+
+	if(offset > BCACHE_BLOCK || n > BCACHE_BLOCK - offset)
+		return -1;
+	spin_lock(&bcache_lock);
+	if(!initialized)
+		bcache_init();
+	for(e = buckets[BCACHE_HASH(block)]; e != BCACHE_NONE; e = entries[e].next)
+	{
+		if(entries[e].block == block)
+			break;
+	}
+	if(e != BCACHE_NONE)
+		bcache_hits++;
+	else
+	{
+		bcache_misses++;
+		if((e = bcache_fill(block, src, srclen)) == BCACHE_NONE)
+		{
+			spin_unlock(&bcache_lock);
+			return -1;
+		}
+	}
+	bcache_touch(e);
+	memcpy(buf, blocks[e] + offset, n);
+	spin_unlock(&bcache_lock);
+	return 0;
+}
@@ -0,0 +1,26 @@
+/* bcache.h - Decompressed data blocks of a compressed image
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include "types.h"
+
+/* Blocks the cache keeps at once, and the size of each (a file system
+ * data block) */
+#define BCACHE_BLOCKS	64
+#define BCACHE_BUCKETS	32
+#define BCACHE_BLOCK	4096
+
+/* Reads the cache answered, and ones that decompressed the block */
+extern uint32_t bcache_hits;
+extern uint32_t bcache_misses;
+
+/* Copies n bytes at offset in data block block to buf. src is the
+ * block's LZ4 form, srclen bytes, decompressed if the block isn't
+ * cached. Returns 0, -1 if it doesn't decompress to a whole block. */
+extern int32_t bcache_read(uint32_t block, const uint8_t* src, uint32_t srclen,
+		uint32_t offset, uint8_t* buf, uint32_t n);
+
+#endif /* _BCACHE_H */
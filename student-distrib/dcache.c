@@ -0,0 +1,122 @@
+/* dcache.c - Directory entries found by earlier path walks
+ * vim:ts=4 noexpandtab
+ */
+
+#include "dcache.h"
+#include "lib.h"
+
+#define DCACHE_NONE		-1
+
+/* An entry of a directory, keyed by the directory and the entry's name */
+typedef struct dcache_entry {
+	uint32_t dir;
+	dentry_t dentry;
+	int16_t next;		/* next entry in the bucket */
+	int16_t used;
+} dcache_entry_t;
+
+uint32_t dcache_hits;
+uint32_t dcache_misses;
+
+static dcache_entry_t entries[DCACHE_SIZE];
+static int16_t buckets[DCACHE_BUCKETS];
+static int32_t initialized;
+/* Where the search for an entry to replace picks up */
+static int32_t hand;
+
+/*
+ * dcache_hash
+ *   DESCRIPTION: picks the bucket for a name in a directory
+ *   INPUTS: dir -- directory
+ *           name -- entry name, len bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: bucket number
+ *   SIDE EFFECTS: none
+ */
+static uint32_t dcache_hash(uint32_t dir, const uint8_t* name, uint32_t len)
+{
+	uint32_t h = dir;
+
+	while(len-- > 0)
+		h = h * 31 + *name++;
+	return h % DCACHE_BUCKETS;
+}
+
+/* returns nonzero if a stored 32 byte name is name, len bytes long */
+static int32_t name_equal(const uint8_t* fname, const uint8_t* name, uint32_t len)
+{
+	return strncmp((int8_t *)fname, (int8_t *)name, len) == 0 && (len == 32 || fname[len] == '\0');
+}
+
+/*
+ * dcache_lookup
+ *   DESCRIPTION: looks an entry up in the hash table
+ *   INPUTS: dir -- directory searched
+ *           name -- entry name, len bytes, not necessarily terminated
+ *   OUTPUTS: dentry -- copy of the entry on a hit
+ *   RETURN VALUE: 0 on a hit, -1 on a miss
+ *   SIDE EFFECTS: none
+ */
+int32_t dcache_lookup(uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry)
+{
+	int32_t e;
+
+	if(!initialized)
+	{
+		dcache_misses++;
+		return -1;
+	}
+	for(e = buckets[dcache_hash(dir, name, len)]; e != DCACHE_NONE; e = entries[e].next)
+	{
+		if(entries[e].dir == dir && name_equal(entries[e].dentry.fname, name, len))
+		{
+			dcache_hits++;
+			memcpy(dentry, &entries[e].dentry, sizeof(dentry_t));
+			return 0;
+		}
+	}
+	dcache_misses++;
+	return -1;
+}
+
+/*
+ * dcache_add
+ *   DESCRIPTION: adds an entry, replacing one round robin once the
+ *                cache is full
+ *   INPUTS: dir -- directory holding the entry
+ *           dentry -- the entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void dcache_add(uint32_t dir, const dentry_t* dentry)
+{
+	int16_t * link;
+	uint32_t len;
+	int32_t e, i;
+
+	if(!initialized)
+	{
+		for(i = 0; i < DCACHE_BUCKETS; i++)
+			buckets[i] = DCACHE_NONE;
+		initialized = 1;
+	}
+
+	e = hand;
+	hand = (hand + 1) % DCACHE_SIZE;
+	if(entries[e].used)
+	{
+		for(len = 0; len < 32 && entries[e].dentry.fname[len] != '\0'; len++);
+		link = &buckets[dcache_hash(entries[e].dir, entries[e].dentry.fname, len)];
+		while(*link != e)
+			link = &entries[*link].next;
+		*link = entries[e].next;
+	}
+
+	for(len = 0; len < 32 && dentry->fname[len] != '\0'; len++);
+	entries[e].dir = dir;
+	memcpy(&entries[e].dentry, dentry, sizeof(dentry_t));
+	entries[e].used = 1;
+	entries[e].next = buckets[dcache_hash(dir, dentry->fname, len)];
+	buckets[dcache_hash(dir, dentry->fname, len)] = e;
+}
@@ -0,0 +1,25 @@
+/* dcache.h - Directory entries found by earlier path walks
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _DCACHE_H
+#define _DCACHE_H
+
+#include "types.h"
+#include "filesys.h"
+
+/* Entries the cache keeps at once */
+#define DCACHE_SIZE		128
+#define DCACHE_BUCKETS	64
+
+/* Lookups the cache answered, and ones that searched the directory */
+extern uint32_t dcache_hits;
+extern uint32_t dcache_misses;
+
+/* Finds name (len bytes, not terminated) in directory dir. Returns 0
+ * and fills dentry on a hit, -1 on a miss. */
+extern int32_t dcache_lookup(uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry);
+/* Remembers that dir holds dentry */
+extern void dcache_add(uint32_t dir, const dentry_t* dentry);
+
+#endif /* _DCACHE_H */
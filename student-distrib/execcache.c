@@ -0,0 +1,341 @@
+/* execcache.c - Programs resolved and paged in by earlier executes
+ * vim:ts=4 noexpandtab
+ */
+
+#include "execcache.h"
+#include "filesys.h"
+#include "pagecache.h"
+#include "mm.h"
+#include "lib.h"
+
+/* ELF32 values the loader checks */
+#define ELF_CLASS32		1
+#define ELF_DATA_LSB	1
+#define ELF_TYPE_EXEC	2
+#define ELF_MACHINE_386	3
+#define PT_LOAD			1
+#define PF_W			0x2
+/* Program headers read at most; PT_LOAD ones past EXEC_MAX_SEGMENTS
+ * make the program unrunnable */
+#define ELF_MAX_PHDRS	8
+
+typedef struct elf_header {
+	uint8_t ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint32_t entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+} elf_header_t;
+
+typedef struct elf_phdr {
+	uint32_t type;
+	uint32_t offset;
+	uint32_t vaddr;
+	uint32_t paddr;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+	uint32_t align;
+} elf_phdr_t;
+
+uint32_t exec_cache_hits;
+uint32_t exec_cache_misses;
+
+static exec_image_t images[EXEC_CACHE_SIZE];
+/* Ticks on every lookup; the entry used longest ago is replaced */
+static uint32_t clock;
+
+/*
+ * image_drop_pages
+ *   DESCRIPTION: gives back the references an entry holds on its pages
+ *   INPUTS: img -- cache entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void image_drop_pages(exec_image_t* img)
+{
+	uint32_t i;
+
+	for(i = 0; i < img->npages; i++)
+		frame_put(img->frames[i]);
+	img->npages = 0;
+}
+
+/*
+ * image_fill
+ *   DESCRIPTION: builds an entry's page list from the page cache. The
+ *                pages are gathered on the side and only installed once
+ *                all are in: getting one can run memory out, and then
+ *                exec_cache_release drops every entry's list.
+ *   INPUTS: img -- cache entry without a page list, no bigger than
+ *                  EXEC_CACHE_PAGES
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: npages stays 0 if the list couldn't be built
+ */
+static void image_fill(exec_image_t* img)
+{
+	uint32_t frames[EXEC_CACHE_PAGES];
+	uint32_t i, n;
+
+	for(n = 0; n < img->file_pages; n++)
+	{
+		if(pcache_get(img->inode, n, &frames[n]) <= 0)
+		{
+			for(i = 0; i < n; i++)
+				frame_put(frames[i]);
+			return;
+		}
+	}
+	memcpy(img->frames, frames, n * sizeof(uint32_t));
+	img->npages = n;
+}
+
+/*
+ * image_page
+ *   DESCRIPTION: gets a file page of an image, from its page list if it
+ *                has one and from the page cache if not
+ *   INPUTS: img -- cache entry
+ *           index -- file page
+ *   OUTPUTS: frame -- the page, with a new reference for the caller
+ *   RETURN VALUE: 0, -1 if out of memory or the file is short
+ *   SIDE EFFECTS: none
+ */
+static int32_t image_page(exec_image_t* img, uint32_t index, uint32_t* frame)
+{
+	if(index < img->npages)
+	{
+		*frame = img->frames[index];
+		frame_get(*frame);
+		return 0;
+	}
+	return pcache_get(img->inode, index, frame) > 0 ? 0 : -1;
+}
+
+/*
+ * segment_map
+ *   DESCRIPTION: Maps the file part of a segment. Read-only segments
+ *                share the page cache's frames outright; writable ones
+ *                share them copy-on-write. A page the file part ends in
+ *                partway, with .bss after it, gets a private copy whose
+ *                tail is zeroed. The rest of .bss is below the break, so
+ *                it is zero-filled on first touch.
+ *   INPUTS: img -- cache entry
+ *           seg -- one of its segments
+ *           dir -- page directory being built
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if out of memory
+ *   SIDE EFFECTS: none
+ */
+static int32_t segment_map(exec_image_t* img, exec_segment_t* seg, uint32_t* dir)
+{
+	uint32_t file_end = seg->vaddr + seg->filesz;
+	uint32_t vaddr = seg->vaddr & ~(PAGE_SIZE - 1);
+	uint32_t index = seg->offset / PAGE_SIZE;
+	uint32_t flags = PTE_PRESENT | PTE_USER | (seg->writable ? PTE_COW : 0);
+	uint32_t frame, copy, keep;
+
+	for(; vaddr < file_end; vaddr += PAGE_SIZE, index++)
+	{
+		if(image_page(img, index, &frame) == -1)
+			return -1;
+		if(vaddr + PAGE_SIZE > file_end && seg->memsz > seg->filesz)
+		{
+			if((copy = frame_alloc()) == 0)
+			{
+				frame_put(frame);
+				return -1;
+			}
+			keep = file_end - vaddr;
+			memcpy((void *)copy, (void *)frame, keep);
+			memset((void *)(copy + keep), 0, PAGE_SIZE - keep);
+			frame_put(frame);
+			user_map(dir, vaddr, copy, seg->writable ? PTE_USER_RW : PTE_PRESENT | PTE_USER);
+		}
+		else
+			user_map(dir, vaddr, frame, flags);
+	}
+	return 0;
+}
+
+/*
+ * read_segments
+ *   DESCRIPTION: Reads and checks an ELF32 executable's header and
+ *                PT_LOAD segments. Segments must be in address order,
+ *                page-congruent with the file, between USER_IMAGE and
+ *                the stack, and must not share a page.
+ *   INPUTS: inode -- the file
+ *   OUTPUTS: img -- entry, inode, end, nsegs, segs and file_pages set
+ *   RETURN VALUE: 0, -1 if the file isn't an executable this can load
+ *   SIDE EFFECTS: none
+ */
+static int32_t read_segments(uint32_t inode, exec_image_t* img)
+{
+	elf_header_t hdr;
+	elf_phdr_t phdrs[ELF_MAX_PHDRS];
+	exec_segment_t* seg;
+	uint32_t i, len, end = USER_IMAGE, file_end = 0;
+
+	if(read_data(inode, 0, (uint8_t *)&hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+	if(hdr.ident[0] != 0x7F || hdr.ident[1] != 'E' || hdr.ident[2] != 'L' || hdr.ident[3] != 'F' ||
+			hdr.ident[4] != ELF_CLASS32 || hdr.ident[5] != ELF_DATA_LSB ||
+			hdr.type != ELF_TYPE_EXEC || hdr.machine != ELF_MACHINE_386 ||
+			hdr.phentsize != sizeof(elf_phdr_t) || hdr.phnum == 0 || hdr.phnum > ELF_MAX_PHDRS)
+		return -1;
+	len = hdr.phnum * sizeof(elf_phdr_t);
+	if(read_data(inode, hdr.phoff, (uint8_t *)phdrs, len) != len)
+		return -1;
+
+	img->nsegs = 0;
+	for(i = 0; i < hdr.phnum; i++)
+	{
+		if(phdrs[i].type != PT_LOAD || phdrs[i].memsz == 0)
+			continue;
+		if(img->nsegs == EXEC_MAX_SEGMENTS)
+			return -1;
+		seg = &img->segs[img->nsegs++];
+		seg->vaddr = phdrs[i].vaddr;
+		seg->offset = phdrs[i].offset;
+		seg->filesz = phdrs[i].filesz;
+		seg->memsz = phdrs[i].memsz;
+		seg->writable = phdrs[i].flags & PF_W;
+		if(seg->filesz > seg->memsz || seg->vaddr < end || seg->vaddr >= USER_STACK_LIMIT ||
+				seg->memsz > USER_STACK_LIMIT - seg->vaddr ||
+				seg->offset + seg->filesz < seg->offset ||
+				(seg->vaddr ^ seg->offset) & (PAGE_SIZE - 1))
+			return -1;
+		end = PAGE_ROUND_UP(seg->vaddr + seg->memsz);
+		if(seg->filesz != 0 && PAGE_ROUND_UP(seg->offset + seg->filesz) / PAGE_SIZE > file_end)
+			file_end = PAGE_ROUND_UP(seg->offset + seg->filesz) / PAGE_SIZE;
+	}
+	if(img->nsegs == 0 || hdr.entry < img->segs[0].vaddr || hdr.entry >= end)
+		return -1;
+
+	img->inode = inode;
+	img->entry = hdr.entry;
+	img->end = end;
+	img->file_pages = file_end;
+	return 0;
+}
+
+/*
+ * exec_cache_get
+ *   DESCRIPTION: looks a program up by name. A miss resolves the name in
+ *                the file system, reads its segments and takes over the
+ *                entry used longest ago.
+ *   INPUTS: name -- program name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the cache entry, NULL if name isn't an executable
+ *   SIDE EFFECTS: the entry is valid until the next lookup
+ */
+exec_image_t* exec_cache_get(const uint8_t* name)
+{
+	exec_image_t* img = &images[0];
+	exec_image_t parsed;
+	dentry_t dentry;
+	int32_t i;
+
+	clock++;
+	for(i = 0; i < EXEC_CACHE_SIZE; i++)
+	{
+		if(images[i].name[0] != '\0' && strncmp((int8_t *)images[i].name, (int8_t *)name, MAX_NAME + 1) == 0)
+		{
+			exec_cache_hits++;
+			images[i].last_used = clock;
+			return &images[i];
+		}
+		if(images[i].last_used < img->last_used)
+			img = &images[i];
+	}
+
+	exec_cache_misses++;
+	if(read_dentry_by_name(name, &dentry) == -1 || dentry.type != TYPE_FILE)
+		return NULL;
+	if(read_segments(dentry.inode_num, &parsed) == -1)
+		return NULL;
+
+	image_drop_pages(img);
+	*img = parsed;
+	img->npages = 0;
+	strncpy((int8_t *)img->name, (int8_t *)name, MAX_NAME);
+	img->name[MAX_NAME] = '\0';
+	img->last_used = clock;
+	return img;
+}
+
+/*
+ * exec_image_map
+ *   DESCRIPTION: Maps a program's segments. Every instance of a program
+ *                shares the same frames: text for good, data until a
+ *                process writes to it. .bss and the stack are left to
+ *                demand-zero faults.
+ *   INPUTS: img -- entry from exec_cache_get
+ *           dir -- page directory with an empty user page table
+ *   OUTPUTS: none
+ *   RETURN VALUE: end of the image, 0 if out of memory
+ *   SIDE EFFECTS: builds the entry's page list if it has none
+ */
+uint32_t exec_image_map(exec_image_t* img, uint32_t* dir)
+{
+	uint32_t i;
+
+	if(img->npages == 0 && img->file_pages <= EXEC_CACHE_PAGES)
+		image_fill(img);
+	for(i = 0; i < img->nsegs; i++)
+	{
+		if(segment_map(img, &img->segs[i], dir) == -1)
+			return 0;
+	}
+	return img->end;
+}
+
+/*
+ * exec_cache_invalidate
+ *   DESCRIPTION: drops the entry for a file that changed, so the next
+ *                execute reads its headers again
+ *   INPUTS: inode -- the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void exec_cache_invalidate(uint32_t inode)
+{
+	int32_t i;
+
+	for(i = 0; i < EXEC_CACHE_SIZE; i++)
+	{
+		if(images[i].name[0] != '\0' && images[i].inode == inode)
+		{
+			image_drop_pages(&images[i]);
+			images[i].name[0] = '\0';
+		}
+	}
+}
+
+/*
+ * exec_cache_release
+ *   DESCRIPTION: drops every page list, leaving the names resolved
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called when memory runs out, before the page cache
+ *                 reclaims pages nobody maps
+ */
+void exec_cache_release(void)
+{
+	int32_t i;
+
+	for(i = 0; i < EXEC_CACHE_SIZE; i++)
+		image_drop_pages(&images[i]);
+}
@@ -0,0 +1,57 @@
+/* execcache.h - Programs resolved and paged in by earlier executes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _EXECCACHE_H
+#define _EXECCACHE_H
+
+#include "types.h"
+#include "process.h"
+
+/* Programs the cache remembers */
+#define EXEC_CACHE_SIZE		8
+/* Largest image whose page list is kept, in pages; bigger ones are
+ * paged in through the page cache each time */
+#define EXEC_CACHE_PAGES	32
+/* Most PT_LOAD segments a program may have */
+#define EXEC_MAX_SEGMENTS	4
+
+/* A PT_LOAD segment: filesz bytes of file from offset, then zeros up
+ * to memsz */
+typedef struct exec_segment {
+	uint32_t vaddr;
+	uint32_t offset;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t writable;
+} exec_segment_t;
+
+/* A runnable program */
+typedef struct exec_image {
+	uint8_t name[MAX_NAME + 1];	/* empty if the entry is unused */
+	uint32_t inode;
+	uint32_t entry;
+	uint32_t end;				/* page after the last segment */
+	uint32_t nsegs;
+	exec_segment_t segs[EXEC_MAX_SEGMENTS];
+	uint32_t file_pages;		/* file pages the segments cover */
+	uint32_t npages;			/* pages in frames, 0 if not kept */
+	uint32_t frames[EXEC_CACHE_PAGES];	/* file pages, each holds a reference */
+	uint32_t last_used;
+} exec_image_t;
+
+/* Executes the cache answered, and ones that went to the file system */
+extern uint32_t exec_cache_hits;
+extern uint32_t exec_cache_misses;
+
+/* Finds a program by name, NULL if there is no such executable */
+extern exec_image_t* exec_cache_get(const uint8_t* name);
+/* Maps an image's segments in an empty user page table. Returns the
+ * end of the image, where the heap starts; 0 if out of memory. */
+extern uint32_t exec_image_map(exec_image_t* img, uint32_t* dir);
+/* Forgets a program whose file was written */
+extern void exec_cache_invalidate(uint32_t inode);
+/* Lets go of every kept page so the page cache can reclaim them */
+extern void exec_cache_release(void);
+
+#endif /* _EXECCACHE_H */
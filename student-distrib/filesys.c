@@ -1,87 +1,156 @@
 #include "filesys.h"
+#include "dcache.h"
+#include "pagecache.h"
+#include "execcache.h"
+#include "bcache.h"
+#include "spinlock.h"
 #include "lib.h"
 
+#define BLOCK_SIZE		4096
+#define DENTRY_SIZE		64
+#define MAX_DENTRIES	63		/* the boot block holds 64 entries, less the header */
+#define INODE_BLOCKS	1023	/* block numbers that fit after the length */
+#define MAX_FILE_SIZE	(INODE_BLOCKS * BLOCK_SIZE)
+
+/* Writable images have the magic in the boot block's first reserved
+ * word, followed by the data block the bitmap starts at and its length
+ * in blocks. Bit n of the bitmap is set when data block n is used. */
+#define FS_MAGIC		0x31393357	/* "W391" */
+#define BOOT_MAGIC		3
+#define BOOT_BITMAP		4
+#define BOOT_BITMAP_LEN	5
+#define BOOT_FEATURES	6
+
+/* With FEATURE_EXTENTS every inode holds the length, the number of
+ * extents and then (first block, blocks) pairs instead of a block list */
+#define FEATURE_EXTENTS	0x1
+#define EXT_COUNT		1
+#define EXT_FIRST		2
+#define MAX_EXTENTS		((BLOCK_SIZE / 4 - EXT_FIRST) / 2)
+#define EXT_MAX_SIZE	0x7FFFF000	/* lengths must fit an int32_t */
+
+/* With FEATURE_LZ4 the image is read only and each data block is LZ4
+ * compressed on its own. data_blocks + 1 byte offsets fill the blocks
+ * after the inodes; block n is the bytes between offsets n and n + 1 of
+ * the packed area that follows them, stored as is if that is a whole
+ * block. */
+#define FEATURE_LZ4		0x2
+#define LZ4_TABLE_BLOCKS	(((data_blocks + 1) * 4 + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+#define INODE(n)		((uint32_t *)(base_addr + BLOCK_SIZE * (1 + (n))))
+#define DATA_BLOCK(n)	((uint8_t *)(base_addr + BLOCK_SIZE * (1 + num_inodes + (n))))
+#define DENTRY(i)		((dentry_t *)(base_addr + DENTRY_SIZE * (1 + (i))))
+#define BLOCK_USED(n)	(bitmap[(n) / 8] & (1 << ((n) % 8)))
+
+/* A subdirectory is an inode whose data is DENTRY_SIZE records laid out
+ * like the boot block's entries, starting with its own "." entry.
+ * Inodes past MAX_INODES are never given to new files; MAX_DEPTH bounds
+ * the walk that finds the used ones. */
+#define MAX_INODES		8192
+#define MAX_DEPTH		8
+#define INODE_USED(n)	(inode_used[(n) / 8] & (1 << ((n) % 8)))
+
 
-static uint32_t bytes_read[64]; //keeps track of current file position
-static uint32_t dir_position; //keeps track of which file in the directory dir_read is on
 static uint32_t base_addr; //start file location
 static uint32_t dir_entries; //number of directory entries
 static uint32_t num_inodes; //number of inodes
 static uint32_t data_blocks; //number of data blocks
+static uint8_t * bitmap; //block bitmap, NULL if the image is read only
+static uint32_t extents; //nonzero if inodes hold extents
+static uint32_t max_size; //largest file the inode format allows
+static uint32_t * lz4_table; //block offsets, NULL if the image isn't compressed
+static uint8_t * lz4_packed; //compressed blocks
+static uint8_t inode_used[MAX_INODES / 8]; //inodes some directory entry refers to
+static spinlock_t fs_lock = SPINLOCK_INIT("filesys"); //guards the allocation state above; no interrupt handler reads files
 
-/* 
- * fopen
- *   DESCRIPTION:find directory entry for file(fname)
- *   INPUTS: filename
- *   OUTPUTS: none
- *   RETURN VALUE: returns index
+/*
+ * dir_entry
+ *   DESCRIPTION: reads an entry of a directory
+ *   INPUTS: dir -- FS_ROOT_DIR or a subdirectory's inode
+ *           index -- entry number
+ *   OUTPUTS: dentry -- the entry
+ *   RETURN VALUE: 0, -1 past the last entry
  *   SIDE EFFECTS: none
  */
-int32_t fopen(uint8_t* fname)
+static int32_t dir_entry(uint32_t dir, uint32_t index, dentry_t* dentry)
 {
-
-	int i = 0;
-	while(i<dir_entries && (strncmp((int8_t *)fname, (int8_t *)(base_addr +64 + i*64), strlen((int8_t *)fname)) != 0))
-		i++;
-
-	bytes_read[i] = 0;
-	/*file name exists*/
-	if(i < dir_entries)
-		return i;
-	else
+	if(dir == FS_ROOT_DIR)
+		return read_dentry_by_index(index, dentry);
+	if(read_data(dir, index * DENTRY_SIZE, (uint8_t *)dentry, sizeof(dentry_t)) != sizeof(dentry_t))
 		return -1;
+	return 0;
 }
 
-/* 
- * fread
- *   DESCRIPTION: data read to the end of the file or the end of the buffer provided, whichever occurs sooner.
- *   INPUTS: file descriptor
- *   OUTPUTS: data to buffer
- *   RETURN VALUE: 0 on success, -1 for failure
- *   SIDE EFFECTS: none
+/*
+ * dir_lookup
+ *   DESCRIPTION: finds a name in one directory, through the dentry cache
+ *   INPUTS: dir -- FS_ROOT_DIR or a subdirectory's inode
+ *           name -- len bytes, not necessarily terminated
+ *   OUTPUTS: dentry -- the entry
+ *   RETURN VALUE: 0, -1 if the directory has no such name
+ *   SIDE EFFECTS: a found entry is added to the cache
  */
-int32_t fread(uint32_t index,  uint8_t* buf, uint32_t nbytes)
+static int32_t dir_lookup(uint32_t dir, const uint8_t* name, uint32_t len, dentry_t* dentry)
 {
-	dentry_t  cur_dentry;
+	uint32_t i;
 
-    /*make sure index is in bounds of existing inodes*/
-	if(read_dentry_by_index(index, &cur_dentry) == -1)
+	/*names are at most 32 chars and not necessarily null terminated*/
+	if(len == 0 || len > 32)
 		return -1;
-	
-    int ret_bytes_read = bytes_read[index];
-    bytes_read[index] += read_data(cur_dentry.inode_num, bytes_read[index], buf, nbytes);
-	return bytes_read[index] - ret_bytes_read;
-}
-
-/* 
- * fwrite
- *   DESCRIPTION: read only file system, can't write
- *   INPUTS: file discriptor, data to be written, and how many bytes
- *   OUTPUTS: none
- *   RETURN VALUE: -1
- *   SIDE EFFECTS: none
- */
-int32_t fwrite(uint32_t index, const uint8_t* buf, uint32_t nbytes)
-{
+	if(dcache_lookup(dir, name, len, dentry) == 0)
+		return 0;
+	for(i = 0; dir_entry(dir, i, dentry) == 0; i++)
+	{
+		if(strncmp((int8_t *)dentry->fname, (int8_t *)name, len) == 0 && (len == 32 || dentry->fname[len] == '\0'))
+		{
+			dcache_add(dir, dentry);
+			return 0;
+		}
+	}
 	return -1;
 }
 
-/* 
- * fclose
- *   DESCRIPTION: does nothing
- *   INPUTS: file descriptor
- *   OUTPUTS: none
- *   RETURN VALUE:none 
+/*
+ * path_walk
+ *   DESCRIPTION: resolves a path one component at a time from the root
+ *                directory. Components are separated by '/'; "." names
+ *                the directory it is in.
+ *   INPUTS: path -- the path, len bytes
+ *   OUTPUTS: dentry -- what it names; the root has inode FS_ROOT_DIR
+ *   RETURN VALUE: 0, -1 if a component is missing or not a directory
  *   SIDE EFFECTS: none
  */
-int32_t fclose(int32_t index)
+static int32_t path_walk(const uint8_t* path, uint32_t len, dentry_t* dentry)
 {
-	return -1;
+	uint32_t n;
+
+	memset(dentry, 0, sizeof(dentry_t));
+	dentry->fname[0] = '.';
+	dentry->type = TYPE_DIR;
+	dentry->inode_num = FS_ROOT_DIR;
+
+	while(1)
+	{
+		while(len > 0 && *path == '/')
+		{
+			path++;
+			len--;
+		}
+		if(len == 0)
+			return 0;
+		if(dentry->type != TYPE_DIR)
+			return -1;
+		for(n = 0; n < len && path[n] != '/'; n++);
+		if(!(n == 1 && path[0] == '.') && dir_lookup(dentry->inode_num, path, n, dentry) == -1)
+			return -1;
+		path += n;
+		len -= n;
+	}
 }
 
 /*
  * read_dentry_by_name
- *   DESCRIPTION:  fill dentry with file name, type, and inode number based off file name
+ *   DESCRIPTION:  fill dentry with file name, type, and inode number based off its path
  *   INPUTS: filename, dentry to be written to
  *   OUTPUTS: none
  *   RETURN VALUE: 0 success, -1 if file not found
@@ -89,17 +158,9 @@ int32_t fclose(int32_t index)
  */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry)
 {
-	int i = 0;
-	uint32_t * compare = (uint32_t *)(base_addr+64);
-	while(i<dir_entries && (strncmp((int8_t *)fname, (int8_t *)compare[i*64], strlen((int8_t *)fname)) != 0))
-		i++;
-	if(i < dir_entries)
-	{
-		memcpy(dentry, (dentry_t *)(base_addr + 64 + i*64), 40);
-		return 0;
-	}
-	else
+	if(fname == NULL || dentry == NULL || fname[0] == '\0')
 		return -1;
+	return path_walk(fname, strlen((int8_t *)fname), dentry);
 }
 
 /*
@@ -121,53 +182,434 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry)
 		return -1;
 }
 
+/*
+ * inode_map
+ *   DESCRIPTION: finds the data block holding a block of a file
+ *   INPUTS: node -- the file's inode
+ *           index -- block number within the file
+ *   OUTPUTS: run -- how many blocks from there on are contiguous in the
+ *                   image, at least 1
+ *   RETURN VALUE: data block number, -1 if the file has no such block
+ *   SIDE EFFECTS: none
+ */
+static int32_t inode_map(uint32_t* node, uint32_t index, uint32_t* run)
+{
+	uint32_t * ext;
+	uint32_t i;
+
+	if(!extents)
+	{
+		if(index >= INODE_BLOCKS || node[index + 1] >= data_blocks)
+			return -1;
+		*run = 1;
+		return node[index + 1];
+	}
+	for(i = 0; i < node[EXT_COUNT] && i < MAX_EXTENTS; i++)
+	{
+		ext = &node[EXT_FIRST + 2 * i];
+		if(index < ext[1])
+		{
+			if(ext[0] + ext[1] > data_blocks)
+				return -1;
+			*run = ext[1] - index;
+			return ext[0] + index;
+		}
+		index -= ext[1];
+	}
+	return -1;
+}
+
+/*
+ * inode_append
+ *   DESCRIPTION: adds a block to the end of a file, growing its last
+ *                extent if the block follows it
+ *   INPUTS: node -- the file's inode
+ *           index -- number of blocks the file has now
+ *           block -- data block to add
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the inode has no room
+ *   SIDE EFFECTS: called with fs_lock held
+ */
+static int32_t inode_append(uint32_t* node, uint32_t index, uint32_t block)
+{
+	uint32_t * ext;
+
+	if(!extents)
+	{
+		if(index >= INODE_BLOCKS)
+			return -1;
+		node[index + 1] = block;
+		return 0;
+	}
+	if(node[EXT_COUNT] != 0)
+	{
+		ext = &node[EXT_FIRST + 2 * (node[EXT_COUNT] - 1)];
+		if(ext[0] + ext[1] == block)
+		{
+			ext[1]++;
+			return 0;
+		}
+	}
+	if(node[EXT_COUNT] == MAX_EXTENTS)
+		return -1;
+	ext = &node[EXT_FIRST + 2 * node[EXT_COUNT]];
+	ext[0] = block;
+	ext[1] = 1;
+	node[EXT_COUNT]++;
+	return 0;
+}
+
+/*
+ * block_copy
+ *   DESCRIPTION: copies part of a data block; blocks of compressed images
+ *                come through the block cache
+ *   INPUTS: block -- data block number
+ *           offset -- first byte wanted
+ *           n -- bytes wanted, which may run on into the following blocks
+ *                only if the image isn't compressed
+ *   OUTPUTS: buf -- the bytes
+ *   RETURN VALUE: 0, -1 if a compressed block is damaged
+ *   SIDE EFFECTS: none
+ */
+static int32_t block_copy(uint32_t block, uint32_t offset, uint8_t* buf, uint32_t n)
+{
+	uint32_t start, len;
+
+	if(lz4_table == NULL)
+	{
+		memcpy(buf, DATA_BLOCK(block) + offset, n);
+		return 0;
+	}
+	start = lz4_table[block];
+	len = lz4_table[block + 1] - start;
+	if(lz4_table[block + 1] < start || len > BLOCK_SIZE)
+		return -1;
+	if(len == BLOCK_SIZE)
+	{
+		memcpy(buf, lz4_packed + start + offset, n);
+		return 0;
+	}
+	return bcache_read(block, lz4_packed + start, len, offset, buf, n);
+}
+
 /* 
  * read_data
- *   DESCRIPTION: reads length # of bytes of file from beginning=offset and outputs to buffer
+ *   DESCRIPTION: reads length # of bytes of file from beginning=offset and outputs
+ *                to buffer, copying a run of contiguous blocks at a time,
+ *                or a block at a time from a compressed image
  *   INPUTS: inode, offset, buffer pointer, lenth(number of bits)
  *   OUTPUTS: writes data to buffer
- *   RETURN VALUE:-1 on failure, 0 on success
+ *   RETURN VALUE: bytes read, 0 at the end of the file, -1 on failure
  *   SIDE EFFECTS: none
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t nbytes)
 {
-  /*make sure inode is in bounds of existing inodes*/
-	if(inode > num_inodes || buf == NULL)
-		return -1;
+	uint32_t * node;
+	uint32_t length, pos, n, run, done;
+	int32_t block;
 
-	uint32_t * inode_block = (uint32_t *)(base_addr + 4096 + (inode * 4096)); //pointer to the current inode
-	uint8_t * data_block;
-	uint32_t data_block_num; //current data block page for file
-	uint32_t length = inode_block[0];
-	int i = offset;
+	/*make sure inode is in bounds of existing inodes*/
+	if(inode >= num_inodes || buf == NULL)
+		return -1;
+	node = INODE(inode);
+	length = node[0];
 
 	/*if file has been completely read, return blank buffer*/
 	if(offset >= length)
 	{
-        for(i=0; i<nbytes; i++)
-			buf[i] = 0;
-        return 0;
-    }
+		memset(buf, 0, nbytes);
+		return 0;
+	}
+	if(nbytes > length - offset)
+		nbytes = length - offset;
+
+	for(done = 0; done < nbytes; done += n)
+	{
+		pos = offset + done;
+		if((block = inode_map(node, pos / BLOCK_SIZE, &run)) == -1)
+			break;
+		if(lz4_table != NULL)
+			run = 1; /*compressed blocks come out of the cache one at a time*/
+		n = run * BLOCK_SIZE - pos % BLOCK_SIZE;
+		if(n > nbytes - done)
+			n = nbytes - done;
+		if(block_copy(block, pos % BLOCK_SIZE, buf + done, n) == -1)
+			break;
+	}
+	return done;
+}
+
+/*
+ * inode_length
+ *   DESCRIPTION: size of a file
+ *   INPUTS: inode
+ *   OUTPUTS: none
+ *   RETURN VALUE: length in bytes, -1 for a bad inode
+ *   SIDE EFFECTS: none
+ */
+int32_t inode_length(uint32_t inode)
+{
+	if(inode >= num_inodes)
+		return -1;
+	return INODE(inode)[0];
+}
+
+/*
+ * inode_block_addr
+ *   DESCRIPTION: finds a whole block of a file in the image, so it can be
+ *                mapped where it is
+ *   INPUTS: inode -- the file
+ *           index -- block number within the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the block, 0 if the file ends before the
+ *                 end of it or the image is compressed or isn't page
+ *                 aligned
+ *   SIDE EFFECTS: none
+ */
+uint32_t inode_block_addr(uint32_t inode, uint32_t index)
+{
+	uint32_t * node;
+	uint32_t run;
+	int32_t block;
+
+	if(inode >= num_inodes || lz4_table != NULL || base_addr % BLOCK_SIZE != 0)
+		return 0;
+	node = INODE(inode);
+	if(index >= node[0] / BLOCK_SIZE || (block = inode_map(node, index, &run)) == -1)
+		return 0;
+	return (uint32_t)DATA_BLOCK(block);
+}
+
+/*
+ * block_alloc
+ *   DESCRIPTION: Takes a free data block, zeroed. goal is used if it is
+ *                free; otherwise the first run of want free blocks is
+ *                started, or failing that the first free block taken, so
+ *                a file written in one go ends up contiguous.
+ *   INPUTS: goal -- block just after the file's last one
+ *           want -- blocks the caller still needs
+ *   OUTPUTS: none
+ *   RETURN VALUE: block number, -1 if the image is full
+ *   SIDE EFFECTS: called with fs_lock held
+ */
+static int32_t block_alloc(uint32_t goal, uint32_t want)
+{
+	int32_t first = -1, found = -1;
+	uint32_t n, run = 0;
+
+	if(goal < data_blocks && !BLOCK_USED(goal))
+		found = goal;
+	for(n = 0; found == -1 && n < data_blocks; n++)
+	{
+		if(BLOCK_USED(n))
+		{
+			run = 0;
+			continue;
+		}
+		if(first == -1)
+			first = n;
+		if(++run == want)
+			found = n + 1 - want;
+	}
+	if(found == -1)
+		found = first;
+	if(found == -1)
+		return -1;
+
+	bitmap[found / 8] |= 1 << (found % 8);
+	memset(DATA_BLOCK(found), 0, BLOCK_SIZE);
+	return found;
+}
+
+/*
+ * write_data
+ *   DESCRIPTION: Writes into a file at offset, allocating the blocks it
+ *                grows into. Cached pages and programs of the file are
+ *                dropped so later reads and executes see the new data.
+ *   INPUTS: inode -- file
+ *           offset -- where to start, at most the file's length
+ *           buf -- kernel or checked user buffer
+ *           nbytes -- bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: bytes written, less than nbytes if the image or the
+ *                 inode filled up or a block of the file is missing;
+ *                 -1 if nothing could be written
+ *   SIDE EFFECTS: the image in memory is updated in place
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t nbytes)
+{
+	uint32_t * node;
+	uint32_t end, have, need, pos, n, run, done, goal = 0;
+	int32_t block;
+
+	if(bitmap == NULL || inode >= num_inodes || buf == NULL || offset >= max_size)
+		return -1;
+	if(nbytes == 0)
+		return 0;
+	node = INODE(inode);
+	end = (nbytes > max_size - offset) ? max_size : offset + nbytes;
 
-	while((i - offset) < nbytes && i < length) 
+	spin_lock(&fs_lock);
+	have = (node[0] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	need = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if(have != 0 && (block = inode_map(node, have - 1, &run)) != -1)
+		goal = block + 1;
+	for(; have < need; have++, goal = block + 1)
+	{
+		block = block_alloc(goal, need - have);
+		if(block == -1)
+			break;
+		if(inode_append(node, have, block) == -1)
 		{
+			bitmap[block / 8] &= ~(1 << (block % 8));
+			break;
+		}
+	}
+	/*stop at the last block that could be had*/
+	if(end > have * BLOCK_SIZE)
+		end = have * BLOCK_SIZE;
+	if(end > node[0])
+		node[0] = end;
+	spin_unlock(&fs_lock);
+	if(end <= offset)
+		return -1;
+
+	for(done = 0; offset + done < end; done += n)
+	{
+		pos = offset + done;
+		if((block = inode_map(node, pos / BLOCK_SIZE, &run)) == -1)
+			break;
+		n = run * BLOCK_SIZE - pos % BLOCK_SIZE;
+		if(n > end - pos)
+			n = end - pos;
+		memcpy(DATA_BLOCK(block) + pos % BLOCK_SIZE, buf + done, n);
+	}
+
+	pcache_invalidate(inode);
+	exec_cache_invalidate(inode);
+	return done != 0 ? done : -1;
+}
+
+/*
+ * inode_free
+ *   DESCRIPTION: takes an inode no directory entry refers to
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: inode number, -1 if all are used
+ *   SIDE EFFECTS: called with fs_lock held
+ */
+static int32_t inode_free(void)
+{
+	uint32_t inode;
+
+	for(inode = 0; inode < num_inodes && inode < MAX_INODES; inode++)
+	{
+		if(!INODE_USED(inode))
+		{
+			inode_used[inode / 8] |= 1 << (inode % 8);
+			return inode;
+		}
+	}
+	return -1;
+}
+
+/*
+ * inode_mark_dir
+ *   DESCRIPTION: marks the inodes of a directory's files and
+ *                subdirectories used, and theirs in turn
+ *   INPUTS: dir -- FS_ROOT_DIR or a subdirectory's inode
+ *           depth -- levels below the root
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void inode_mark_dir(uint32_t dir, uint32_t depth)
+{
+	dentry_t entry;
+	uint32_t i;
+
+	for(i = 0; dir_entry(dir, i, &entry) == 0; i++)
+	{
+		/*the root's "." and devices don't own their inode*/
+		if(entry.type == TYPE_RTC || entry.inode_num >= num_inodes ||
+				entry.inode_num >= MAX_INODES || (entry.type == TYPE_DIR && entry.fname[0] == '.'))
+			continue;
+		inode_used[entry.inode_num / 8] |= 1 << (entry.inode_num % 8);
+		if(entry.type == TYPE_DIR && depth < MAX_DEPTH)
+			inode_mark_dir(entry.inode_num, depth + 1);
+	}
+}
+
+/*
+ * fs_create
+ *   DESCRIPTION: adds an empty file to a directory: the boot block for
+ *                the root, the end of its data for a subdirectory
+ *   INPUTS: fname -- path whose last component, 1 to 32 characters, is
+ *                    the new name
+ *   OUTPUTS: dentry -- the new file's entry
+ *   RETURN VALUE: 0 on success, -1 if the name is bad or taken, the image
+ *                 is read only or it has no free entry or inode
+ *   SIDE EFFECTS: none
+ */
+int32_t fs_create(const uint8_t* fname, dentry_t* dentry)
+{
+	uint32_t len = strlen((int8_t *)fname);
+	const uint8_t * name = fname + len;
+	uint8_t record[DENTRY_SIZE];
+	dentry_t parent, existing;
+	dentry_t * entry = (dentry_t *)record;
+	int32_t inode;
+
+	while(name > fname && name[-1] != '/')
+		name--;
+	len = fname + len - name;
+	if(bitmap == NULL || len == 0 || len > 32 ||
+			path_walk(fname, name - fname, &parent) == -1 || parent.type != TYPE_DIR ||
+			dir_lookup(parent.inode_num, name, len, &existing) == 0)
+		return -1;
+
+	memset(record, 0, DENTRY_SIZE);
+	strncpy((int8_t *)entry->fname, (int8_t *)name, len);
+	entry->type = TYPE_FILE;
+
+	spin_lock(&fs_lock);
+	if((parent.inode_num == FS_ROOT_DIR && dir_entries == MAX_DENTRIES) || (inode = inode_free()) == -1)
+	{
+		spin_unlock(&fs_lock);
+		return -1;
+	}
+	entry->inode_num = inode;
+	INODE(inode)[0] = 0;
+	INODE(inode)[EXT_COUNT] = 0;
+	if(parent.inode_num == FS_ROOT_DIR)
+	{
+		memcpy(DENTRY(dir_entries), record, DENTRY_SIZE);
+		dir_entries++;
+		((uint32_t *)base_addr)[0] = dir_entries;
+	}
+	spin_unlock(&fs_lock);
 
-		data_block_num = inode_block[i/4096+1]; //current data block number
-		/*number of nodes + boot_block node + data block #*/
-		data_block = (uint8_t *)(base_addr + 4096 + (num_inodes + data_block_num) * 4096);
-		
-		buf[i - offset] = data_block[i % 4096]; 
-		i++;
+	if(parent.inode_num != FS_ROOT_DIR &&
+			write_data(parent.inode_num, inode_length(parent.inode_num), record, DENTRY_SIZE) != DENTRY_SIZE)
+	{
+		/*a partial record is left past the last whole one and never read*/
+		spin_lock(&fs_lock);
+		inode_used[inode / 8] &= ~(1 << (inode % 8));
+		spin_unlock(&fs_lock);
+		return -1;
 	}
 
-	return i - offset;
+	pcache_invalidate(inode);
+	exec_cache_invalidate(inode);
+	memcpy(dentry, entry, sizeof(dentry_t));
+	return 0;
 }
 
 /**********************************Directory operations**********************************************/
 
 /* 
  * dir_open
- *   DESCRIPTION: only one directory that is initialized in init function
+ *   DESCRIPTION: nothing to set up; each fd keeps its own position
  *   INPUTS: directory name 
  *   OUTPUTS: none
  *   RETURN VALUE: returns 0 on success and -1 on failure
@@ -184,31 +626,72 @@ int32_t dir_open(uint8_t* dir_name)
  *				  should be provided (as much as fits, or all 32 bytes), and
  *				  subsequent reads should read from successive directory entries 
  *				  until the last is reached, at which point read should repeatedly return 0.
- *   INPUTS: file descriptor, buffer, and bytes to be read
- *   OUTPUTS: data to buffer
- *   RETURN VALUE: 0 on success, -1 for failure
+ *   INPUTS: directory (FS_ROOT_DIR or a subdirectory's inode), the fd's position,
+ *           buffer, and bytes to be read
+ *   OUTPUTS: data to buffer, position advanced
+ *   RETURN VALUE: bytes of name copied, 0 after the last entry, -1 for failure
  *   SIDE EFFECTS: none
  */
-int32_t dir_read(uint32_t fd,  uint8_t* buf, uint32_t nbytes)
+int32_t dir_read(uint32_t dir, uint32_t* pos, uint8_t* buf, uint32_t nbytes)
 {
+	dentry_t  cur_dentry;
+	uint32_t len;
+
 	if(buf == NULL)
 		return -1;
-
-    if(dir_position >= dir_entries)
-        return 0;
-
-	dentry_t  cur_dentry;
-	read_dentry_by_index(dir_position, &cur_dentry);
+	if(dir_entry(dir, *pos, &cur_dentry) == -1)
+		return 0;
+	(*pos)++; //increment position
 
     /*bound file name to 32 chars*/
-    if(nbytes >32)
-        nbytes = 32;
+	for(len = 0; len < 32 && cur_dentry.fname[len] != '\0'; len++);
+    if(nbytes > len)
+        nbytes = len;
 
     /*copy file name*/
     memcpy(buf, &cur_dentry, nbytes);
-	
-	dir_position++; //increment position
-	return 0;
+	return nbytes;
+}
+
+/*
+ * dir_getdents
+ *   DESCRIPTION: Fills a buffer with as many directory records as fit,
+ *                starting at the fd's position. Each is a dirent_t
+ *                followed by the name and a NUL, padded to 4 bytes.
+ *   INPUTS: dir -- FS_ROOT_DIR or a subdirectory's inode
+ *           pos -- the fd's position
+ *           buf -- checked user buffer
+ *           nbytes -- its size
+ *   OUTPUTS: records to buf, position advanced past them
+ *   RETURN VALUE: bytes filled, 0 after the last entry, -1 if the next
+ *                 record doesn't fit
+ *   SIDE EFFECTS: none
+ */
+int32_t dir_getdents(uint32_t dir, uint32_t* pos, uint8_t* buf, uint32_t nbytes)
+{
+	dentry_t entry;
+	dirent_t * rec;
+	uint32_t used = 0, len, reclen;
+
+	while(dir_entry(dir, *pos, &entry) == 0)
+	{
+		for(len = 0; len < 32 && entry.fname[len] != '\0'; len++);
+		reclen = (sizeof(dirent_t) + len + 1 + 3) & ~3;
+		if(reclen > nbytes - used)
+			return used == 0 ? -1 : used;
+
+		rec = (dirent_t *)(buf + used);
+		rec->inode = entry.inode_num;
+		rec->size = (entry.type == TYPE_RTC) ? 0 : inode_length(entry.inode_num);
+		rec->reclen = reclen;
+		rec->type = entry.type;
+		rec->namelen = len;
+		memcpy(rec + 1, entry.fname, len);
+		memset((uint8_t *)(rec + 1) + len, 0, reclen - sizeof(dirent_t) - len);
+		used += reclen;
+		(*pos)++;
+	}
+	return used;
 }
 
 /* 
@@ -237,25 +720,80 @@ int32_t dir_close(int32_t ignore)
 	return -1;
 }
 
-void filesys_init(const uint32_t location)
+/*
+ * lz4_table_ok
+ *   DESCRIPTION: checks a compressed image's block table once, so reads
+ *                can trust it: the offsets must never go down, no block
+ *                may be bigger than BLOCK_SIZE, and the last offset must
+ *                be inside the module
+ *   INPUTS: length -- bytes in the image module
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the table is good, 0 if not
+ *   SIDE EFFECTS: lz4_table must be set
+ */
+static int32_t lz4_table_ok(uint32_t length)
 {
-	uint32_t * temp = (uint32_t *)location;
-	dir_position = 1; //skip directory name
-	base_addr = location;
-	dir_entries = temp[0];
-	num_inodes = temp[1];
-	data_blocks	= temp[2];
+	uint32_t head, n;
+
+	/*bounds first, so the sums below can't wrap*/
+	if(num_inodes >= length / BLOCK_SIZE || data_blocks >= length / 4)
+		return 0;
+	head = BLOCK_SIZE * (1 + num_inodes + LZ4_TABLE_BLOCKS);
+	if(head > length)
+		return 0;
+	for(n = 0; n < data_blocks; n++)
+	{
+		if(lz4_table[n + 1] < lz4_table[n] || lz4_table[n + 1] - lz4_table[n] > BLOCK_SIZE)
+			return 0;
+	}
+	return lz4_table[data_blocks] <= length - head;
 }
 
 /* 
- * loader
- *   DESCRIPTION: loads program into specified address
- *   INPUTS: inode, address to start loading
- *   OUTPUTS: loaded program into ram
- *   RETURN VALUE:bytes loaded
+ * filesys_init
+ *   DESCRIPTION: reads the boot block of the image; images createfs
+ *                marked writable also get their block bitmap and may
+ *                use extent inodes, unless they are compressed, which
+ *                makes them read only
+ *   INPUTS: location -- address of the image module
+ *           length -- its size in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-int32_t load(uint32_t inode, uint32_t address)
+void filesys_init(const uint32_t location, const uint32_t length)
 {
-	return read_data(inode, 0, address,  0x400000); //read entire program file
+	uint32_t * temp = (uint32_t *)location;
+	base_addr = location;
+	dir_entries = temp[0];
+	num_inodes = temp[1];
+	data_blocks	= temp[2];
+
+	bitmap = NULL;
+	extents = 0;
+	lz4_table = NULL;
+	max_size = MAX_FILE_SIZE;
+	if(temp[BOOT_MAGIC] != FS_MAGIC)
+		return;
+	if(temp[BOOT_FEATURES] & FEATURE_EXTENTS)
+	{
+		extents = 1;
+		max_size = EXT_MAX_SIZE;
+	}
+	if(temp[BOOT_FEATURES] & FEATURE_LZ4)
+	{
+		lz4_table = (uint32_t *)DATA_BLOCK(0);
+		lz4_packed = DATA_BLOCK(LZ4_TABLE_BLOCKS);
+		/*a damaged table would send reads past the module; with no
+		 *data blocks every read of file data fails instead*/
+		if(!lz4_table_ok(length))
+			data_blocks = 0;
+		return;
+	}
+	if(temp[BOOT_BITMAP] < data_blocks &&
+			temp[BOOT_BITMAP_LEN] * BLOCK_SIZE * 8 >= data_blocks &&
+			temp[BOOT_BITMAP_LEN] <= data_blocks - temp[BOOT_BITMAP])
+		bitmap = DATA_BLOCK(temp[BOOT_BITMAP]);
+	if(bitmap != NULL)
+		inode_mark_dir(FS_ROOT_DIR, 0);
 }
@@ -3,6 +3,14 @@
 
 #include "types.h"
 
+/*dentry types*/
+#define TYPE_RTC	0
+#define TYPE_DIR	1
+#define TYPE_FILE	2
+
+/*inode number read_dentry_by_name gives the root directory*/
+#define FS_ROOT_DIR	0xFFFFFFFF
+
 /*data entries within boot block*/
 typedef struct dentry
 {
@@ -11,23 +19,23 @@ typedef struct dentry
 	uint32_t inode_num;
 }dentry_t;
 
+/*entry 0 of every directory is its own ".", which listings start past*/
+#define DIR_FIRST	1
 
-/*initializes directory*/
-extern void filesys_init(const uint32_t location);
-
-/*********************all file operations*********************************************/
-
-/*find directory entry for file(fname)*/
-extern int32_t fopen(uint8_t* fname);
-/*data read to the end of the file or the end of the buffer provided, whichever occurs sooner*/
-extern int32_t fread(uint32_t index, uint8_t* buf, uint32_t nbytes);
-/* read only file system, can't write*/
-extern int32_t fwrite(uint32_t index, const uint8_t* buf, uint32_t nbytes);
-/*does nothing*/
-extern int32_t fclose(int32_t index);
-
+/*record dir_getdents writes for each entry, followed by the name, a NUL
+ and padding to reclen; must match syscalls/ece391syscall.h*/
+typedef struct dirent
+{
+	uint32_t inode;
+	uint32_t size;		/*file length in bytes, 0 for devices*/
+	uint16_t reclen;	/*bytes from this record to the next*/
+	uint8_t type;
+	uint8_t namelen;
+}dirent_t;
 
 
+/*initializes directory*/
+extern void filesys_init(const uint32_t location, const uint32_t length);
 
 /*fill dentry with file name, type, and inode number*/
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
@@ -35,16 +43,23 @@ int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 /*reads length # of bytes of file from beginning=offset and outputs to buffer*/
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t nbytes);
-
-/*loads program image from disk blocks into contiguous physical memory*/
-extern int32_t load(uint32_t inode_pntr, uint32_t address);
+/*writes nbytes at offset, allocating blocks; returns bytes written or -1*/
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t nbytes);
+/*returns the file's length in bytes, -1 for a bad inode*/
+int32_t inode_length(uint32_t inode);
+/*address of a whole block of a file in the image, 0 if it has none*/
+uint32_t inode_block_addr(uint32_t inode, uint32_t index);
+/*adds an empty file, on images createfs made writable*/
+int32_t fs_create(const uint8_t* fname, dentry_t* dentry);
 
 /*******************all directory operations******************************************/
 
-/*only one directory that is initialized in init function*/
+/*starts reading a directory over*/
 extern int32_t dir_open(uint8_t* dir_name);
-/*reads file names in directory*/
-extern int32_t dir_read(uint32_t inode, uint8_t* buf, uint32_t nbytes);
+/*reads the next file name in directory, advancing pos*/
+extern int32_t dir_read(uint32_t dir, uint32_t* pos, uint8_t* buf, uint32_t nbytes);
+/*fills buf with as many dirent_t records as fit, advancing pos*/
+extern int32_t dir_getdents(uint32_t dir, uint32_t* pos, uint8_t* buf, uint32_t nbytes);
 /*does nothing*/
 extern int32_t dir_write(uint32_t inode, const uint8_t* buf, uint32_t nbytes);
 /*does nothing*/
@@ -0,0 +1,200 @@
+/* fpu.c - Lazy x87/SSE state switching
+ *
+ * Each processor's FPU registers belong to at most one process, its
+ * owner. A context switch only sets CR0.TS; the first FPU or SSE
+ * instruction after that raises #NM, which loads the current process's
+ * state. A process that never touches the FPU never pays for it, and
+ * one that runs alone keeps its registers loaded.
+ *
+ * A process can move to another processor, whose #NM handler cannot
+ * reach the old processor's registers, so a process that used the FPU
+ * has its state saved when it is switched out. The registers stay valid
+ * for it as long as it does not run on another processor in between,
+ * which fpu_cpu tracks.
+ * vim:ts=4 noexpandtab
+ */
+
+#include "fpu.h"
+#include "process.h"
+#include "smp.h"
+#include "lib.h"
+
+#define CR0_MP		0x02	/* WAIT obeys TS */
+#define CR0_EM		0x04	/* no FPU: must be clear */
+#define CR0_TS		0x08	/* next FPU instruction raises #NM */
+#define CR0_NE		0x20	/* report errors through #MF */
+#define CR4_OSFXSR	0x200	/* FXSAVE/FXRSTOR and SSE enabled */
+#define CR4_OSXMMEXCPT	0x400	/* unmasked SSE errors raise #XM */
+
+/* State a process starts with: FNINIT plus the default MXCSR */
+static uint8_t fpu_initial[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+#define fxsave(buf)		asm volatile("fxsave (%0)" : : "r"(buf) : "memory")
+#define fxrstor(buf)	asm volatile("fxrstor (%0)" : : "r"(buf) : "memory")
+#define clts()			asm volatile("clts")
+
+/* 
+ * stts
+ *   DESCRIPTION: Sets CR0.TS so the next FPU instruction traps
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+stts(void)
+{
+	uint32_t cr0;
+
+	asm volatile("movl %%cr0, %0" : "=r"(cr0));
+	if(!(cr0 & CR0_TS))
+		asm volatile("movl %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+/* 
+ * fpu_cpu_init
+ *   DESCRIPTION: Turns on the calling processor's FPU and SSE
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: leaves the registers clean and CR0.TS set
+ */
+void
+fpu_cpu_init(void)
+{
+	uint32_t cr0, cr4;
+
+	asm volatile("movl %%cr0, %0" : "=r"(cr0));
+	cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE;
+	asm volatile("movl %0, %%cr0" : : "r"(cr0));
+	asm volatile("movl %%cr4, %0" : "=r"(cr4));
+	asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+
+	asm volatile("fninit");
+	this_cpu()->fpu_owner = NULL;
+	stts();
+}
+
+/* 
+ * fpu_init
+ *   DESCRIPTION: Turns on the bootstrap processor's FPU and SSE and
+ *                records the clean state new processes start from
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: leaves CR0.TS set
+ */
+void
+fpu_init(void)
+{
+	fpu_cpu_init();
+	clts();
+	fxsave(fpu_initial);
+	stts();
+}
+
+/* 
+ * fpu_switch
+ *   DESCRIPTION: Saves prev's registers if it used the FPU since it was
+ *                switched in, then arms the #NM trap unless next's state
+ *                is still in this processor's registers
+ *   INPUTS: prev -- process being switched out
+ *           next -- process about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fpu_switch(pcb_t* prev, pcb_t* next)
+{
+	cpu_t* cpu = this_cpu();
+	uint32_t cr0;
+
+	asm volatile("movl %%cr0, %0" : "=r"(cr0));
+	if(!(cr0 & CR0_TS) && prev == cpu->fpu_owner && prev->fpu_cpu == cpu->id)
+		fxsave(prev->fpu_state);
+
+	if(next == cpu->fpu_owner && next->fpu_cpu == cpu->id)
+		clts();
+	else
+		stts();
+}
+
+/* 
+ * fpu_trap
+ *   DESCRIPTION: Loads the current process's state, or the clean state
+ *                on its first use. The old owner's state was saved when
+ *                it was switched out.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: current becomes the owner
+ */
+void
+fpu_trap(void)
+{
+	cpu_t* cpu = this_cpu();
+
+	clts();
+	if(current == cpu->idle ||
+			(cpu->fpu_owner == current && current->fpu_cpu == cpu->id))
+		return;
+	if(current->fpu_used)
+		fxrstor(current->fpu_state);
+	else
+		fxrstor(fpu_initial);
+	current->fpu_used = 1;
+	current->fpu_restores++;
+	current->fpu_cpu = cpu->id;
+	cpu->fpu_owner = current;
+}
+
+/* 
+ * fpu_fork
+ *   DESCRIPTION: Copies the parent's FPU state to a new child, saving it
+ *                from the registers first if the parent owns them
+ *   INPUTS: child -- new process
+ *           parent -- process being forked
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fpu_fork(pcb_t* child, pcb_t* parent)
+{
+	uint32_t flags;
+
+	child->fpu_restores = 0;
+	cli_and_save(flags);
+	if(this_cpu()->fpu_owner == parent && parent->fpu_cpu == this_cpu()->id) {
+		/* The parent is running, so TS is clear */
+		fxsave(parent->fpu_state);
+	}
+	child->fpu_used = parent->fpu_used;
+	if(child->fpu_used)
+		memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+	restore_flags(flags);
+}
+
+/* 
+ * fpu_release
+ *   DESCRIPTION: Forgets a process's FPU state; its next use starts clean
+ *   INPUTS: p -- process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: arms the #NM trap if p is running
+ */
+void
+fpu_release(pcb_t* p)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	p->fpu_used = 0;
+	p->fpu_cpu = -1;
+	if(this_cpu()->fpu_owner == p) {
+		this_cpu()->fpu_owner = NULL;
+		stts();
+	}
+	restore_flags(flags);
+}
@@ -0,0 +1,28 @@
+/* fpu.h - Lazy x87/SSE state switching
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+
+/* Size of an FXSAVE image; it must be 16 byte aligned */
+#define FPU_STATE_SIZE	512
+
+struct pcb;
+
+/* Enables the FPU and SSE with CR0.TS set, so the first use traps */
+extern void fpu_init(void);
+/* Same for an application processor */
+extern void fpu_cpu_init(void);
+/* Called on every context switch from prev to next */
+extern void fpu_switch(struct pcb* prev, struct pcb* next);
+/* #NM handler: hands the FPU to the current process */
+extern void fpu_trap(void);
+/* Gives a forked child a copy of the parent's state */
+extern void fpu_fork(struct pcb* child, struct pcb* parent);
+/* Throws a process's state away, on exec or halt */
+extern void fpu_release(struct pcb* p);
+
+#endif /* _FPU_H */
@@ -6,10 +6,17 @@
 #include "lib.h"
 
 /* Interrupt masks to determine which interrupts
- * are enabled and disabled */
+ * are enabled and disabled. They mirror what the PICs hold, so changing
+ * one is a single port write instead of a read and a write. */
 uint8_t master_mask; /* IRQs 0-7 */
 uint8_t slave_mask; /* IRQs 8-15 */
 
+static void i8259_enable(uint32_t irq_num);
+static void i8259_disable(uint32_t irq_num);
+static void i8259_eoi(uint32_t irq_num);
+
+irq_chip_t i8259_chip = { (int8_t*)"8259", i8259_enable, i8259_disable, i8259_eoi, NULL };
+
 /* Initialize the 8259 PIC */
 void
 i8259_init(void)
@@ -39,56 +46,42 @@ i8259_init(void)
 // Same implementation as http://wiki.osdev.org/8259_PIC
 // w/ appropriate modifications
 /* Enable (unmask) the specified IRQ */
-void
-enable_irq(uint32_t irq_num)
+static void
+i8259_enable(uint32_t irq_num)
 {
-	uint32_t irqshift;
-	uint16_t port;
-	uint8_t value;
-	irqshift=irq_num;
-	//Find which port irq_num corresponds w/
+	//Remove the mask on given irq from the cached mask and write it out
 	if(irq_num<8)
 	{
-		port=MASTER_8259_PORT+1;
+		master_mask&=~(1<<irq_num);
+		outb(master_mask,MASTER_8259_PORT+1);
 	}
 	else
 	{
-		port=SLAVE_8259_PORT+1;
-		irqshift-=8;
+		slave_mask&=~(1<<(irq_num-8));
+		outb(slave_mask,SLAVE_8259_PORT+1);
 	}
-	//Get the current masks and remove the mask on given irq
-	value=inb(port)&~(1<<irqshift);
-	//Write mask to port
-	outb(value,port);
 }
 
 /* Disable (mask) the specified IRQ */
-void
-disable_irq(uint32_t irq_num)
+static void
+i8259_disable(uint32_t irq_num)
 {
-	uint32_t irqshift;
-	uint16_t port;
-	uint8_t value;
-	irqshift=irq_num;
-	//Find which port irq_num corresponds w/
+	//Add the mask on given irq to the cached mask and write it out
 	if(irq_num<8)
 	{
-		port=MASTER_8259_PORT+1;
+		master_mask|=1<<irq_num;
+		outb(master_mask,MASTER_8259_PORT+1);
 	}
 	else
 	{
-		port=SLAVE_8259_PORT+1;
-		irqshift-=8;
+		slave_mask|=1<<(irq_num-8);
+		outb(slave_mask,SLAVE_8259_PORT+1);
 	}
-	//Get the current masks and add the new mask on given irq
-	value=inb(port)|(1<<irqshift);
-	//Write mask to port
-	outb(value,port);
 }
 
 /* Send end-of-interrupt signal for the specified IRQ */
-void
-send_eoi(uint32_t irq_num)
+static void
+i8259_eoi(uint32_t irq_num)
 {
 	//Find which port irq_num corresponds w/ and send EOI
 	if(irq_num<8)
@@ -102,4 +95,3 @@ send_eoi(uint32_t irq_num)
 		outb(EOI|(2),MASTER_8259_PORT);
 	}
 }
-
@@ -3,11 +3,17 @@
 	holds func definitions for all handlers in the IDT
 */
 #include "lib.h"
-#include "i8259.h"
+#include "irq.h"
+#include "apic.h"
 #include "idthandlers.h"
 #include "terminal.h"
 #include "types.h"
 #include "rtc.h"
+#include "pit.h"
+#include "sched.h"
+#include "process.h"
+#include "mm.h"
+#include "signal.h"
 
 /* Exception Handlers */
 void divide_error()
@@ -117,6 +123,44 @@ void page_fault()
 	printf("PAGE FAULT EXCEPTION AT ADDRESS: 0x%x", fault_address);
 	while(1);
 }
+/* Copy-on-write and stack faults are fixed up; anything else is a
+ * SEGFAULT for a user program. The kernel faulting on a user address
+ * mm_fault can't back, e.g. when frames run out, kills the program it
+ * was working for; a fault on a kernel address is fatal. */
+void do_page_fault(hw_context_t* regs)
+{
+	uint32_t fault_address;
+	asm volatile("movl %%cr2, %0" : "=r"(fault_address));
+	if(current->page_dir != NULL && mm_fault(current->page_dir, fault_address, regs->error_code, current->brk) == 0)
+		return;
+	if(regs->cs & 3) {
+		signal_raise(current, SIG_SEGFAULT);
+		return;
+	}
+	if(fault_address >= USER_VIRT && fault_address < USER_VIRT + USER_PAGE_SIZE &&
+			current->page_dir != (uint32_t*)KERNEL_PAGE_DIR) {
+		sti();
+		process_exit(SIG_KILL_STATUS);
+	}
+	page_fault();
+}
+/* A fault in a user program raises DIV_ZERO for arithmetic errors and
+ * SEGFAULT for the rest, delivered on the way back out. Faults in the
+ * kernel, and NMIs, double faults and machine checks anywhere, stop the
+ * machine as before. */
+void do_exception(hw_context_t* regs)
+{
+	uint32_t vector = regs->vector;
+
+	if((regs->cs & 3) && vector != 2 && vector != 8 && vector != 18) {
+		if(vector == 0 || vector == 16 || vector == 19)
+			signal_raise(current, SIG_DIV_ZERO);
+		else
+			signal_raise(current, SIG_SEGFAULT);
+		return;
+	}
+	ehandlers[vector]();
+}
 void none()
 {
 }
@@ -172,57 +216,35 @@ funcarray ehandlers[]=
 	simd_coprocessor_error
 };
 
-/* System Call handler */
-void systemcall()
-{
-	printf("Systemcall Interrupt\n");
-}
-
-/* IRQ Handlers */
+/* IRQ Handlers, called from the entry points in linkage.S */
 void timer_chip()
 {
-	printf("Timer Chip Interrupt\n");
-	//test_interrupts();
+	pit_intr();
 	send_eoi(0);
+	sched_tick();
+	signal_tick();
 }
+/* Entered through an interrupt gate, so interrupts are already off and
+ * the exit path turns them back on */
 void keyboard()
 {
-	
-	asm("pushal"); // WE MUST CHANGE THIS!!!!! (TALK TO BEN)
 	uint16_t temp;
 	
-	cli();
 	temp=inb(0x60);
 	send_eoi(1);
 	
 	keyboard_input(temp);
-	sti();
-	asm("popal \n \
-		leave \n \
-		iret");
-	
+}
+/* Local APIC timer: each processor's own quantum clock */
+void lapic_timer()
+{
+	lapic_eoi();
+	sched_local_tick();
 }
 void rt_clock()
 {
-	asm("pushal"); // WE MUST CHANGE THIS!!!!! (TALK TO BEN)
-	uint8_t temp;
-
-	cli();
-	outb(0x8C,0x70);
-	temp = inb(0x71);
-	rtc_intr(temp);
+	rtc_intr();
 	send_eoi(8);
-	sti();
-
-	asm("popal \n \
-		leave \n \
-		iret");
 }
-funcarray irqhandlers[]=
-{
-	timer_chip,
-	keyboard,
-	rt_clock
-};
 
 
@@ -1,11 +1,19 @@
 #ifndef _IDTHANDLERS_H
 #define _IDTHANDLERS_H
 
+#include "linkage.h"
+
 
 typedef void (*funcarray)();
 extern funcarray ehandlers[];
-extern funcarray irqhandlers[];
-extern void systemcall();
+/* IRQ handlers, entered through linkage.S */
+extern void timer_chip();
+extern void keyboard();
+extern void rt_clock();
+extern void lapic_timer();
+/* Exceptions and page faults, entered through linkage.S */
+extern void do_exception(hw_context_t* regs);
+extern void do_page_fault(hw_context_t* regs);
 
 #endif
 
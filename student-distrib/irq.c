@@ -0,0 +1,93 @@
+/* irq.c - Interrupt controller selection: I/O APIC or 8259
+ * vim:ts=4 noexpandtab
+ */
+
+#include "irq.h"
+#include "i8259.h"
+#include "apic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "lib.h"
+
+irq_chip_t* irq_chip = &i8259_chip;
+
+/* Guards the cached 8259 masks and the I/O APIC's select/window pair */
+static spinlock_t irq_lock = SPINLOCK_INIT("irq");
+
+/*
+ * irq_init
+ *   DESCRIPTION: Picks the interrupt controller. With an I/O APIC every
+ *                8259 line stays masked and each IRQ is routed to its own
+ *                vector on the bootstrap processor; otherwise the 8259
+ *                keeps doing the job.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: every IRQ is masked afterwards
+ */
+void
+irq_init(void)
+{
+	uint32_t irq, flags;
+
+	if(lapic == NULL || ioapic == NULL)
+		return;
+	flags = spin_lock_irqsave(&irq_lock);
+	for(irq = 0; irq < NUM_IRQS; irq++)
+		i8259_chip.disable(irq);
+	ioapic_init(cpus[0].apic_id);
+	irq_chip = &ioapic_chip;
+	spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+/* Enable (unmask) the specified IRQ */
+void
+enable_irq(uint32_t irq_num)
+{
+	uint32_t flags = spin_lock_irqsave(&irq_lock);
+
+	irq_chip->enable(irq_num);
+	spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+/* Disable (mask) the specified IRQ */
+void
+disable_irq(uint32_t irq_num)
+{
+	uint32_t flags = spin_lock_irqsave(&irq_lock);
+
+	irq_chip->disable(irq_num);
+	spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+/* Send end-of-interrupt signal for the specified IRQ. No lock: each
+ * chip's EOI is self-contained register writes. */
+void
+send_eoi(uint32_t irq_num)
+{
+	irq_chip->eoi(irq_num);
+}
+
+/*
+ * irq_set_affinity
+ *   DESCRIPTION: Delivers an IRQ to a given processor
+ *   INPUTS: irq_num -- ISA IRQ
+ *           cpu -- index in cpus[]
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the controller can't or cpu is not online
+ *   SIDE EFFECTS: none
+ */
+int32_t
+irq_set_affinity(uint32_t irq_num, int32_t cpu)
+{
+	uint32_t flags;
+	int32_t ret;
+
+	if(irq_chip->set_affinity == NULL || irq_num >= NUM_IRQS ||
+			cpu < 0 || cpu >= ncpus || !cpus[cpu].online)
+		return -1;
+	flags = spin_lock_irqsave(&irq_lock);
+	ret = irq_chip->set_affinity(irq_num, cpus[cpu].apic_id);
+	spin_unlock_irqrestore(&irq_lock, flags);
+	return ret;
+}
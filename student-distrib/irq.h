@@ -0,0 +1,41 @@
+/* irq.h - Interrupt controller selection: I/O APIC or 8259
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include "types.h"
+
+/* Number of ISA IRQ lines; IRQ n always arrives on IRQ_VECTOR(n) */
+#define NUM_IRQS	16
+/* The slave 8259's line on the master; nothing to route on an APIC */
+#define IRQ_CASCADE	2
+
+/* Operations jump table for an interrupt controller */
+typedef struct irq_chip {
+	const int8_t* name;
+	void (*enable)(uint32_t irq);
+	void (*disable)(uint32_t irq);
+	void (*eoi)(uint32_t irq);
+	/* Sends the IRQ to one processor; NULL if the chip can't */
+	int32_t (*set_affinity)(uint32_t irq, uint32_t apic_id);
+} irq_chip_t;
+
+/* Controller in use, the 8259 until irq_init() finds an I/O APIC */
+extern irq_chip_t* irq_chip;
+
+/* Switches to the I/O APIC if smp_init() found one, masking the 8259 */
+extern void irq_init(void);
+
+/* Enable (unmask) the specified IRQ */
+extern void enable_irq(uint32_t irq_num);
+/* Disable (mask) the specified IRQ */
+extern void disable_irq(uint32_t irq_num);
+/* Send end-of-interrupt signal for the specified IRQ */
+extern void send_eoi(uint32_t irq_num);
+/* Delivers an IRQ to processor cpu from now on; -1 if the controller
+ * only delivers to the bootstrap processor */
+extern int32_t irq_set_affinity(uint32_t irq_num, int32_t cpu);
+
+#endif /* _IRQ_H */
@@ -6,14 +6,25 @@
 #include "x86_desc.h"
 #include "lib.h"
 #include "i8259.h"
+#include "irq.h"
 #include "debug.h"
 
 #include "test.h"
 #include "idthandlers.h"
 #include "paging.h"
+#include "mm.h"
+#include "fpu.h"
 #include "rtc.h"
 #include "terminal.h"
 #include "filesys.h"
+#include "pit.h"
+#include "linkage.h"
+#include "syscall.h"
+#include "process.h"
+#include "sched.h"
+#include "apic.h"
+#include "smp.h"
+#include "workqueue.h"
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
@@ -24,6 +35,8 @@ void
 entry (unsigned long magic, unsigned long addr)
 {
 	uint32_t fileptr;// start of file system
+	uint32_t fileend = 0;// end of file system
+	uint32_t mem_top = USER_VIRT;// end of physical memory, if the loader doesn't say
 	multiboot_info_t *mbi;
 
 	/* Initialize the screen. */
@@ -43,9 +56,11 @@ entry (unsigned long magic, unsigned long addr)
 	printf ("flags = 0x%#x\n", (unsigned) mbi->flags);
 
 	/* Are mem_* valid? */
-	if (CHECK_FLAG (mbi->flags, 0))
+	if (CHECK_FLAG (mbi->flags, 0)) {
 		printf ("mem_lower = %uKB, mem_upper = %uKB\n",
 				(unsigned) mbi->mem_lower, (unsigned) mbi->mem_upper);
+		mem_top = 0x100000 + mbi->mem_upper * 1024;
+	}
 
 	/* Is boot_device valid? */
 	if (CHECK_FLAG (mbi->flags, 1))
@@ -60,6 +75,7 @@ entry (unsigned long magic, unsigned long addr)
 		int i;
 		module_t* mod = (module_t*)mbi->mods_addr;
 		fileptr = mod->mod_start;
+		fileend = mod->mod_end;
 		while(mod_count < mbi->mods_count) {
 			printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
 			printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
@@ -147,7 +163,7 @@ entry (unsigned long magic, unsigned long addr)
 
 		tss.ldt_segment_selector = KERNEL_LDT;
 		tss.ss0 = KERNEL_DS;
-		tss.esp0 = 0x800000;
+		tss.esp0 = (uint32_t)(&idle_stacks[0] + 1);
 		ltr(KERNEL_TSS);
 	}
 	/* Mask all IRQs again*/
@@ -159,10 +175,13 @@ entry (unsigned long magic, unsigned long addr)
 	/* Init the PIC */
 	i8259_init();
 	
-	/* Init IDT vector 0-20*/
+	/* Init IDT vector 0-20. Every exception goes through linkage.S,
+	 * which takes the kernel lock, so these are interrupt gates; page
+	 * faults also need CR2 read before anything else can fault. #NM
+	 * swaps FPU state in for lazy switching. */
 	{
 		int i;
-		for(i=0;i<20;i++)
+		for(i=0;i<NUM_EXCEPTIONS;i++)
 		{	
 			if(i!=15)
 			{
@@ -173,10 +192,12 @@ entry (unsigned long magic, unsigned long addr)
 				idt_desc.present=1;
 				idt_desc.size=1;
 				idt_desc.dpl=0x0;
+				idt_desc.reserved0=0;
 				idt_desc.reserved1=1;
 				idt_desc.reserved2=1;
-				idt_desc.reserved3=1;
-				SET_IDT_ENTRY(idt_desc, ehandlers[i]);
+				idt_desc.reserved3=0;
+				idt_desc.reserved4=0;
+				SET_IDT_ENTRY(idt_desc, exception_linkages[i]);
 				//Set new entry in table
 				idt[i]=idt_desc;
 			}
@@ -192,9 +213,12 @@ entry (unsigned long magic, unsigned long addr)
 		idt_desc.present=1;
 		idt_desc.size=1;
 		idt_desc.dpl=0x0;
+		idt_desc.reserved0=0;
 		idt_desc.reserved1=1;
 		idt_desc.reserved2=1;
-		SET_IDT_ENTRY(idt_desc, irqhandlers[0]);
+		idt_desc.reserved3=0;
+		idt_desc.reserved4=0;
+		SET_IDT_ENTRY(idt_desc, timer_linkage);
 		//Set new entry in table
 		idt[32]=idt_desc;
 		//Disable IRQ masking
@@ -209,9 +233,12 @@ entry (unsigned long magic, unsigned long addr)
 		idt_desc.present=1;
 		idt_desc.size=1;
 		idt_desc.dpl=0x0;
+		idt_desc.reserved0=0;
 		idt_desc.reserved1=1;
 		idt_desc.reserved2=1;
-		SET_IDT_ENTRY(idt_desc, irqhandlers[1]);
+		idt_desc.reserved3=0;
+		idt_desc.reserved4=0;
+		SET_IDT_ENTRY(idt_desc, keyboard_linkage);
 		//Set new entry in table
 		idt[33]=idt_desc;
 		//Disable IRQ masking
@@ -226,9 +253,12 @@ entry (unsigned long magic, unsigned long addr)
 		idt_desc.present=1;
 		idt_desc.size=1;
 		idt_desc.dpl=0x0;
+		idt_desc.reserved0=0;
 		idt_desc.reserved1=1;
 		idt_desc.reserved2=1;
-		SET_IDT_ENTRY(idt_desc, irqhandlers[2]);
+		idt_desc.reserved3=0;
+		idt_desc.reserved4=0;
+		SET_IDT_ENTRY(idt_desc, rtc_linkage);
 		//Set new entry in table
 		idt[40]=idt_desc;
 	//Disable IRQ masking
@@ -241,12 +271,27 @@ entry (unsigned long magic, unsigned long addr)
 	idt_desc.seg_selector=0x0010;
 	idt_desc.present=1;
 	idt_desc.size=1;
-	idt_desc.dpl=0x0;
+	idt_desc.dpl=0x3; // reachable from user mode
+	idt_desc.reserved0=0;
 	idt_desc.reserved1=1;
 	idt_desc.reserved2=1;
-	SET_IDT_ENTRY(idt_desc, systemcall);
+	idt_desc.reserved3=0;
+	idt_desc.reserved4=0;
+	SET_IDT_ENTRY(idt_desc, syscall_linkage);
 	//Set new entry in table
-	idt[128]=idt_desc;
+	idt[SYSCALL_VECTOR]=idt_desc;
+
+	/* Inter-processor interrupts, the local APIC timer and the local
+	 * APIC's spurious vector */
+	idt_desc.dpl=0x0;
+	SET_IDT_ENTRY(idt_desc, ipi_resched_linkage);
+	idt[IPI_RESCHED_VECTOR]=idt_desc;
+	SET_IDT_ENTRY(idt_desc, ipi_invlpg_linkage);
+	idt[IPI_INVLPG_VECTOR]=idt_desc;
+	SET_IDT_ENTRY(idt_desc, lapic_timer_linkage);
+	idt[LAPIC_TIMER_VECTOR]=idt_desc;
+	SET_IDT_ENTRY(idt_desc, spurious_linkage);
+	idt[SPURIOUS_VECTOR]=idt_desc;
 			
 	//Load new IDT
 	lidt(idt_desc_ptr);
@@ -254,8 +299,14 @@ entry (unsigned long magic, unsigned long addr)
 	/* Initialize devices, memory, filesystem, enable device interrupts on the
 	 * PIC, any other initialization stuff... */
 	paging_init();
+	smp_init(); // find the processors and enable this one's local APIC
+	irq_init(); // I/O APIC if there is one, else stay on the 8259
+	mm_init(mem_top, fileptr, fileend); // keep the filesystem image out of the frame pool
+	fpu_init();
+	pit_init();
 	
 	//Enable IRQ interrupts. 
+	enable_irq(0);
 	enable_irq(8);
 	enable_irq(2);
 	enable_irq(1);
@@ -266,23 +317,22 @@ entry (unsigned long magic, unsigned long addr)
 	 * without showing you any output */
 	printf("Enabling Interrupts\n");
 	sti();
-	/* This will be replaced by a system call after CP3 */
 	rtc_open();
-	filesys_init(fileptr); // start of filesystem
-	
-	while(1)
+	filesys_init(fileptr, fileend - fileptr); // start and length of filesystem
+	workqueue_init();
+	zero_pool_init();
+
+	/* Execute the first program (`shell') on each terminal ... */
 	{
-		
-		printf("Reading-> ");
-		uint8_t buf[1024];
-		int cnt = terminal_read(buf, 1024);
-		buf[cnt] = '\0';
-		puts ((int8_t*)"Typed:    ");
-		puts ((int8_t*)buf);
-		putc('\n');
-		
+		int32_t term;
+		for(term = 0; term < NUM_TERMINALS; term++)
+		{
+			if(process_create((uint8_t *)"shell", term) == NULL)
+				printf("Could not start shell on terminal %d\n", term);
+		}
 	}
-	/* Execute the first program (`shell') ... */
+	sched_start();
+
 	/* Spin (nicely, so we don't chew up cycles) */
 	asm volatile(".1: hlt; jmp .1;");
 }
@@ -0,0 +1,96 @@
+/* kthread.c - Kernel threads
+ * vim:ts=4 noexpandtab
+ */
+
+#include "kthread.h"
+#include "sched.h"
+#include "paging.h"
+#include "lib.h"
+
+/* Kernel threads, each PCB at the base of its stack like a process's.
+ * They have pids past MAX_PROCESSES, so wait and the process table
+ * never see them. */
+static kstack_t kthread_stacks[MAX_KTHREADS] __attribute__((aligned(KSTACK_SIZE)));
+static int32_t nkthreads;
+
+/* 
+ * kthread_start
+ *   DESCRIPTION: Where a kernel thread's first switch lands. It runs with
+ *                the kernel lock held, like any kernel code, and
+ *                interrupts on.
+ *   INPUTS: fn -- thread body
+ *           arg -- its argument
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+static void
+kthread_start(kthread_fn_t fn, void* arg)
+{
+	sti();
+	fn(arg);
+
+	cli();
+	while(1) {
+		current->state = PROC_SLEEPING;
+		schedule();
+	}
+}
+
+/* 
+ * kthread_create
+ *   DESCRIPTION: Starts a kernel thread: a PCB and stack with no user
+ *                space, running in the kernel page directory
+ *   INPUTS: fn -- thread body
+ *           arg -- its argument
+ *           cpu -- index in cpus[] of the processor it stays on
+ *           prio -- KTHREAD_NORMAL, or KTHREAD_IDLE to run only when
+ *                   the processor has nothing else to do
+ *   OUTPUTS: none
+ *   RETURN VALUE: the thread, NULL if the table is full
+ *   SIDE EFFECTS: the thread is runnable
+ */
+pcb_t*
+kthread_create(kthread_fn_t fn, void* arg, int32_t cpu, int32_t prio)
+{
+	switch_frame_t* frame;
+	uint32_t* stack;
+	uint32_t flags;
+	int32_t i;
+	pcb_t* p;
+
+	cli_and_save(flags);
+	if(nkthreads >= MAX_KTHREADS) {
+		restore_flags(flags);
+		return NULL;
+	}
+	i = nkthreads++;
+	p = &kthread_stacks[i].pcb;
+	p->pid = MAX_PROCESSES + i;
+	p->state = PROC_NEW;
+	p->parent = NULL;
+	p->root = 0;
+	p->terminal = -1;
+	p->cpu = cpu;
+	p->pinned = 1;
+	p->idle_prio = (prio == KTHREAD_IDLE);
+	p->rq_next = NULL;
+	p->page_dir = (uint32_t*)KERNEL_PAGE_DIR;
+	p->fpu_cpu = -1;
+
+	/* The first switch "returns" into kthread_start(fn, arg), which
+	 * finds a dummy return address and its arguments above the frame */
+	p->kstack_top = (uint32_t)(&kthread_stacks[i] + 1);
+	stack = (uint32_t*)p->kstack_top - 3;
+	stack[0] = 0;
+	stack[1] = (uint32_t)fn;
+	stack[2] = (uint32_t)arg;
+	frame = (switch_frame_t*)stack - 1;
+	memset(frame, 0, sizeof(switch_frame_t));
+	frame->ret = (uint32_t)kthread_start;
+	p->ksp = (uint32_t)frame;
+
+	sched_add(p);
+	restore_flags(flags);
+	return p;
+}
@@ -0,0 +1,26 @@
+/* kthread.h - Kernel threads
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _KTHREAD_H
+#define _KTHREAD_H
+
+#include "types.h"
+#include "process.h"
+
+/* Size of the kernel thread table, separate from the process table */
+#define MAX_KTHREADS	(2 * NR_CPUS)
+
+/* Body of a kernel thread. Threads don't exit; a body that returns
+ * leaves its thread asleep for good. */
+typedef void (*kthread_fn_t)(void* arg);
+
+/* kthread_create priorities */
+#define KTHREAD_NORMAL	0
+#define KTHREAD_IDLE	1	/* runs only when nothing else is runnable */
+
+/* Starts fn(arg) in a new kernel thread pinned to processor cpu. NULL
+ * if the table is full. */
+extern pcb_t* kthread_create(kthread_fn_t fn, void* arg, int32_t cpu, int32_t prio);
+
+#endif /* _KTHREAD_H */
@@ -3,32 +3,49 @@
  */
 
 #include "lib.h"
+#include "paging.h"
+#include "mm.h"
+#include "process.h"
 #define VIDEO 0xB8000
 #define SAVED_VIDEO 0x100000
+#define SAVED_VIDEO_SIZE 0x100000 // Scrollback per screen
 #define NUM_COLS 80
 #define NUM_ROWS 25
-
-static uint8_t ATTRIB;
-static uint8_t cursor_x; // Keeps track of current column position
-static uint32_t cursor_y; // Keeps track of cursor ofset from beginning of saved video memory
-static char* video_mem = (char *)VIDEO; // Start of video memory (displayed)
-static char* saved_video_mem = (char *)SAVED_VIDEO; // Start of saved video memory (stored)
-static uint32_t screen_offset; // Number of saved offscreen lines
+#define SCREEN_BYTES (NUM_ROWS*NUM_COLS*2)
+#define SAVED_ROWS (SAVED_VIDEO_SIZE/(NUM_COLS*2))
+
+/* Everything one virtual terminal's output needs. */
+typedef struct screen {
+	uint8_t attrib;
+	uint8_t cursor_x; // Keeps track of current column position
+	uint32_t cursor_y; // Keeps track of cursor ofset from beginning of saved video memory
+	uint32_t screen_offset; // Number of saved offscreen lines
+	uint8_t mapped; // 1 if a program draws straight into its video page
+	char* video_mem; // VIDEO while displayed, backing_mem otherwise
+	char* backing_mem; // Off-screen page written while hidden
+	char* saved_video_mem; // Start of saved video memory (stored)
+} screen_t;
+
+static screen_t screens[NUM_SCREENS];
+static screen_t* out; // Screen putc and friends write to
+static screen_t* shown; // Screen currently in VIDEO
 static uint8_t cursor_enabled; // 1 if cursor is displayed, 0 if not
 
+#define ATTRIB (out->attrib)
+
 
 /* Returns cursor column position. */
 uint8_t
 screen_x()
 {
-	return cursor_x;
+	return out->cursor_x;
 }
 
 /* Returns y position of cursor on screen. */
 uint32_t
 screen_y()
 {
-	return cursor_y - screen_offset;
+	return out->cursor_y - out->screen_offset;
 }
 
 /* Courtesy of http://wiki.osdev.org/Text_Mode_Cursor
@@ -43,6 +60,9 @@ screen_y()
 void update_cursor()
 {
 	uint8_t cur_CSR;
+	// Only the displayed screen owns the hardware cursor.
+	if(out != shown)
+		return;
 	// Checks if cursor is offscreen.
 	if(screen_y() >= NUM_ROWS) {
 		// Checks if cursor needs to be turned off.
@@ -83,24 +103,154 @@ void update_cursor()
 void
 screen_init()
 {
-	cursor_x = 0;
-	cursor_y = 0;
-	screen_offset = 0;
+	int32_t i, id;
+
+	for(id = 0; id < NUM_SCREENS; id++) {
+		out = &screens[id];
+		out->cursor_x = 0;
+		out->cursor_y = 0;
+		out->screen_offset = 0;
+		out->mapped = 0;
+		out->attrib = 0x2; // Initialize to green on black.
+		out->backing_mem = (char *)BACKING_PAGE(id); // One page per screen, used while it is hidden
+		out->saved_video_mem = (char *)(SAVED_VIDEO + id * SAVED_VIDEO_SIZE);
+		out->video_mem = out->backing_mem;
+
+		/* Go through the backing page and saved video memory and
+		 * initialize to blank spaces. */
+		for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
+			*(uint8_t *)(out->backing_mem + (i << 1)) = ' ';
+			*(uint8_t *)(out->backing_mem + (i << 1) + 1) = ATTRIB;
+		}
+		for(i=0; i<SAVED_VIDEO_SIZE/2; i++) {
+			*(uint8_t *)(out->saved_video_mem + (i << 1)) = ' ';
+			*(uint8_t *)(out->saved_video_mem + (i << 1) + 1) = ATTRIB;
+		}
+	}
+
+	/* Screen 0 starts out displayed. */
+	out = shown = &screens[0];
+	out->video_mem = (char *)VIDEO;
+	memcpy(out->video_mem, out->backing_mem, SCREEN_BYTES);
 	cursor_enabled = 1;
 	update_cursor();
-	ATTRIB = 0x2; // Initialize to green on black.
-	
-	int32_t i;
-	/* Go through all video memory and saved video memory and
-	 * initialize to blank spaces. */
-    for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-    }
-	for(i=0; i<(0x400000-SAVED_VIDEO)/2; i++) {
-		*(uint8_t *)(saved_video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(saved_video_mem + (i << 1) + 1) = ATTRIB;
+}
+
+/*
+ * DESCRIPTION: Selects the screen that output goes to.
+ * INPUTS: id -- screen number
+ * OUTPUTS: none
+ * RETURN VALUES: previously selected screen
+ * SIDE EFFECTS: none
+ */
+int32_t
+set_screen(int32_t id)
+{
+	int32_t old = out - screens;
+	if(id >= 0 && id < NUM_SCREENS)
+		out = &screens[id];
+	return old;
+}
+
+/*
+ * DESCRIPTION: Copies the visible window of saved video memory into the
+ *				screen's video page.
+ * INPUTS: s -- screen to redraw
+ * OUTPUTS: none
+ * RETURN VALUES: none
+ * SIDE EFFECTS: Changes displayed video memory.
+ */
+static void
+render(screen_t* s)
+{
+	memcpy(s->video_mem, s->saved_video_mem + ((NUM_COLS*s->screen_offset) << 1),
+			SCREEN_BYTES);
+}
+
+/*
+ * DESCRIPTION: Marks whether a program draws into the screen's video page
+ *				directly, in which case the page itself has to be saved and
+ *				restored on a switch rather than redrawn from scrollback.
+ * INPUTS: id -- screen number
+ *		   mapped -- 1 if mapped into a program
+ * OUTPUTS: none
+ * RETURN VALUES: none
+ * SIDE EFFECTS: none
+ */
+void
+screen_set_mapped(int32_t id, int32_t mapped)
+{
+	screen_t* s;
+
+	if(id < 0 || id >= NUM_SCREENS)
+		return;
+	s = &screens[id];
+	// Put the text back once the program that drew over it is gone.
+	if(s->mapped && !mapped)
+		render(s);
+	s->mapped = mapped;
+}
+
+/*
+ * DESCRIPTION: Puts another screen on the display. The old one goes back
+ *				to writing its backing page. Text screens are redrawn from
+ *				scrollback; a page a program draws into is saved and
+ *				restored as is.
+ * INPUTS: id -- screen to display
+ * OUTPUTS: none
+ * RETURN VALUES: none
+ * SIDE EFFECTS: Changes displayed video memory and the cursor.
+ */
+void
+screen_show(int32_t id)
+{
+	screen_t* old = shown;
+	screen_t* new;
+
+	if(id < 0 || id >= NUM_SCREENS || &screens[id] == shown)
+		return;
+	new = &screens[id];
+
+	old->video_mem = old->backing_mem;
+	if(old->mapped)
+		memcpy(old->backing_mem, (char *)VIDEO, SCREEN_BYTES);
+
+	new->video_mem = (char *)VIDEO;
+	shown = new;
+	if(new->mapped)
+		memcpy(new->video_mem, new->backing_mem, SCREEN_BYTES);
+	else
+		render(new);
+
+	old = out;
+	out = new;
+	update_cursor();
+	out = old;
+}
+
+/*
+ * DESCRIPTION: Drops the oldest half of the scrollback once the cursor
+ *				reaches the end of saved video memory.
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN VALUES: none
+ * SIDE EFFECTS: Moves saved video memory.
+ */
+static void
+trim_scrollback()
+{
+	uint32_t i, drop = SAVED_ROWS / 2;
+
+	if(out->cursor_y < SAVED_ROWS)
+		return;
+	memmove(out->saved_video_mem, out->saved_video_mem + ((NUM_COLS*drop) << 1),
+			(NUM_COLS*(SAVED_ROWS - drop)) << 1);
+	for(i = NUM_COLS*(SAVED_ROWS - drop); i < NUM_COLS*SAVED_ROWS; i++) {
+		*(uint8_t *)(out->saved_video_mem + (i << 1)) = ' ';
+		*(uint8_t *)(out->saved_video_mem + (i << 1) + 1) = ATTRIB;
 	}
+	out->cursor_y -= drop;
+	out->screen_offset = (out->screen_offset > drop) ? out->screen_offset - drop : 0;
 }
 
 
@@ -116,33 +266,34 @@ void
 BSOD()
 {
 	int32_t i;
+	out = shown;
     for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = 0x10; // Blue
+        *(uint8_t *)(out->video_mem + (i << 1)) = ' ';
+        *(uint8_t *)(out->video_mem + (i << 1) + 1) = 0x10; // Blue
 	}
 	ATTRIB = 0x17; // Blue on white
-	cursor_y = screen_offset + 10;
-	cursor_x = 10;
+	out->cursor_y = out->screen_offset + 10;
+	out->cursor_x = 10;
 	puts("A total FU exception has occured at your location. All system");
-	cursor_y++;
-	cursor_x = 10;
+	out->cursor_y++;
+	out->cursor_x = 10;
 	puts("functionality will be terminated.");
-	cursor_y += 2;
-	cursor_x = 10;
+	out->cursor_y += 2;
+	out->cursor_x = 10;
 	puts("- ");
 	puts("Press any key to power cycle the system. If system does not");
-	cursor_y++;
-	cursor_x = 12;
+	out->cursor_y++;
+	out->cursor_x = 12;
 	puts("restart, scream at top of lungs and pound on keyboard.");
-	cursor_y++;
-	cursor_x = 10;
+	out->cursor_y++;
+	out->cursor_x = 10;
 	puts("- ");
 	puts("If you need to talk to a programmer press any other key.");
-	cursor_y += 2;
-	cursor_x = 26;
+	out->cursor_y += 2;
+	out->cursor_x = 26;
 	puts("Press any key to continue..");
-	cursor_y = screen_offset + 8;
-	cursor_x = 20;
+	out->cursor_y = out->screen_offset + 8;
+	out->cursor_x = 20;
 	ATTRIB = 0xF1;
 	
 	/* Disable cursor */
@@ -168,16 +319,17 @@ clear(void)
 {
     int32_t i;
 
-	cursor_x = 0;
-	cursor_y++;
-	screen_offset = cursor_y; // Moves all saved video memory off screen.
+	out->cursor_x = 0;
+	out->cursor_y++;
+	trim_scrollback();
+	out->screen_offset = out->cursor_y; // Moves all saved video memory off screen.
 	update_cursor();
 	// Clears video memory and reflects this in saved video memory. 
     for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-		*(uint8_t *)(saved_video_mem + ((NUM_COLS*screen_offset + i) << 1)) = ' ';
-        *(uint8_t *)(saved_video_mem + ((NUM_COLS*screen_offset + i) << 1) + 1) = ATTRIB;
+        *(uint8_t *)(out->video_mem + (i << 1)) = ' ';
+        *(uint8_t *)(out->video_mem + (i << 1) + 1) = ATTRIB;
+		*(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->screen_offset + i) << 1)) = ' ';
+        *(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->screen_offset + i) << 1) + 1) = ATTRIB;
     }
 	
 
@@ -198,27 +350,21 @@ scroll(int32_t offset)
 	// If offset is negative, it will scroll up.
 	
 	// Prevents scrolling above saved video memory.
-	if(offset + (int)screen_offset < 0) {
-		if(screen_offset == 0)
+	if(offset + (int)out->screen_offset < 0) {
+		if(out->screen_offset == 0)
 			return;
-		offset = 0 - (int)screen_offset; // Only scroll up enough to reach top, no farther.
+		offset = 0 - (int)out->screen_offset; // Only scroll up enough to reach top, no farther.
 	}
 	// Prevents scrolling below cursor.
-	else if((int)screen_offset + offset > cursor_y) {
-		if(screen_offset == cursor_y)
+	else if((int)out->screen_offset + offset > out->cursor_y) {
+		if(out->screen_offset == out->cursor_y)
 			return;
-		offset = cursor_y - (int)screen_offset; // Only scroll down enough to reach cursor.
+		offset = out->cursor_y - (int)out->screen_offset; // Only scroll down enough to reach cursor.
 	}
 	
-	screen_offset += offset;
-	int i;
+	out->screen_offset += offset;
 	// Copy saved video memory into displayed video memory.
-	for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) =
-			*(uint8_t *)(saved_video_mem + ((NUM_COLS*screen_offset + i) << 1));
-        *(uint8_t *)(video_mem + (i << 1) + 1) = 
-			*(uint8_t *)(saved_video_mem + ((NUM_COLS*screen_offset + i) << 1) + 1);
-	}
+	render(out);
 	update_cursor();
 }
 
@@ -228,8 +374,8 @@ update_color() {
 	int32_t i;
 	// Video memory uses pairs of bytes for each block on screen in text mode
 	// We're only setting the second byte to change the font/background color.
-	for(i=0; i<(0x400000-SAVED_VIDEO)/2; i++) {
-        *(uint8_t *)(saved_video_mem + (i << 1) + 1) = ATTRIB;
+	for(i=0; i<SAVED_VIDEO_SIZE/2; i++) {
+        *(uint8_t *)(out->saved_video_mem + (i << 1) + 1) = ATTRIB;
 	}
 	scroll(0); // Update displayed video memory with new colors.
 }
@@ -402,38 +548,40 @@ void
 putc(uint8_t c)
 {
 	if(c == '\n' || c == '\r') {
-        cursor_y++;
-        cursor_x=0;
+        out->cursor_y++;
+        out->cursor_x=0;
+		trim_scrollback();
     }
 	// Handles backspace 
 	else if(c == '\b') {
-		if(cursor_x == 0) { // Moves to end of previous row
-			cursor_y--;
-			cursor_x = NUM_COLS - 1;
+		if(out->cursor_x == 0) { // Moves to end of previous row
+			out->cursor_y--;
+			out->cursor_x = NUM_COLS - 1;
 		} else {
-			cursor_x--;
+			out->cursor_x--;
 		}
 		
 		// Replace previous displayed character with a space.
 		if(screen_y() < NUM_ROWS) {
-			*(uint8_t *)(video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1)) = ' ';
-			*(uint8_t *)(video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1) + 1) = ATTRIB;
+			*(uint8_t *)(out->video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1)) = ' ';
+			*(uint8_t *)(out->video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1) + 1) = ATTRIB;
 		}
-		*(uint8_t *)(saved_video_mem + ((NUM_COLS*cursor_y + cursor_x) << 1)) = ' ';
-		*(uint8_t *)(saved_video_mem + ((NUM_COLS*cursor_y + cursor_x) << 1) + 1) = ATTRIB;
+		*(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->cursor_y + out->cursor_x) << 1)) = ' ';
+		*(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->cursor_y + out->cursor_x) << 1) + 1) = ATTRIB;
 		
 	}
 	// Normal character
 	else {
 		if(screen_y() < NUM_ROWS) {
-			*(uint8_t *)(video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1)) = c;
-			*(uint8_t *)(video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1) + 1) = ATTRIB;
+			*(uint8_t *)(out->video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1)) = c;
+			*(uint8_t *)(out->video_mem + ((NUM_COLS*screen_y() + screen_x()) << 1) + 1) = ATTRIB;
 		}
-		*(uint8_t *)(saved_video_mem + ((NUM_COLS*cursor_y + cursor_x) << 1)) = c;
-        *(uint8_t *)(saved_video_mem + ((NUM_COLS*cursor_y + cursor_x) << 1) + 1) = ATTRIB;
-        cursor_x++;
-        cursor_y = (cursor_y + (cursor_x / NUM_COLS));
-        cursor_x %= NUM_COLS;
+		*(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->cursor_y + out->cursor_x) << 1)) = c;
+        *(uint8_t *)(out->saved_video_mem + ((NUM_COLS*out->cursor_y + out->cursor_x) << 1) + 1) = ATTRIB;
+        out->cursor_x++;
+        out->cursor_y = (out->cursor_y + (out->cursor_x / NUM_COLS));
+        out->cursor_x %= NUM_COLS;
+		trim_scrollback();
     }
 	
 	if(screen_y() >= NUM_ROWS) // if cursor is offscreen
@@ -627,6 +775,67 @@ memcpy(void* dest, const void* src, uint32_t n)
 	return dest;
 }
 
+/*
+ * DESCRIPTION: Checks that a buffer passed in by a program lies entirely
+ *				within memory the current process may use: its image and
+ *				heap, [USER_IMAGE, brk), or its stack, from USER_STACK_LIMIT
+ *				up. Anything else would take a page fault the kernel can't
+ *				resolve.
+ * INPUTS: addr -- start of the buffer
+ *		   len -- size of the buffer in bytes
+ * OUTPUTS: none
+ * RETURN VALUES: 1 if the buffer is bad, 0 if it can be used
+ * SIDE EFFECTS: none
+ */
+int32_t
+bad_userspace_addr(const void* addr, int32_t len)
+{
+	uint32_t start = (uint32_t)addr;
+
+	if(len < 0 || start < USER_IMAGE || start >= USER_VIRT + USER_PAGE_SIZE ||
+			len > USER_VIRT + USER_PAGE_SIZE - start)
+		return 1;
+	/* nothing may reach into the gap between the heap and the stack */
+	return start < USER_STACK_LIMIT && start + len > current->brk;
+}
+
+/*
+ * DESCRIPTION: Checks that the kernel can copy into a buffer passed in by
+ *				a program: as bad_userspace_addr, and none of it may be a
+ *				read-only page such as program text or a file mapped by
+ *				mmap
+ * INPUTS: addr -- start of the buffer
+ *		   len -- size of the buffer in bytes
+ * OUTPUTS: none
+ * RETURN VALUES: 1 if the buffer is bad, 0 if it can be used
+ * SIDE EFFECTS: none
+ */
+int32_t
+bad_userspace_write(void* addr, int32_t len)
+{
+	return bad_userspace_addr(addr, len) ||
+			!user_writable(current->page_dir, (uint32_t)addr, len);
+}
+
+/*
+ * DESCRIPTION: Checks that a NUL-terminated string passed in by a program
+ *				lies entirely within memory it may use, a byte at a time
+ *				so nothing past the terminator is touched
+ * INPUTS: s -- the string
+ * OUTPUTS: none
+ * RETURN VALUES: 1 if the string is bad, 0 if it can be used
+ * SIDE EFFECTS: none
+ */
+int32_t
+bad_userspace_str(const uint8_t* s)
+{
+	do {
+		if(bad_userspace_addr(s, 1))
+			return 1;
+	} while(*s++ != '\0');
+	return 0;
+}
+
 /* Optimized memmove (used for overlapping memory areas) */
 void*
 memmove(void* dest, const void* src, uint32_t n)
@@ -709,6 +918,6 @@ test_interrupts(void)
 {
 	int32_t i;
 	for (i=0; i < NUM_ROWS*NUM_COLS; i++) {
-		video_mem[i<<1]++;
+		((char *)VIDEO)[i<<1]++;
 	}
 }
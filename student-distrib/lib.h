@@ -15,8 +15,14 @@ int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
 void clear(void);
 
+/* Number of independent screens (one per virtual terminal) */
+#define NUM_SCREENS 3
+
 void BSOD();
 void screen_init();
+int32_t set_screen(int32_t id);
+void screen_show(int32_t id);
+void screen_set_mapped(int32_t id, int32_t mapped);
 void scroll(int offset);
 void font_color();
 void background_color();
@@ -33,6 +39,8 @@ int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 
 /* Userspace address-check functions */
 int32_t bad_userspace_addr(const void* addr, int32_t len);
+int32_t bad_userspace_write(void* addr, int32_t len);
+int32_t bad_userspace_str(const uint8_t* s);
 int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n);
 
 /* Port read functions */
@@ -136,6 +144,21 @@ do {                                    \
 			);                      \
 } while(0)
 
+/* Sleep until the next interrupt
+ * Enables interrupts and halts; sti holds interrupts off for one more
+ * instruction, so nothing can slip in between the two and be missed.
+ * Interrupts are disabled again on return. */
+#define wait_for_interrupt()            \
+do {                                    \
+	asm volatile("sti           \n      \
+			hlt             \n      \
+			cli"                    \
+			:                       \
+			:                       \
+			: "memory", "cc"        \
+			);                      \
+} while(0)
+
 /* Restore flags
  * Puts the value in "flags" into the EFLAGS register.  Most often used
  * after a cli_and_save_flags(flags) */
@@ -149,4 +172,13 @@ do {                                    \
 			);                      \
 } while(0)
 
+/* Reads the low half of the time stamp counter into "cycles" */
+#define rdtsc(cycles)                   \
+do {                                    \
+	uint32_t _hi;                       \
+	asm volatile("rdtsc"                \
+			: "=a"(cycles), "=d"(_hi)   \
+			);                      \
+} while(0)
+
 #endif /* _LIB_H */
@@ -0,0 +1,84 @@
+/* linkage.h - Register frame pushed by the interrupt and system call
+ * entry points in linkage.S
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _LINKAGE_H
+#define _LINKAGE_H
+
+#include "types.h"
+
+/* Vector used for system calls */
+#define SYSCALL_VECTOR	0x80
+/* IDT vector of a PIC IRQ line (the PICs are remapped to 0x20-0x2F) */
+#define IRQ_VECTOR(irq)	(0x20 + (irq))
+
+/* Byte offsets of the fields of hw_context_t, for use from assembly */
+#define HW_EBX		0
+#define HW_ECX		4
+#define HW_EDX		8
+#define HW_ESI		12
+#define HW_EDI		16
+#define HW_EBP		20
+#define HW_EAX		24
+#define HW_DS		28
+#define HW_ES		32
+#define HW_FS		36
+#define HW_VECTOR	40
+#define HW_ERROR	44
+#define HW_EIP		48
+#define HW_CS		52
+#define HW_EFLAGS	56
+#define HW_ESP		60
+#define HW_SS		64
+
+#ifndef ASM
+
+/* Everything saved on the kernel stack on entry to the kernel. The
+ * last two fields are only pushed by the processor when the interrupt
+ * came from user mode. */
+typedef struct hw_context {
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+	uint32_t esi;
+	uint32_t edi;
+	uint32_t ebp;
+	uint32_t eax;
+	uint32_t ds;
+	uint32_t es;
+	uint32_t fs;
+	uint32_t vector;
+	uint32_t error_code;
+	uint32_t eip;
+	uint32_t cs;
+	uint32_t eflags;
+	uint32_t esp;
+	uint32_t ss;
+} hw_context_t;
+
+/* Number of processor exception vectors the kernel handles */
+#define NUM_EXCEPTIONS	20
+
+/* Entry points installed in the IDT */
+extern void (*exception_linkages[NUM_EXCEPTIONS])();
+extern void syscall_linkage();
+extern void timer_linkage();
+extern void keyboard_linkage();
+extern void rtc_linkage();
+extern void page_fault_linkage();
+extern void fpu_linkage();
+extern void ipi_resched_linkage();
+extern void ipi_invlpg_linkage();
+extern void lapic_timer_linkage();
+extern void spurious_linkage();
+
+/* Common exit path back to the interrupted code */
+extern void return_from_interrupt();
+/* Drops to user mode with the given registers on the current kernel
+ * stack; must be called with interrupts disabled */
+extern void enter_user(hw_context_t* regs);
+
+#endif /* ASM */
+
+#endif /* _LINKAGE_H */
@@ -0,0 +1,97 @@
+/* lz4.c - LZ4 block decompression
+ * vim:ts=4 noexpandtab
+ */
+
+#include "lz4.h"
+#include "lib.h"
+
+/* Sequence token: literal count in the high nibble, match length less
+ * LZ4_MIN_MATCH in the low one. 15 means more length bytes follow. */
+#define LZ4_MIN_MATCH	4
+#define LZ4_RUN_MASK	15
+
+/*
+ * lz4_length
+ *   DESCRIPTION: reads the extra bytes of a literal count or match
+ *                length: each one is added, and 255 means another follows
+ *   INPUTS: ip -- next input byte
+ *           iend -- end of the input
+ *           len -- length from the token
+ *   OUTPUTS: ip -- advanced past the bytes read
+ *   RETURN VALUE: full length, -1 if the input ends first
+ *   SIDE EFFECTS: none
+ */
+static int32_t lz4_length(const uint8_t** ip, const uint8_t* iend, uint32_t len)
+{
+	uint8_t b;
+
+	if(len != LZ4_RUN_MASK)
+		return len;
+	do
+	{
+		if(*ip >= iend)
+			return -1;
+		b = *(*ip)++;
+		len += b;
+	} while(b == 255);
+	return len;
+}
+
+/*
+ * lz4_decompress
+ *   DESCRIPTION: Decompresses one LZ4 block: a series of sequences, each
+ *                some literal bytes followed by a match copied from
+ *                earlier output. The last sequence has literals only.
+ *                Nothing outside src and dst is ever touched, however
+ *                damaged the input.
+ *   INPUTS: src -- compressed block
+ *           srclen -- its length
+ *           dstlen -- room at dst
+ *   OUTPUTS: dst -- the data
+ *   RETURN VALUE: bytes written, -1 if the block is damaged or doesn't
+ *                 fit
+ *   SIDE EFFECTS: none
+ */
+int32_t lz4_decompress(const uint8_t* src, uint32_t srclen, uint8_t* dst, uint32_t dstlen)
+{
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + srclen;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + dstlen;
+	uint32_t token, offset;
+	int32_t len;
+
+	while(ip < iend)
+	{
+		token = *ip++;
+		if((len = lz4_length(&ip, iend, token >> 4)) == -1 ||
+				len > iend - ip || len > oend - op)
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if(ip == iend)
+			break;
+
+		if(iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - dst ||
+				(len = lz4_length(&ip, iend, token & LZ4_RUN_MASK)) == -1)
+			return -1;
+		len += LZ4_MIN_MATCH;
+		if(len > oend - op)
+			return -1;
+		/* a match may overlap its own output, e.g. a run of one byte */
+		if(offset >= len)
+			memcpy(op, op - offset, len);
+		else
+		{
+			for(; len > 0; len--, op++)
+				*op = *(op - offset);
+		}
+		op += len;
+	}
+	return op - dst;
+}
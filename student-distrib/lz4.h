@@ -0,0 +1,14 @@
+/* lz4.h - LZ4 block decompression
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+/* Decompresses an LZ4 block of srclen bytes into at most dstlen bytes.
+ * Returns the bytes written, -1 if the block is damaged or too big. */
+extern int32_t lz4_decompress(const uint8_t* src, uint32_t srclen, uint8_t* dst, uint32_t dstlen);
+
+#endif /* _LZ4_H */
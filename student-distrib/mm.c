@@ -0,0 +1,585 @@
+/* mm.c - Physical frames and user address spaces
+ * vim:ts=4 noexpandtab
+ */
+
+#include "mm.h"
+#include "lib.h"
+#include "pagecache.h"
+#include "execcache.h"
+#include "kthread.h"
+#include "sched.h"
+#include "smp.h"
+
+#define FRAME_INDEX(frame)	(((frame) - FRAME_BASE) / PAGE_SIZE)
+#define USER_PDE			(USER_VIRT / 0x400000)
+#define USER_PTE(vaddr)		(((vaddr) >> 12) & 0x3FF)
+/* Entries holding a reference to their frame */
+#define PTE_COUNTED(pte)	(((pte) & (PTE_PRESENT | PTE_IMAGE)) == PTE_PRESENT)
+
+uint32_t frames_free;
+
+/* Users of each frame; 0 means it is on the free list */
+static uint16_t refs[NUM_FRAMES];
+/* Set while the page cache holds one of those references */
+static uint8_t cached[NUM_FRAMES];
+
+/* Free frames are chained through their first word; 0 ends the list */
+static uint32_t free_list;
+
+/* Frames zeroed ahead of time, chained the same way. The link is the
+ * only word that isn't zero; it is cleared when the frame is taken. */
+static uint32_t zero_list;
+uint32_t zero_pool_frames;
+uint32_t zero_pool_hits;
+uint32_t zero_pool_misses;
+uint32_t zero_pool_zeroed;
+uint32_t zero_pool_cycles;
+/* The zeroing thread, while the pool is full or memory is */
+static wait_queue_t zero_wq;
+/* SSE2 is there, so the zeroing thread can use non-temporal stores */
+static int32_t zero_movnti;
+
+/* 
+ * mm_init
+ *   DESCRIPTION: puts every frame between the kernel and the end of
+ *                memory (or user space) on the free list
+ *   INPUTS: mem_top -- end of physical memory
+ *           reserved_start, reserved_end -- range to keep out, e.g. a
+ *                                           boot module
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must run after paging_init
+ */
+void mm_init(uint32_t mem_top, uint32_t reserved_start, uint32_t reserved_end)
+{
+	uint32_t frame;
+
+	if(mem_top > FRAME_LIMIT)
+		mem_top = FRAME_LIMIT;
+
+	free_list = 0;
+	frames_free = 0;
+	/* push from the top so low frames come out first */
+	for(frame = (mem_top & ~(PAGE_SIZE - 1)) - PAGE_SIZE; frame >= FRAME_BASE && frame < mem_top; frame -= PAGE_SIZE)
+	{
+		if(frame + PAGE_SIZE > reserved_start && frame < reserved_end)
+			continue;
+		refs[FRAME_INDEX(frame)] = 0;
+		*(uint32_t *)frame = free_list;
+		free_list = frame;
+		frames_free++;
+	}
+}
+
+/* 
+ * frame_alloc
+ *   DESCRIPTION: takes a frame off the free list
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the frame (contents undefined),
+ *                 0 if memory is full
+ *   SIDE EFFECTS: the frame has one reference
+ */
+uint32_t frame_alloc(void)
+{
+	uint32_t flags;
+	uint32_t frame;
+
+	cli_and_save(flags);
+	frame = free_list;
+	if(frame != 0)
+		free_list = *(uint32_t *)frame;
+	else if((frame = zero_list) != 0)
+	{
+		/* rather than fail, spend a zeroed one */
+		zero_list = *(uint32_t *)frame;
+		zero_pool_frames--;
+	}
+	if(frame != 0)
+	{
+		refs[FRAME_INDEX(frame)] = 1;
+		cached[FRAME_INDEX(frame)] = 0;
+		frames_free--;
+	}
+	restore_flags(flags);
+
+	/* Out of memory: give back cached pages nobody has mapped, once
+	 * the exec cache has let go of its references to them */
+	if(frame == 0)
+	{
+		exec_cache_release();
+		if(pcache_reclaim() > 0)
+			return frame_alloc();
+	}
+	return frame;
+}
+
+/* 
+ * frame_alloc_zeroed
+ *   DESCRIPTION: takes a frame from the zeroed pool, or zeroes one from
+ *                the free list if the pool is empty
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the zeroed frame, 0 if memory is
+ *                 full
+ *   SIDE EFFECTS: the frame has one reference; wakes the zeroing thread
+ *                 to top the pool up
+ */
+uint32_t frame_alloc_zeroed(void)
+{
+	uint32_t flags;
+	uint32_t frame;
+
+	cli_and_save(flags);
+	frame = zero_list;
+	if(frame != 0)
+	{
+		zero_list = *(uint32_t *)frame;
+		zero_pool_frames--;
+		refs[FRAME_INDEX(frame)] = 1;
+		cached[FRAME_INDEX(frame)] = 0;
+		frames_free--;
+		zero_pool_hits++;
+		wake_up(&zero_wq);
+	}
+	else
+		zero_pool_misses++;
+	restore_flags(flags);
+
+	if(frame != 0)
+	{
+		*(uint32_t *)frame = 0;
+		return frame;
+	}
+	frame = frame_alloc();
+	if(frame != 0)
+		memset_dword((void *)frame, 0, PAGE_SIZE / 4);
+	return frame;
+}
+
+/* 
+ * zero_frame
+ *   DESCRIPTION: clears a frame with non-temporal stores when the CPU has
+ *                them, so a pool frame that sits unused for a while
+ *                doesn't push anything out of the cache
+ *   INPUTS: frame -- physical address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void zero_frame(uint32_t frame)
+{
+	uint32_t n = PAGE_SIZE / 16;
+
+	if(!zero_movnti)
+	{
+		memset_dword((void *)frame, 0, PAGE_SIZE / 4);
+		return;
+	}
+	asm volatile("                  \n\
+			1:                      \n\
+			movnti  %%eax, (%%edi)  \n\
+			movnti  %%eax, 4(%%edi) \n\
+			movnti  %%eax, 8(%%edi) \n\
+			movnti  %%eax, 12(%%edi)\n\
+			addl    $16, %%edi      \n\
+			decl    %%ecx           \n\
+			jnz     1b              \n\
+			sfence                  \n\
+			"
+			: "+D"(frame), "+c"(n)
+			: "a"(0)
+			: "memory", "cc"
+			);
+}
+
+/* 
+ * zero_thread
+ *   DESCRIPTION: the zeroing thread: moves frames from the free list to
+ *                the zeroed pool until it is full. It runs at idle
+ *                priority, and lets go of the kernel lock while it
+ *                clears a frame, which is on neither list by then.
+ *   INPUTS: arg -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+static void zero_thread(void* arg)
+{
+	uint32_t flags, frame, start, end;
+
+	while(1)
+	{
+		cli_and_save(flags);
+		while(zero_pool_frames >= ZERO_POOL_SIZE || free_list == 0)
+			sleep_on(&zero_wq);
+		frame = free_list;
+		free_list = *(uint32_t *)frame;
+		kernel_unlock();
+		restore_flags(flags);
+
+		rdtsc(start);
+		zero_frame(frame);
+		rdtsc(end);
+
+		cli_and_save(flags);
+		kernel_lock();
+		*(uint32_t *)frame = zero_list;
+		zero_list = frame;
+		zero_pool_frames++;
+		zero_pool_zeroed++;
+		zero_pool_cycles += end - start;
+		restore_flags(flags);
+		cond_resched();
+	}
+}
+
+/* 
+ * zero_pool_init
+ *   DESCRIPTION: checks for SSE2 and starts the zeroing thread on the
+ *                bootstrap processor
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must run after mm_init
+ */
+void zero_pool_init(void)
+{
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	zero_movnti = (edx >> 26) & 1;
+	if(kthread_create(zero_thread, NULL, 0, KTHREAD_IDLE) == NULL)
+		printf("No page zeroing thread\n");
+}
+
+/* 
+ * frame_get
+ *   DESCRIPTION: adds a reference to a frame, e.g. a page shared by fork
+ *   INPUTS: frame -- physical address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_get(uint32_t frame)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	refs[FRAME_INDEX(frame)]++;
+	restore_flags(flags);
+}
+
+/* 
+ * frame_put
+ *   DESCRIPTION: drops a reference, freeing the frame with the last one
+ *   INPUTS: frame -- physical address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_put(uint32_t frame)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(--refs[FRAME_INDEX(frame)] == 0)
+	{
+		*(uint32_t *)frame = free_list;
+		free_list = frame;
+		frames_free++;
+		if(zero_pool_frames < ZERO_POOL_SIZE)
+			wake_up(&zero_wq);
+	}
+	restore_flags(flags);
+}
+
+/* returns how many page table entries (and the page cache) point at a frame */
+uint32_t frame_refs(uint32_t frame)
+{
+	return refs[FRAME_INDEX(frame)];
+}
+
+/* marks whether one of a frame's references belongs to the page cache */
+void frame_set_cached(uint32_t frame, int32_t on)
+{
+	cached[FRAME_INDEX(frame)] = (on != 0);
+}
+
+/* 
+ * frames_shared
+ *   DESCRIPTION: counts frames mapped by more than one address space,
+ *                not counting the page cache's own reference
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of shared frames
+ *   SIDE EFFECTS: none
+ */
+uint32_t frames_shared(void)
+{
+	uint32_t i, n = 0;
+
+	for(i = 0; i < NUM_FRAMES; i++)
+	{
+		if(refs[i] - cached[i] > 1)
+			n++;
+	}
+	return n;
+}
+
+/* 
+ * user_space_init
+ *   DESCRIPTION: gives a process directory an empty user page table
+ *   INPUTS: dir -- process page directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if out of memory
+ *   SIDE EFFECTS: none
+ */
+int32_t user_space_init(uint32_t* dir)
+{
+	uint32_t table = frame_alloc_zeroed();
+
+	if(table == 0)
+		return -1;
+	dir[USER_PDE] = table | PTE_USER_RW; //rights are set per page
+	return 0;
+}
+
+/* 
+ * user_space_detach
+ *   DESCRIPTION: unhooks the user page table from a directory, leaving
+ *                its pages allocated, e.g. while exec builds a new image
+ *   INPUTS: dir -- process page directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: the old directory entry, for user_space_release or to
+ *                 put back
+ *   SIDE EFFECTS: flushes the TLB if dir is loaded
+ */
+uint32_t user_space_detach(uint32_t* dir)
+{
+	uint32_t pde = dir[USER_PDE];
+
+	dir[USER_PDE] = 2; //not present
+	if((pde & PTE_PRESENT) && page_dir_loaded(dir))
+		set_page_dir(dir);
+	return pde;
+}
+
+/* 
+ * user_space_release
+ *   DESCRIPTION: drops every page of a detached user page table and the
+ *                table itself
+ *   INPUTS: pde -- directory entry returned by user_space_detach
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void user_space_release(uint32_t pde)
+{
+	uint32_t * table;
+	int i;
+
+	if(!(pde & PTE_PRESENT))
+		return;
+	table = (uint32_t *)PTE_FRAME(pde);
+	for(i = 0; i < 1024; i++)
+	{
+		if(PTE_COUNTED(table[i]))
+			frame_put(PTE_FRAME(table[i]));
+	}
+	frame_put((uint32_t)table);
+}
+
+/* 
+ * user_space_free
+ *   DESCRIPTION: drops every user page and the page table. The directory
+ *                entry is cleared first, so the frames are unreachable
+ *                before they go back on the free list.
+ *   INPUTS: dir -- process page directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB if dir is loaded
+ */
+void user_space_free(uint32_t* dir)
+{
+	user_space_release(user_space_detach(dir));
+}
+
+/* 
+ * user_space_fork
+ *   DESCRIPTION: gives dst the same user pages as src without copying
+ *                any of them: writable pages become read-only and
+ *                copy-on-write in both, and each frame gains a reference
+ *   INPUTS: dst -- new process directory
+ *           src -- parent's directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if out of memory
+ *   SIDE EFFECTS: flushes the TLB if src is loaded
+ */
+int32_t user_space_fork(uint32_t* dst, uint32_t* src)
+{
+	uint32_t * from = (uint32_t *)PTE_FRAME(src[USER_PDE]);
+	uint32_t * to;
+	int i;
+
+	if(user_space_init(dst) == -1)
+		return -1;
+	to = (uint32_t *)PTE_FRAME(dst[USER_PDE]);
+
+	for(i = 0; i < 1024; i++)
+	{
+		if(!(from[i] & PTE_PRESENT))
+			continue;
+		if(from[i] & PTE_RW)
+			from[i] = (from[i] & ~PTE_RW) | PTE_COW;
+		to[i] = from[i];
+		if(PTE_COUNTED(from[i]))
+			frame_get(PTE_FRAME(from[i]));
+	}
+
+	/*every writable page changed, one flush beats an invlpg for each*/
+	if(page_dir_loaded(src))
+		set_page_dir(src);
+	return 0;
+}
+
+/* 
+ * user_pte
+ *   DESCRIPTION: finds the page table entry of a user address
+ *   INPUTS: dir -- process page directory
+ *           vaddr -- user address
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the entry, NULL if vaddr is not user space
+ *   SIDE EFFECTS: none
+ */
+uint32_t* user_pte(uint32_t* dir, uint32_t vaddr)
+{
+	if(vaddr < USER_VIRT || vaddr >= USER_VIRT + USER_PAGE_SIZE || !(dir[USER_PDE] & PTE_PRESENT))
+		return NULL;
+	return (uint32_t *)PTE_FRAME(dir[USER_PDE]) + USER_PTE(vaddr);
+}
+
+/* 
+ * user_map
+ *   DESCRIPTION: maps a frame at a user address, taking over the caller's
+ *                reference to it (there is none with PTE_IMAGE) and
+ *                dropping whatever was there
+ *   INPUTS: dir -- process page directory
+ *           vaddr -- page aligned user address
+ *           frame -- physical address
+ *           flags -- PTE_* bits
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if vaddr is not user space
+ *   SIDE EFFECTS: does not flush the TLB
+ */
+int32_t user_map(uint32_t* dir, uint32_t vaddr, uint32_t frame, uint32_t flags)
+{
+	uint32_t * pte = user_pte(dir, vaddr);
+
+	if(pte == NULL)
+		return -1;
+	if(PTE_COUNTED(*pte))
+		frame_put(PTE_FRAME(*pte));
+	*pte = PTE_FRAME(frame) | flags;
+	return 0;
+}
+
+/* 
+ * user_unmap
+ *   DESCRIPTION: removes the page at a user address, if any
+ *   INPUTS: dir -- process page directory
+ *           vaddr -- page aligned user address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: does not flush the TLB
+ */
+void user_unmap(uint32_t* dir, uint32_t vaddr)
+{
+	uint32_t * pte = user_pte(dir, vaddr);
+
+	if(pte == NULL || !(*pte & PTE_PRESENT))
+		return;
+	if(PTE_COUNTED(*pte))
+		frame_put(PTE_FRAME(*pte));
+	*pte = 0;
+}
+
+/* 
+ * user_writable
+ *   DESCRIPTION: checks that the kernel can write a range of user
+ *                addresses: every page of it that is present must be
+ *                writable or copy-on-write. Pages that aren't present
+ *                are left to mm_fault.
+ *   INPUTS: dir -- process page directory
+ *           addr -- start of the range
+ *           len -- its length; the range must be in user space
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it can, 0 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t user_writable(uint32_t* dir, uint32_t addr, uint32_t len)
+{
+	uint32_t * pte;
+	uint32_t page;
+
+	for(page = addr & ~(PAGE_SIZE - 1); page < addr + len; page += PAGE_SIZE)
+	{
+		pte = user_pte(dir, page);
+		if(pte != NULL && (*pte & PTE_PRESENT) && !(*pte & (PTE_RW | PTE_COW)))
+			return 0;
+	}
+	return 1;
+}
+
+/* 
+ * mm_fault
+ *   DESCRIPTION: resolves page faults on user addresses, from user or
+ *                kernel mode: heap and stack pages are allocated zeroed
+ *                on first touch, and writes to copy-on-write pages get a private
+ *                copy (or just the page back, for the last user)
+ *   INPUTS: dir -- faulting process's page directory
+ *           addr -- faulting address (CR2)
+ *           error -- page fault error code
+ *           brk -- end of the process's heap
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if handled, -1 if the access is bad
+ *   SIDE EFFECTS: dir must be loaded; the page's stale read-only entry
+ *                 is invalidated (a missing page was never cached)
+ */
+int32_t mm_fault(uint32_t* dir, uint32_t addr, uint32_t error, uint32_t brk)
+{
+	uint32_t * pte = user_pte(dir, addr);
+	uint32_t frame, copy;
+
+	if(pte == NULL)
+		return -1;
+
+	if(!(error & PF_PRESENT))
+	{
+		if(addr < USER_IMAGE || (addr >= brk && addr < USER_STACK_LIMIT) ||
+				(frame = frame_alloc_zeroed()) == 0)
+			return -1;
+		*pte = frame | PTE_USER_RW;
+	}
+	else if((error & PF_WRITE) && (*pte & PTE_COW))
+	{
+		frame = PTE_FRAME(*pte);
+		if(frame_refs(frame) == 1)
+		{
+			*pte = (*pte & ~PTE_COW) | PTE_RW;
+		}
+		else
+		{
+			if((copy = frame_alloc()) == 0)
+				return -1;
+			memcpy((void *)copy, (void *)frame, PAGE_SIZE);
+			*pte = copy | PTE_USER_RW;
+			frame_put(frame);
+		}
+		tlb_flush_page(addr);
+	}
+	else
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* mm.h - Physical frames and user address spaces
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _MM_H
+#define _MM_H
+
+#include "types.h"
+#include "paging.h"
+
+#define PAGE_SIZE		4096
+
+/* Frames handed out to user pages and page tables. They are identity
+ * mapped in every address space so the kernel can reach them. */
+#define FRAME_BASE		0x800000
+#define FRAME_LIMIT		USER_VIRT
+#define NUM_FRAMES		((FRAME_LIMIT - FRAME_BASE) / PAGE_SIZE)
+
+/* Page table entry bits */
+#define PTE_PRESENT		0x001
+#define PTE_RW			0x002
+#define PTE_USER		0x004
+#define PTE_COW			0x200	/* available bit: shared, copy on write */
+#define PTE_IMAGE		0x400	/* available bit: image block, not counted */
+#define PTE_FRAME(pte)	((pte) & 0xFFFFF000)
+#define PAGE_ROUND_UP(addr)	(((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PTE_USER_RW		(PTE_PRESENT | PTE_RW | PTE_USER)
+
+/* Page fault error code bits */
+#define PF_PRESENT		0x1		/* protection fault, page was present */
+#define PF_WRITE		0x2
+#define PF_USER			0x4
+
+/* The stack grows down from USER_STACK into demand-zero pages; the
+ * image and heap may not reach into it */
+#define USER_STACK_PAGES	256
+#define USER_STACK_LIMIT	(USER_VIRT + USER_PAGE_SIZE - USER_STACK_PAGES * PAGE_SIZE)
+
+/* Frames the zeroing thread keeps ready for frame_alloc_zeroed */
+#define ZERO_POOL_SIZE	64
+
+/* Frames free right now, including the zeroed pool */
+extern uint32_t frames_free;
+/* Zeroed pool: frames in it, allocations it served and didn't, frames
+ * the zeroing thread cleared and the TSC cycles that took */
+extern uint32_t zero_pool_frames;
+extern uint32_t zero_pool_hits;
+extern uint32_t zero_pool_misses;
+extern uint32_t zero_pool_zeroed;
+extern uint32_t zero_pool_cycles;
+
+/* Builds the free frame list from memory below mem_top, skipping
+ * [reserved_start, reserved_end) */
+extern void mm_init(uint32_t mem_top, uint32_t reserved_start, uint32_t reserved_end);
+
+/* Starts the idle-priority thread that fills the zeroed pool */
+extern void zero_pool_init(void);
+
+/* Frame allocator; frames are reference counted */
+extern uint32_t frame_alloc(void);
+extern uint32_t frame_alloc_zeroed(void);
+extern void frame_get(uint32_t frame);
+extern void frame_put(uint32_t frame);
+extern uint32_t frame_refs(uint32_t frame);
+extern void frame_set_cached(uint32_t frame, int32_t on);
+extern uint32_t frames_shared(void);
+
+/* User address spaces: the 4MB at USER_VIRT, mapped with 4KB pages */
+extern int32_t user_space_init(uint32_t* dir);
+extern void user_space_free(uint32_t* dir);
+extern uint32_t user_space_detach(uint32_t* dir);
+extern void user_space_release(uint32_t pde);
+extern int32_t user_space_fork(uint32_t* dst, uint32_t* src);
+extern uint32_t* user_pte(uint32_t* dir, uint32_t vaddr);
+extern int32_t user_map(uint32_t* dir, uint32_t vaddr, uint32_t frame, uint32_t flags);
+extern void user_unmap(uint32_t* dir, uint32_t vaddr);
+/* 1 if every present page of a range is writable or copy-on-write */
+extern int32_t user_writable(uint32_t* dir, uint32_t addr, uint32_t len);
+
+/* Resolves a page fault on a user address of a process whose heap ends
+ * at brk; 0 if handled */
+extern int32_t mm_fault(uint32_t* dir, uint32_t addr, uint32_t error, uint32_t brk);
+
+#endif /* _MM_H */
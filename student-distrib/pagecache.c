@@ -0,0 +1,208 @@
+/* pagecache.c - Program file pages shared between processes
+ * vim:ts=4 noexpandtab
+ */
+
+#include "pagecache.h"
+#include "mm.h"
+#include "filesys.h"
+#include "lib.h"
+
+#define PCACHE_HASH(inode, index)	(((inode) * 31 + (index)) % PCACHE_BUCKETS)
+#define PCACHE_NONE					-1
+
+typedef struct pcache_entry {
+	uint32_t inode;
+	uint32_t index;
+	uint32_t frame;		/* 0 if the entry is unused */
+	int32_t len;		/* bytes of file in the page */
+	int16_t next;		/* next entry in the bucket */
+} pcache_entry_t;
+
+uint32_t pcache_hits;
+uint32_t pcache_misses;
+
+static pcache_entry_t entries[PCACHE_PAGES];
+static int16_t buckets[PCACHE_BUCKETS];
+static int32_t initialized;
+static uint32_t count;
+/* Where the search for an entry to evict picks up */
+static int32_t hand;
+
+/*
+ * pcache_init
+ *   DESCRIPTION: empties every bucket the first time the cache is used
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void pcache_init(void)
+{
+	int32_t i;
+
+	for(i = 0; i < PCACHE_BUCKETS; i++)
+		buckets[i] = PCACHE_NONE;
+	initialized = 1;
+}
+
+/*
+ * pcache_remove
+ *   DESCRIPTION: takes an entry out of its bucket and drops the cache's
+ *                reference to its frame
+ *   INPUTS: e -- entry to remove
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the frame is freed if nobody else maps it
+ */
+static void pcache_remove(int32_t e)
+{
+	int16_t * link = &buckets[PCACHE_HASH(entries[e].inode, entries[e].index)];
+
+	while(*link != e)
+		link = &entries[*link].next;
+	*link = entries[e].next;
+
+	frame_set_cached(entries[e].frame, 0);
+	frame_put(entries[e].frame);
+	entries[e].frame = 0;
+	count--;
+}
+
+/*
+ * pcache_slot
+ *   DESCRIPTION: finds an unused entry, evicting a page nobody maps if
+ *                the cache is full
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: entry index, PCACHE_NONE if every page is in use
+ *   SIDE EFFECTS: none
+ */
+static int32_t pcache_slot(void)
+{
+	int32_t i, e;
+
+	for(i = 0; i < PCACHE_PAGES; i++)
+	{
+		if(entries[i].frame == 0)
+			return i;
+	}
+	for(i = 0; i < PCACHE_PAGES; i++)
+	{
+		e = hand;
+		hand = (hand + 1) % PCACHE_PAGES;
+		if(frame_refs(entries[e].frame) == 1)
+		{
+			pcache_remove(e);
+			return e;
+		}
+	}
+	return PCACHE_NONE;
+}
+
+/*
+ * pcache_get
+ *   DESCRIPTION: looks a file page up, reading it into a new frame the
+ *                first time. The cache keeps a reference of its own, so
+ *                every mapping of the page is copy-on-write.
+ *   INPUTS: inode -- file's inode
+ *           index -- page number within the file
+ *   OUTPUTS: frame -- physical address, with a reference for the caller
+ *   RETURN VALUE: bytes of file in the page, 0 past the end of the file,
+ *                 -1 if out of memory
+ *   SIDE EFFECTS: the rest of the last page is zeroed
+ */
+int32_t pcache_get(uint32_t inode, uint32_t index, uint32_t* frame)
+{
+	int32_t e, n;
+	uint32_t page;
+
+	if(!initialized)
+		pcache_init();
+
+	for(e = buckets[PCACHE_HASH(inode, index)]; e != PCACHE_NONE; e = entries[e].next)
+	{
+		if(entries[e].inode == inode && entries[e].index == index)
+		{
+			pcache_hits++;
+			frame_get(entries[e].frame);
+			*frame = entries[e].frame;
+			return entries[e].len;
+		}
+	}
+
+	pcache_misses++;
+	if((page = frame_alloc()) == 0)
+		return -1;
+	/* Frames are identity mapped, so read straight into it */
+	n = read_data(inode, index * PAGE_SIZE, (uint8_t *)page, PAGE_SIZE);
+	if(n <= 0)
+	{
+		frame_put(page);
+		return n == 0 ? 0 : -1;
+	}
+	memset((uint8_t *)page + n, 0, PAGE_SIZE - n);
+	*frame = page;
+
+	/* Without a free entry the caller just gets a private page */
+	if((e = pcache_slot()) == PCACHE_NONE)
+		return n;
+	entries[e].inode = inode;
+	entries[e].index = index;
+	entries[e].frame = page;
+	entries[e].len = n;
+	entries[e].next = buckets[PCACHE_HASH(inode, index)];
+	buckets[PCACHE_HASH(inode, index)] = e;
+	frame_get(page);
+	frame_set_cached(page, 1);
+	count++;
+	return n;
+}
+
+/*
+ * pcache_reclaim
+ *   DESCRIPTION: frees every cached page no process maps
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of frames freed
+ *   SIDE EFFECTS: none
+ */
+int32_t pcache_reclaim(void)
+{
+	int32_t e, n = 0;
+
+	for(e = 0; e < PCACHE_PAGES; e++)
+	{
+		if(entries[e].frame != 0 && frame_refs(entries[e].frame) == 1)
+		{
+			pcache_remove(e);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * pcache_invalidate
+ *   DESCRIPTION: forgets every cached page of a file that was written;
+ *                processes mapping one keep their old copy
+ *   INPUTS: inode -- the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void pcache_invalidate(uint32_t inode)
+{
+	int32_t e;
+
+	for(e = 0; e < PCACHE_PAGES; e++)
+	{
+		if(entries[e].frame != 0 && entries[e].inode == inode)
+			pcache_remove(e);
+	}
+}
+
+/* returns the number of pages in the cache */
+uint32_t pcache_pages(void)
+{
+	return count;
+}
@@ -0,0 +1,32 @@
+/* pagecache.h - Program file pages shared between processes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+
+#include "types.h"
+
+/* Most file pages the cache keeps at once */
+#define PCACHE_PAGES	512
+#define PCACHE_BUCKETS	64
+
+/* Lookups that found the page already cached, and ones that read it */
+extern uint32_t pcache_hits;
+extern uint32_t pcache_misses;
+
+/* Gets page index of a file with a new reference for the caller, who
+ * must map it read-only. Returns the bytes of file in the page, 0 past
+ * the end, -1 if out of memory. */
+extern int32_t pcache_get(uint32_t inode, uint32_t index, uint32_t* frame);
+
+/* Drops cached pages nobody maps; returns how many frames were freed */
+extern int32_t pcache_reclaim(void);
+
+/* Forgets a file's pages after it changed */
+extern void pcache_invalidate(uint32_t inode);
+
+/* Pages in the cache right now */
+extern uint32_t pcache_pages(void);
+
+#endif /* _PAGECACHE_H */
@@ -1,7 +1,24 @@
 #include "paging.h"
+#include "apic.h"
+#include "smp.h"
+#include "lib.h"
 
 /*reference credit for design to http://wiki.osdev.org/Setting_Up_Paging*/
-#define PDBR_ADDR 0x1000
+#define PDBR_ADDR KERNEL_PAGE_DIR
+
+/*global bit: the mapping is the same in every address space, so it
+ *survives CR3 loads once CR4.PGE is on*/
+#define PAGE_GLOBAL 0x100
+
+uint32_t tlb_flushes;
+uint32_t tlb_page_flushes;
+uint32_t tlb_switches_skipped;
+
+/*hidden terminals' video pages, in the kernel's own 4mb page*/
+uint8_t backing_pages[NUM_SCREENS][0x1000] __attribute__((aligned(4096)));
+
+/*one page table per terminal for the 4mb holding VIDMAP_VIRT*/
+static uint32_t vidmap_tables[NUM_SCREENS][1024] __attribute__((aligned(4096)));
 /* 
  * paging_init
  *   DESCRIPTION: initializes paging for OS
@@ -31,28 +48,46 @@ void paging_init()
 	
 	table_entry[0] = 0; /*make first page null*/
 	
-	/*set present memory to present*/
-	table_entry[1] |= 3; 
-	table_entry[2] |= 3;
+	/*set present memory to present, kernel mappings are global*/
+	table_entry[1] |= 3 | PAGE_GLOBAL; 
+	table_entry[2] |= 3 | PAGE_GLOBAL;
 	
 
 	/*allocate more memory for video memory (scrolling)*/
-	table_entry[0xB8] |= 3;
+	table_entry[0xB8] |= 3 | PAGE_GLOBAL;
 	for(i = 0x100; i < 0x400; i++)
-		table_entry[i] |= 3;
+		table_entry[i] |= 3 | PAGE_GLOBAL;
+
+	/*application processor startup page, and the end of base memory and
+	 *BIOS area where the MP and ACPI tables are searched for*/
+	table_entry[AP_TRAMPOLINE >> 12] |= 3 | PAGE_GLOBAL;
+	table_entry[0x9F] |= 3 | PAGE_GLOBAL;
+	for(i = 0xE0; i < 0x100; i++)
+		table_entry[i] |= 3 | PAGE_GLOBAL;
 	
 
 	page_directory[0] = (uint32_t)table_entry | 3; //show first 4mb exist
 
 	/*set up kernel paging*/
-	page_directory[1] = (uint32_t)(0x400000 | 0x181); //sets page global,  size to 4mb , r and present
+	page_directory[1] = (uint32_t)(0x400000 | 0x183); //sets page global,  size to 4mb , r/w and present
+
+	/*identity map the frames between the kernel and user space, kernel only*/
+	for(i = 2; i < USER_VIRT / 0x400000; i++)
+		page_directory[i] = (uint32_t)((i * 0x400000) | 0x183); //global 4mb page, kernel level mode, read/write, present
+
+	/*local and I/O APIC registers*/
+	page_directory[APIC_MMIO_BASE / 0x400000] = (uint32_t)(APIC_MMIO_BASE | 0x19B); //global 4mb page, uncached, kernel level mode, read/write, present
+
 
 
+	vidmap_show(0);
 
 	/*
 	 *%cr3 = PDBR
 	 *%cr4 = enable 4mb pages
-	 *%cr0 = enable paging
+	 *%cr0 = enable paging, and write protect so the kernel faults on
+	 *       copy-on-write user pages too
+	 *%cr4 = enable global pages, which must come after paging is on
 	*/
 	asm volatile("				\n\
 		movl %%esi, %%cr3		\n\
@@ -60,8 +95,11 @@ void paging_init()
 		orl $0x10, %%esi		\n\
 		movl %%esi, %%cr4		\n\
 		movl %%cr0, %%esi		\n\
-		orl $0x80000000, %%esi	\n\
+		orl $0x80010000, %%esi	\n\
 		movl %%esi, %%cr0		\n\
+		movl %%cr4, %%esi		\n\
+		orl $0x80, %%esi		\n\
+		movl %%esi, %%cr4		\n\
 		"
 		:
 		:"S"(page_directory)
@@ -105,6 +143,7 @@ extern int32_t palloc(uint32_t virtual_addr, uint32_t physical_addr, uint32_t ty
 		else
 			pdbr[page_dir_index] = (physical_addr & 0xFFC00000) | 0x87; //4mb page, user level mode, read/write, present
 
+		tlb_flush_page(virtual_addr);
 		return 0;
 	}
 	else if(privilege == 0)
@@ -126,6 +165,129 @@ extern int32_t palloc(uint32_t virtual_addr, uint32_t physical_addr, uint32_t ty
 
 	pdbr[page_dir_index] = (uint32_t)table_entry | 3; //show first 4mb exist
 
+	/*the entry was live, drop whatever the tlb cached for it*/
+	for(i=0; i<1024; i++)
+		tlb_flush_page((virtual_addr & 0xFFC00000) + i * 0x1000);
+
 	return 0;
 }
 
+
+/* 
+ * page_dir_init
+ *   DESCRIPTION: fills in a process page directory with the kernel
+ *                mappings, which are the same in every address space
+ *   INPUTS: dir -- page aligned directory to fill
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void page_dir_init(uint32_t* dir)
+{
+	memcpy(dir, (uint32_t *)PDBR_ADDR, 4096);
+}
+
+/* 
+ * page_dir_vidmap
+ *   DESCRIPTION: maps a terminal's video page at VIDMAP_VIRT. The page table
+ *                is shared by everything on that terminal, so vidmap_show
+ *                can move all of them at once.
+ *   INPUTS: dir -- process page directory
+ *           term -- terminal number, -1 to unmap
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: invalidates VIDMAP_VIRT if dir is loaded
+ */
+void page_dir_vidmap(uint32_t* dir, int32_t term)
+{
+	if(term < 0 || term >= NUM_SCREENS)
+		dir[VIDMAP_VIRT / 0x400000] = 2; //not present
+	else
+		dir[VIDMAP_VIRT / 0x400000] = (uint32_t)vidmap_tables[term] | 7; //user level, r/w, present
+
+	if(page_dir_loaded(dir))
+		tlb_flush_page(VIDMAP_VIRT);
+}
+
+/* 
+ * vidmap_show
+ *   DESCRIPTION: redirects programs drawing into a terminal's video page:
+ *                the shown terminal gets VGA memory, the others their
+ *                backing pages, so hidden programs never touch the screen
+ *   INPUTS: shown -- terminal on the display
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: invalidates VIDMAP_VIRT here and on the other processors;
+ *                 other address spaces pick the change up on their next
+ *                 CR3 load, as it isn't global
+ */
+void vidmap_show(int32_t shown)
+{
+	int i;
+
+	for(i = 0; i < NUM_SCREENS; i++)
+	{
+		if(i == shown)
+			vidmap_tables[i][0] = VIDEO_PAGE | 7; //user level, r/w, present
+		else
+			vidmap_tables[i][0] = BACKING_PAGE(i) | 7;
+	}
+
+	tlb_flush_page(VIDMAP_VIRT);
+	smp_flush_page_others(VIDMAP_VIRT);
+}
+
+/* 
+ * set_page_dir
+ *   DESCRIPTION: loads a page directory
+ *   INPUTS: dir -- page directory to use
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB except for global kernel pages
+ */
+void set_page_dir(uint32_t* dir)
+{
+	tlb_flushes++;
+	asm volatile("movl %0, %%cr3" : : "r"(dir) : "memory");
+}
+
+/* 
+ * switch_page_dir
+ *   DESCRIPTION: loads a page directory on a context switch, keeping the
+ *                TLB when the next thread runs in the same address space
+ *   INPUTS: dir -- page directory to use
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB if dir isn't loaded yet
+ */
+void switch_page_dir(uint32_t* dir)
+{
+	if(page_dir_loaded(dir))
+		tlb_switches_skipped++;
+	else
+		set_page_dir(dir);
+}
+
+/* 
+ * tlb_flush_page
+ *   DESCRIPTION: invalidates the TLB entry (and cached directory entry)
+ *                for one page of the loaded address space
+ *   INPUTS: vaddr -- any address in the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void tlb_flush_page(uint32_t vaddr)
+{
+	tlb_page_flushes++;
+	asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+
+/* returns nonzero if dir is in %cr3 */
+int32_t page_dir_loaded(uint32_t* dir)
+{
+	uint32_t * cur;
+
+	asm volatile("movl %%cr3, %0" : "=r"(cur));
+	return cur == dir;
+}
@@ -4,10 +4,57 @@
 
 #include "types.h"
 
+/* Kernel page directory */
+#define KERNEL_PAGE_DIR	0x1000
+
+/* User address space: 4MB holding the program image and stack, mapped
+ * with 4KB pages. Physical memory below it is identity mapped for the
+ * kernel only. */
+#define USER_VIRT		0x08000000
+#define USER_PAGE_SIZE	0x400000
+#define USER_IMAGE		0x08048000
+#define USER_STACK		(USER_VIRT + USER_PAGE_SIZE - 4)
+
+/* Where vidmap puts a program's text-mode video page */
+#define VIDMAP_VIRT		0x08400000
+#define VIDEO_PAGE		0xB8000
+/* Off-screen page a hidden terminal's video page is redirected to:
+ * ordinary kernel memory, not the spare VGA pages past VIDEO_PAGE */
+#define BACKING_PAGE(term)	((uint32_t)backing_pages[term])
+extern uint8_t backing_pages[][0x1000];
+
 /*initializes first 8mb of paging*/
 extern void paging_init();
 
 /*allocated virtual specified virtual memory, size is in 4kb and rounds up to the nearest 4kb*/
 extern int32_t palloc(uint32_t virtual_addr, uint32_t physical_addr, uint32_t type, uint32_t privilege);
 
+/*fills a process page directory with the kernel mappings*/
+extern void page_dir_init(uint32_t* dir);
+
+/*maps the video page of terminal term at VIDMAP_VIRT, term -1 unmaps it*/
+extern void page_dir_vidmap(uint32_t* dir, int32_t term);
+
+/*points terminal vidmaps at VGA memory for shown, backing pages for the rest*/
+extern void vidmap_show(int32_t shown);
+
+/*TLB counters: full flushes (CR3 loads), single pages invalidated, and
+ *address space switches that kept the TLB because nothing changed*/
+extern uint32_t tlb_flushes;
+extern uint32_t tlb_page_flushes;
+extern uint32_t tlb_switches_skipped;
+
+/*loads a page directory, flushing every non-global TLB entry*/
+extern void set_page_dir(uint32_t* dir);
+
+/*loads a page directory unless it is already loaded, e.g. switching
+ *between threads of one address space*/
+extern void switch_page_dir(uint32_t* dir);
+
+/*invalidates one page of the loaded address space*/
+extern void tlb_flush_page(uint32_t vaddr);
+
+/*returns nonzero if dir is the loaded page directory*/
+extern int32_t page_dir_loaded(uint32_t* dir);
+
 #endif
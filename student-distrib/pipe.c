@@ -0,0 +1,275 @@
+/* pipe.c - Kernel pipes
+ * vim:ts=4 noexpandtab
+ */
+
+#include "pipe.h"
+#include "syscall.h"
+#include "process.h"
+#include "poll.h"
+#include "lib.h"
+
+#define PIPE_MASK	(PIPE_SIZE - 1)
+
+/* A ring buffer between two sets of fds. The indices run freely and are
+ * masked on access; head == tail is empty. */
+typedef struct pipe {
+	uint8_t buf[PIPE_SIZE];
+	uint32_t head;
+	uint32_t tail;
+	int32_t readers;		/* open read end fds, across all processes */
+	int32_t writers;		/* open write end fds */
+	wait_queue_t read_wq;	/* readers waiting for data */
+	wait_queue_t write_wq;	/* writers waiting for room */
+} pipe_t;
+
+static pipe_t pipes[MAX_PIPES];
+
+/* 
+ * pipe_read
+ *   DESCRIPTION: Reads whatever is in the pipe, up to nbytes. Sleeps while
+ *                it is empty and someone could still write.
+ *   INPUTS: file -- read end
+ *           buf -- destination
+ *           nbytes -- size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: bytes read, 0 at end of file, -1 if a signal arrives
+ *                 while it waits
+ *   SIDE EFFECTS: wakes blocked writers
+ */
+static int32_t
+pipe_read(file_t* file, void* buf, int32_t nbytes)
+{
+	pipe_t* p = file->data;
+	uint32_t flags, n, start, first;
+
+	cli_and_save(flags);
+	while(p->head == p->tail && p->writers > 0) {
+		if(signal_pending(current)) {
+			restore_flags(flags);
+			return -1;
+		}
+		sleep_on(&p->read_wq);
+	}
+
+	n = p->tail - p->head;
+	if(n > nbytes)
+		n = nbytes;
+	start = p->head & PIPE_MASK;
+	first = PIPE_SIZE - start;
+	if(first > n)
+		first = n;
+	memcpy(buf, p->buf + start, first);
+	memcpy((uint8_t*)buf + first, p->buf, n - first);
+	p->head += n;
+
+	if(n > 0)
+		wake_up(&p->write_wq);
+	restore_flags(flags);
+	return n;
+}
+
+/* 
+ * pipe_write
+ *   DESCRIPTION: Writes all of buf, sleeping whenever the pipe is full
+ *   INPUTS: file -- write end
+ *           buf -- data to write
+ *           nbytes -- bytes in buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: bytes written, fewer if a signal arrives while it
+ *                 waits; -1 if none were because of that or because nobody
+ *                 can ever read them
+ *   SIDE EFFECTS: wakes blocked readers
+ */
+static int32_t
+pipe_write(file_t* file, const void* buf, int32_t nbytes)
+{
+	pipe_t* p = file->data;
+	uint32_t flags, n, start, first;
+	int32_t done = 0;
+
+	cli_and_save(flags);
+	while(done < nbytes) {
+		while(p->tail - p->head == PIPE_SIZE && p->readers > 0 &&
+				!signal_pending(current))
+			sleep_on(&p->write_wq);
+		if(p->readers == 0 || p->tail - p->head == PIPE_SIZE)
+			break;
+
+		n = PIPE_SIZE - (p->tail - p->head);
+		if(n > nbytes - done)
+			n = nbytes - done;
+		start = p->tail & PIPE_MASK;
+		first = PIPE_SIZE - start;
+		if(first > n)
+			first = n;
+		memcpy(p->buf + start, (const uint8_t*)buf + done, first);
+		memcpy(p->buf, (const uint8_t*)buf + done + first, n - first);
+		p->tail += n;
+		done += n;
+		wake_up(&p->read_wq);
+	}
+	restore_flags(flags);
+
+	if(done == 0 && nbytes > 0)
+		return -1;
+	return done;
+}
+
+/* Writing the read end or reading the write end fails */
+static int32_t
+pipe_bad_read(file_t* file, void* buf, int32_t nbytes)
+{
+	return -1;
+}
+
+static int32_t
+pipe_bad_write(file_t* file, const void* buf, int32_t nbytes)
+{
+	return -1;
+}
+
+static int32_t
+pipe_open(file_t* file, const uint8_t* fname)
+{
+	return -1;
+}
+
+/* 
+ * pipe_read_close, pipe_write_close
+ *   DESCRIPTION: Drops one fd of an end. The last reader going away fails
+ *                blocked writers; the last writer going away gives
+ *                readers end of file. The pipe is freed with its last fd.
+ *   INPUTS: file -- fd being closed
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+pipe_read_close(file_t* file)
+{
+	pipe_t* p = file->data;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	p->readers--;
+	wake_up(&p->write_wq);
+	restore_flags(flags);
+	return 0;
+}
+
+static int32_t
+pipe_write_close(file_t* file)
+{
+	pipe_t* p = file->data;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	p->writers--;
+	wake_up(&p->read_wq);
+	restore_flags(flags);
+	return 0;
+}
+
+static void
+pipe_read_dup(file_t* file)
+{
+	((pipe_t*)file->data)->readers++;
+}
+
+static void
+pipe_write_dup(file_t* file)
+{
+	((pipe_t*)file->data)->writers++;
+}
+
+/* 
+ * pipe_read_poll, pipe_write_poll
+ *   DESCRIPTION: Readiness checks for poll. The other end signals the
+ *                queue on every transfer and when it closes.
+ *   INPUTS: file -- fd being polled
+ *           pt -- poll call to register, or NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: ready POLL* events
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static int32_t
+pipe_read_poll(file_t* file, poll_table_t* pt)
+{
+	pipe_t* p = file->data;
+	int32_t mask = 0;
+
+	poll_wait(&p->read_wq, pt);
+	if(p->head != p->tail)
+		mask |= POLLIN;
+	if(p->writers == 0)
+		mask |= POLLHUP;
+	return mask;
+}
+
+static int32_t
+pipe_write_poll(file_t* file, poll_table_t* pt)
+{
+	pipe_t* p = file->data;
+
+	poll_wait(&p->write_wq, pt);
+	if(p->readers == 0)
+		return POLLERR;
+	if(p->tail - p->head < PIPE_SIZE)
+		return POLLOUT;
+	return 0;
+}
+
+static file_ops_t pipe_read_ops = { pipe_open, pipe_read, pipe_bad_write, pipe_read_close, NULL, pipe_read_poll, pipe_read_dup };
+static file_ops_t pipe_write_ops = { pipe_open, pipe_bad_read, pipe_write, pipe_write_close, NULL, pipe_write_poll, pipe_write_dup };
+
+/* 
+ * sys_pipe
+ *   DESCRIPTION: Creates a pipe and opens both ends in the current process
+ *   INPUTS: fds -- user array of two fds to fill in
+ *   OUTPUTS: fds[0] is the read end, fds[1] the write end
+ *   RETURN VALUE: 0, -1 if no pipe or fds are free
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_pipe(int32_t* fds)
+{
+	int32_t i, rfd, wfd;
+	file_t* files = current->files;
+	pipe_t* p = NULL;
+
+	if(bad_userspace_write(fds, 2 * sizeof(int32_t)))
+		return -1;
+
+	/* A pipe is free once both ends are closed everywhere */
+	for(i = 0; i < MAX_PIPES; i++) {
+		if(pipes[i].readers == 0 && pipes[i].writers == 0) {
+			p = &pipes[i];
+			break;
+		}
+	}
+	if(p == NULL || (rfd = alloc_fd()) == -1)
+		return -1;
+	files[rfd].flags = FD_IN_USE;
+	if((wfd = alloc_fd()) == -1) {
+		files[rfd].flags = 0;
+		return -1;
+	}
+
+	p->head = p->tail = 0;
+	p->readers = p->writers = 1;
+	p->read_wq.head = NULL;
+	p->write_wq.head = NULL;
+
+	files[rfd].ops = &pipe_read_ops;
+	files[rfd].data = p;
+	files[rfd].inode = 0;
+	files[rfd].pos = 0;
+	files[rfd].mode = 0;
+
+	files[wfd] = files[rfd];
+	files[wfd].ops = &pipe_write_ops;
+
+	fds[0] = rfd;
+	fds[1] = wfd;
+	return 0;
+}
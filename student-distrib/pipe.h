@@ -0,0 +1,18 @@
+/* pipe.h - Kernel pipes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "types.h"
+
+/* Bytes a pipe holds; must be a power of two */
+#define PIPE_SIZE	4096
+/* Pipes open at once, system wide */
+#define MAX_PIPES	8
+
+/* Creates a pipe; fds[0] is the read end and fds[1] the write end */
+extern int32_t sys_pipe(int32_t* fds);
+
+#endif /* _PIPE_H */
@@ -0,0 +1,29 @@
+/*pit.c*/
+#include "pit.h"
+#include "lib.h"
+
+volatile uint32_t pit_ticks;
+
+/*PIT_INIT
+*Purpose:	Program channel 0 of the PIT to fire IRQ0 at PIT_HZ
+*Action:	Selects channel 0, lobyte/hibyte access, mode 3 (square wave)
+*			and writes the divisor for PIT_HZ
+*/
+void pit_init(void)
+{
+	uint32_t divisor = PIT_BASE_FREQ / PIT_HZ;
+
+	pit_ticks = 0;
+	outb(0x36, PIT_CMD);
+	outb(divisor & 0xFF, PIT_CH0);
+	outb((divisor >> 8) & 0xFF, PIT_CH0);
+}
+
+/*PIT_INTR
+*Purpose:	Account for one timer tick
+*Note:		Should only be called by the timer chip handler
+*/
+void pit_intr(void)
+{
+	pit_ticks++;
+}
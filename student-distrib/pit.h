@@ -0,0 +1,23 @@
+/* pit.h - Programmable interval timer (8253/8254) */
+#ifndef _PIT_H
+#define _PIT_H
+
+#include "types.h"
+
+#define PIT_CMD		0x43
+#define PIT_CH0		0x40
+
+/* Input clock of the PIT and the tick rate we program channel 0 to */
+#define PIT_BASE_FREQ	1193182
+#define PIT_HZ			100
+
+/* Converts a time in tenths of a second to PIT ticks */
+#define DECISEC_TO_TICKS(ds)	((ds) * (PIT_HZ / 10))
+
+/* Ticks since pit_init(), incremented by the timer chip handler */
+extern volatile uint32_t pit_ticks;
+
+extern void pit_init(void);
+extern void pit_intr(void);
+
+#endif
@@ -0,0 +1,146 @@
+/* poll.c - Waiting on several file descriptors at once
+ * vim:ts=4 noexpandtab
+ */
+
+#include "poll.h"
+#include "process.h"
+#include "lib.h"
+#include "pit.h"
+
+/* 
+ * poll_wake
+ *   DESCRIPTION: Wake function of a poll entry: marks the poll call as
+ *                signalled and wakes the process blocked in it
+ *   INPUTS: entry -- entry on the signalled queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from wake_up, often in an interrupt handler
+ */
+static void
+poll_wake(wait_entry_t* entry)
+{
+	poll_table_t* pt = entry->data;
+
+	pt->triggered = 1;
+	wake_process(entry->pcb);
+}
+
+/* 
+ * poll_wait
+ *   DESCRIPTION: Registers a poll call on a device's wait queue
+ *   INPUTS: q -- queue signalled when the device's state changes
+ *           pt -- poll call, or NULL if already registered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+poll_wait(wait_queue_t* q, poll_table_t* pt)
+{
+	wait_entry_t* entry;
+
+	if(pt == NULL || pt->count >= POLL_MAX_WAITS)
+		return;
+	entry = &pt->entries[pt->count];
+	entry->pcb = current;
+	entry->func = poll_wake;
+	entry->data = pt;
+	pt->queues[pt->count] = q;
+	pt->count++;
+	add_wait_queue(q, entry);
+}
+
+/* 
+ * poll_scan
+ *   DESCRIPTION: Asks every fd in the set which events are ready
+ *   INPUTS: fds -- user array, revents filled in
+ *           nfds -- entries in fds
+ *           pt -- poll call to register, NULL after the first pass
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of entries with events
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+poll_scan(pollfd_t* fds, int32_t nfds, poll_table_t* pt)
+{
+	int32_t i, mask, ready = 0;
+	file_t* file;
+
+	for(i = 0; i < nfds; i++) {
+		file = get_file(fds[i].fd);
+		if(file == NULL)
+			mask = POLLNVAL;
+		else if(file->ops->poll == NULL)
+			mask = POLLIN | POLLOUT;
+		else
+			mask = file->ops->poll(file, pt);
+
+		fds[i].revents = mask & (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+		if(fds[i].revents != 0)
+			ready++;
+	}
+	return ready;
+}
+
+/* 
+ * sys_poll
+ *   DESCRIPTION: Waits until one of a set of fds is ready. Devices signal
+ *                their wait queues from their interrupt handlers when they
+ *                become ready, so a single blocked call wakes on whichever
+ *                source comes first; the fds are only scanned again after
+ *                one of them was signalled.
+ *   INPUTS: fds -- fds and the events of interest
+ *           nfds -- entries in fds, at most MAX_FILES
+ *           timeout -- milliseconds to wait, 0 to not block, -1 forever
+ *   OUTPUTS: revents of each entry
+ *   RETURN VALUE: number of entries with events, 0 on timeout, -1 on bad
+ *                 arguments or if a signal arrives while it waits
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_poll(pollfd_t* fds, int32_t nfds, int32_t timeout)
+{
+	poll_table_t pt;
+	poll_table_t* wait = &pt;
+	uint32_t flags, start, ticks = 0, elapsed;
+	int32_t i, ready;
+
+	if(nfds < 0 || nfds > MAX_FILES ||
+			bad_userspace_write(fds, nfds * sizeof(pollfd_t)))
+		return -1;
+	if(timeout > 0)
+		ticks = (timeout * PIT_HZ + 999) / 1000;
+
+	pt.triggered = 0;
+	pt.count = 0;
+
+	cli_and_save(flags);
+	start = pit_ticks;
+	while(1) {
+		ready = poll_scan(fds, nfds, wait);
+		wait = NULL;
+		if(ready > 0 || timeout == 0)
+			break;
+		if(signal_pending(current)) {
+			ready = -1;
+			break;
+		}
+
+		/* Sleep until a registered queue fires or time runs out. */
+		pt.triggered = 0;
+		elapsed = pit_ticks - start;
+		if(timeout > 0 && elapsed >= ticks)
+			break;
+		while(!pt.triggered && !signal_pending(current)) {
+			sched_sleep(timeout > 0 ? ticks - elapsed : 0);
+			elapsed = pit_ticks - start;
+			if(timeout > 0 && elapsed >= ticks)
+				break;
+		}
+	}
+
+	for(i = 0; i < pt.count; i++)
+		remove_wait_queue(pt.queues[i], &pt.entries[i]);
+	restore_flags(flags);
+	return ready;
+}
@@ -0,0 +1,43 @@
+/* poll.h - Waiting on several file descriptors at once
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _POLL_H
+#define _POLL_H
+
+#include "types.h"
+#include "sched.h"
+#include "syscall.h"
+
+/* Event bits, must match syscalls/ece391syscall.h */
+#define POLLIN		0x01	/* a read would not block */
+#define POLLOUT		0x04	/* a write would not block */
+#define POLLERR		0x08
+#define POLLHUP		0x10	/* the other end of a pipe is gone */
+#define POLLNVAL	0x20	/* fd is not open */
+
+/* One entry of the array passed to poll */
+typedef struct pollfd {
+	int32_t fd;
+	int16_t events;		/* events the caller is interested in */
+	int16_t revents;	/* events that happened, filled in by poll */
+} pollfd_t;
+
+/* Wait queues a poll call is registered on; every open fd registers on
+ * at most one device queue */
+#define POLL_MAX_WAITS	MAX_FILES
+
+struct poll_table {
+	int32_t triggered;		/* set by the callback of any queue */
+	int32_t count;
+	wait_entry_t entries[POLL_MAX_WAITS];
+	wait_queue_t* queues[POLL_MAX_WAITS];
+};
+
+/* Called by a device's poll op to be woken when q is signalled. Does
+ * nothing when pt is NULL (only the first pass of poll registers). */
+extern void poll_wait(wait_queue_t* q, poll_table_t* pt);
+
+extern int32_t sys_poll(pollfd_t* fds, int32_t nfds, int32_t timeout);
+
+#endif /* _POLL_H */
@@ -0,0 +1,604 @@
+/* process.c - Process control blocks, execute and halt
+ * vim:ts=4 noexpandtab
+ */
+
+#include "process.h"
+#include "paging.h"
+#include "mm.h"
+#include "execcache.h"
+#include "filesys.h"
+#include "x86_desc.h"
+#include "lib.h"
+
+/* EFLAGS a program starts with: interrupts on plus the reserved bit */
+#define USER_EFLAGS		0x202
+
+kstack_t kernel_stacks[MAX_PROCESSES] __attribute__((aligned(KSTACK_SIZE)));
+static uint32_t page_dirs[MAX_PROCESSES][1024] __attribute__((aligned(4096)));
+
+/* Free process slots: a stack of pids chained through next_free, -1 at
+ * the bottom, then the slots from pids_used up that were never used */
+static int32_t free_pid = -1;
+static int32_t next_free[MAX_PROCESSES];
+static int32_t pids_used;
+
+/* 
+ * parse_command
+ *   DESCRIPTION: Splits a command line into program name and arguments
+ *                and checks the program is an executable. Everything is
+ *                copied out of user space before the caller replaces it.
+ *   INPUTS: command -- program name followed by its arguments
+ *   OUTPUTS: args -- argument string
+ *   RETURN VALUE: the program's exec cache entry, NULL if it can't be run
+ *   SIDE EFFECTS: none
+ */
+static exec_image_t*
+parse_command(const uint8_t* command, uint8_t* args)
+{
+	uint8_t name[MAX_NAME + 1];
+	int32_t i, j;
+
+	/* Program name runs up to the first space, the rest are arguments */
+	for(i = 0; command[i] == ' '; i++);
+	for(j = 0; command[i] != '\0' && command[i] != ' '; i++, j++) {
+		if(j >= MAX_NAME)
+			return NULL;
+		name[j] = command[i];
+	}
+	name[j] = '\0';
+	while(command[i] == ' ')
+		i++;
+	if(strlen((int8_t*)command + i) >= MAX_ARGS)
+		return NULL;
+	strcpy((int8_t*)args, (int8_t*)command + i);
+	return exec_cache_get(name);
+}
+
+/* 
+ * user_context
+ *   DESCRIPTION: Fills in the registers a program starts with
+ *   INPUTS: regs -- frame to fill
+ *           entry -- program entry point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+user_context(hw_context_t* regs, uint32_t entry)
+{
+	memset(regs, 0, sizeof(hw_context_t));
+	regs->ds = USER_DS;
+	regs->es = USER_DS;
+	regs->fs = USER_DS;
+	regs->eip = entry;
+	regs->cs = USER_CS;
+	regs->eflags = USER_EFLAGS;
+	regs->esp = USER_STACK;
+	regs->ss = USER_DS;
+}
+
+/* 
+ * release_vidmap
+ *   DESCRIPTION: Takes away a process's video page mapping
+ *   INPUTS: p -- process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+release_vidmap(pcb_t* p)
+{
+	if(p->uses_vidmap) {
+		p->uses_vidmap = 0;
+		page_dir_vidmap(p->page_dir, -1);
+		screen_set_mapped(p->terminal, 0);
+	}
+}
+
+/* 
+ * process_exec
+ *   DESCRIPTION: Replaces a process's program. The new image is built in
+ *                a fresh page table and the old one is only dropped once
+ *                that worked, so a failed exec leaves the caller intact.
+ *   INPUTS: p -- process whose program is replaced
+ *           command -- program name followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the program can't be run
+ *   SIDE EFFECTS: the user frame at the top of p's kernel stack starts
+ *                 the program when p next returns to user mode
+ */
+static int32_t
+process_exec(pcb_t* p, const uint8_t* command)
+{
+	uint8_t args[MAX_ARGS];
+	exec_image_t* img;
+	uint32_t old, end = 0;
+
+	img = parse_command(command, args);
+	if(img == NULL)
+		return -1;
+
+	old = user_space_detach(p->page_dir);
+	if(user_space_init(p->page_dir) == -1 ||
+			(end = exec_image_map(img, p->page_dir)) == 0) {
+		user_space_free(p->page_dir);
+		p->page_dir[USER_VIRT / USER_PAGE_SIZE] = old;
+		return -1;
+	}
+	/* Detaching flushed the old pages and nothing has touched the new
+	 * ones through user addresses, so the TLB needs nothing more */
+	user_space_release(old);
+	release_vidmap(p);
+	fpu_release(p);
+
+	p->heap_start = end;
+	p->brk = end;
+	p->sig_pending = 0;
+	p->sig_blocked = 0;
+	memset(p->sig_handlers, 0, sizeof(p->sig_handlers));
+	strcpy((int8_t*)p->args, (int8_t*)args);
+	user_context((hw_context_t*)p->kstack_top - 1, img->entry);
+	return 0;
+}
+
+/* 
+ * process_alloc
+ *   DESCRIPTION: Claims a free process slot, with the kernel mappings but
+ *                no user space yet
+ *   INPUTS: terminal -- terminal the process belongs to
+ *           parent -- process that will wait for it, NULL for a root shell
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new process, NULL if the table is full
+ *   SIDE EFFECTS: the process is PROC_NEW until the caller makes it
+ *                 runnable
+ */
+static pcb_t*
+process_alloc(int32_t terminal, pcb_t* parent)
+{
+	uint32_t flags;
+	switch_frame_t* frame;
+	int32_t pid;
+	pcb_t* p;
+
+	cli_and_save(flags);
+	if(free_pid != -1) {
+		pid = free_pid;
+		free_pid = next_free[pid];
+	} else if(pids_used < MAX_PROCESSES) {
+		pid = pids_used++;
+	} else {
+		restore_flags(flags);
+		return NULL;
+	}
+	p = PCB(pid);
+	p->state = PROC_NEW;
+	restore_flags(flags);
+
+	p->pid = pid;
+	p->page_dir = page_dirs[pid];
+	page_dir_init(p->page_dir);
+	p->parent = parent;
+	p->root = (parent == NULL);
+	p->terminal = terminal;
+	p->uses_vidmap = 0;
+	p->exit_status = 0;
+	p->wake_tick = 0;
+	p->exit_wq.head = NULL;
+	p->args[0] = '\0';
+	p->heap_start = 0;
+	p->brk = 0;
+	p->fpu_used = 0;
+	p->fpu_restores = 0;
+	p->fpu_cpu = -1;
+	p->sig_pending = 0;
+	p->sig_blocked = 0;
+	memset(p->sig_handlers, 0, sizeof(p->sig_handlers));
+	p->cpu = this_cpu()->id;
+	p->pinned = 0;
+	p->idle_prio = 0;
+	p->rq_next = NULL;
+
+	/* The first switch to it "returns" through the user frame at the top
+	 * of its kernel stack */
+	p->kstack_top = (uint32_t)(&kernel_stacks[pid] + 1);
+	frame = (switch_frame_t*)((hw_context_t*)p->kstack_top - 1) - 1;
+	memset(frame, 0, sizeof(switch_frame_t));
+	frame->ret = (uint32_t)return_from_interrupt;
+	p->ksp = (uint32_t)frame;
+	return p;
+}
+
+/* 
+ * process_free
+ *   DESCRIPTION: Puts a process slot back on the free list
+ *   INPUTS: p -- process whose resources are all released
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+process_free(pcb_t* p)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	p->state = PROC_FREE;
+	next_free[p->pid] = free_pid;
+	free_pid = p->pid;
+	restore_flags(flags);
+}
+
+/* 
+ * process_discard
+ *   DESCRIPTION: Frees a process that never ran
+ *   INPUTS: p -- process from process_alloc or process_fork
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+process_discard(pcb_t* p)
+{
+	files_close_all(p->files);
+	user_space_free(p->page_dir);
+	process_free(p);
+}
+
+/* 
+ * process_create
+ *   DESCRIPTION: Starts a terminal's root shell
+ *   INPUTS: command -- program name followed by its arguments
+ *           terminal -- terminal the process belongs to
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new process, NULL on failure
+ *   SIDE EFFECTS: the process is runnable
+ */
+pcb_t*
+process_create(const uint8_t* command, int32_t terminal)
+{
+	pcb_t* p = process_alloc(terminal, NULL);
+
+	if(p == NULL)
+		return NULL;
+	files_init(p->files, terminal);
+	if(process_exec(p, command) == -1) {
+		process_discard(p);
+		return NULL;
+	}
+	sched_add(p);
+	return p;
+}
+
+/* 
+ * process_fork
+ *   DESCRIPTION: Copies the current process. The user pages are shared
+ *                copy-on-write, so this is only page table work. The
+ *                child resumes from the same system call with eax 0.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the child, NULL on failure
+ *   SIDE EFFECTS: the child is PROC_NEW until the caller makes it runnable
+ */
+static pcb_t*
+process_fork(void)
+{
+	pcb_t* parent = current;
+	hw_context_t* regs;
+	pcb_t* p;
+
+	p = process_alloc(parent->terminal, parent);
+	if(p == NULL)
+		return NULL;
+	if(user_space_fork(p->page_dir, parent->page_dir) == -1) {
+		user_space_free(p->page_dir);
+		process_free(p);
+		return NULL;
+	}
+	files_inherit(p->files, parent->files);
+	strcpy((int8_t*)p->args, (int8_t*)parent->args);
+	p->heap_start = parent->heap_start;
+	p->brk = parent->brk;
+	memcpy(p->sig_handlers, parent->sig_handlers, sizeof(p->sig_handlers));
+	fpu_fork(p, parent);
+
+	regs = (hw_context_t*)p->kstack_top - 1;
+	*regs = *((hw_context_t*)parent->kstack_top - 1);
+	regs->eax = 0;
+	return p;
+}
+
+/* 
+ * process_wait
+ *   DESCRIPTION: Waits for a child to halt and frees its slot
+ *   INPUTS: child -- child of the current process
+ *   OUTPUTS: none
+ *   RETURN VALUE: the child's exit status, -1 if a signal arrives first,
+ *                 leaving the child to be waited for again
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+process_wait(pcb_t* child)
+{
+	uint32_t flags;
+	int32_t status;
+
+	cli_and_save(flags);
+	while(child->state != PROC_ZOMBIE) {
+		if(signal_pending(current)) {
+			restore_flags(flags);
+			return -1;
+		}
+		sleep_on(&child->exit_wq);
+	}
+	status = child->exit_status;
+	process_free(child);
+	restore_flags(flags);
+	return status;
+}
+
+/* 
+ * sys_fork
+ *   DESCRIPTION: Creates a copy of the caller
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the child's pid in the parent, 0 in the child, -1 if
+ *                 out of processes or memory
+ *   SIDE EFFECTS: the caller must collect the child with wait
+ */
+int32_t
+sys_fork(void)
+{
+	pcb_t* child = process_fork();
+
+	if(child == NULL)
+		return -1;
+	sched_add(child);
+	return child->pid;
+}
+
+/* 
+ * sys_exec
+ *   DESCRIPTION: Replaces the caller's program, keeping its pid and fds
+ *   INPUTS: command -- program name followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: does not return on success, -1 if the program can't be
+ *                 run
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_exec(const uint8_t* command)
+{
+	if(bad_userspace_str(command))
+		return -1;
+	return process_exec(current, command);
+}
+
+/* 
+ * sys_sbrk
+ *   DESCRIPTION: Grows or shrinks the caller's heap. Growing only moves
+ *                the break; pages are mapped zeroed when first touched.
+ *   INPUTS: increment -- bytes to add, negative to give memory back
+ *   OUTPUTS: none
+ *   RETURN VALUE: the old break, -1 if it would leave the heap's range
+ *   SIDE EFFECTS: pages wholly above a lowered break are freed
+ */
+int32_t
+sys_sbrk(int32_t increment)
+{
+	uint32_t old = current->brk;
+	uint32_t new = old + increment;
+	uint32_t page;
+
+	if(increment >= 0 ? (new < old || new > USER_STACK_LIMIT) :
+			(new > old || new < current->heap_start))
+		return -1;
+	if(increment < 0) {
+		for(page = PAGE_ROUND_UP(new); page < old; page += PAGE_SIZE) {
+			user_unmap(current->page_dir, page);
+			tlb_flush_page(page);
+		}
+	}
+	current->brk = new;
+	return old;
+}
+
+/* 
+ * spawn
+ *   DESCRIPTION: Forks the caller and runs a program in the child
+ *   INPUTS: command -- program name followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: the runnable child, NULL if it could not be run
+ *   SIDE EFFECTS: none
+ */
+static pcb_t*
+spawn(const uint8_t* command)
+{
+	pcb_t* child;
+
+	if(bad_userspace_str(command))
+		return NULL;
+	child = process_fork();
+	if(child == NULL)
+		return NULL;
+	if(process_exec(child, command) == -1) {
+		process_discard(child);
+		return NULL;
+	}
+	sched_add(child);
+	return child;
+}
+
+/* 
+ * sys_execute
+ *   DESCRIPTION: Runs a program on the caller's terminal and waits for it
+ *   INPUTS: command -- program name followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: the program's exit status, -1 if it could not be run or
+ *                 a signal cut the wait short
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_execute(const uint8_t* command)
+{
+	pcb_t* child = spawn(command);
+
+	if(child == NULL)
+		return -1;
+	return process_wait(child);
+}
+
+/* 
+ * sys_spawn
+ *   DESCRIPTION: Starts a program without waiting for it, so several can
+ *                run at once, e.g. the stages of a pipeline
+ *   INPUTS: command -- program name followed by its arguments
+ *   OUTPUTS: none
+ *   RETURN VALUE: pid of the new process, -1 if it could not be run
+ *   SIDE EFFECTS: the caller must collect it with wait
+ */
+int32_t
+sys_spawn(const uint8_t* command)
+{
+	pcb_t* child = spawn(command);
+
+	if(child == NULL)
+		return -1;
+	return child->pid;
+}
+
+/* 
+ * sys_wait
+ *   DESCRIPTION: Waits for a spawned child to halt
+ *   INPUTS: pid -- child's pid
+ *   OUTPUTS: none
+ *   RETURN VALUE: the child's exit status, -1 if pid is not a child or a
+ *                 signal arrives first
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_wait(int32_t pid)
+{
+	if(pid < 0 || pid >= MAX_PROCESSES || PCB(pid)->state == PROC_FREE ||
+			PCB(pid)->parent != current)
+		return -1;
+	return process_wait(PCB(pid));
+}
+
+/* 
+ * release_children
+ *   DESCRIPTION: Lets go of children a halting process never waited for:
+ *                finished ones are freed, running ones free themselves
+ *   INPUTS: p -- halting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+release_children(pcb_t* p)
+{
+	uint32_t flags;
+	int32_t i;
+
+	cli_and_save(flags);
+	for(i = 0; i < MAX_PROCESSES; i++) {
+		if(PCB(i)->state == PROC_FREE || PCB(i)->parent != p)
+			continue;
+		PCB(i)->parent = NULL;
+		if(PCB(i)->state == PROC_ZOMBIE)
+			process_free(PCB(i));
+	}
+	restore_flags(flags);
+}
+
+/* 
+ * process_exit
+ *   DESCRIPTION: Ends the current program and wakes its parent. A
+ *                terminal's root shell is started again instead.
+ *   INPUTS: status -- exit status for the parent: halt's byte, or
+ *                     SIG_KILL_STATUS for a program a signal killed
+ *   OUTPUTS: none
+ *   RETURN VALUE: does not return
+ *   SIDE EFFECTS: closes all fds and frees the address space
+ */
+void
+process_exit(int32_t status)
+{
+	pcb_t* p = current;
+
+	files_close_all(p->files);
+	release_children(p);
+	release_vidmap(p);
+	fpu_release(p);
+
+	if(p->root && process_exec(p, (uint8_t*)"shell") == 0) {
+		files_init(p->files, p->terminal);
+		cli();
+		enter_user((hw_context_t*)p->kstack_top - 1);
+	}
+	user_space_free(p->page_dir);
+
+	cli();
+	p->exit_status = status;
+	if(p->parent == NULL) {
+		/* Nobody will reap it. Its stack stays in use until the switch
+		 * below, but nothing can claim the slot before then. */
+		process_free(p);
+	} else {
+		p->state = PROC_ZOMBIE;
+		wake_up(&p->exit_wq);
+	}
+	schedule();
+}
+
+/* Ends the current program with a status byte for its parent */
+int32_t
+sys_halt(uint8_t status)
+{
+	process_exit(status);
+	return -1;
+}
+
+/* 
+ * sys_getargs
+ *   DESCRIPTION: Copies the current program's arguments to user space
+ *   INPUTS: buf -- destination
+ *           nbytes -- size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if there are no arguments or they don't fit
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_getargs(uint8_t* buf, int32_t nbytes)
+{
+	uint32_t len;
+
+	if(nbytes < 0 || bad_userspace_write(buf, nbytes))
+		return -1;
+	len = strlen((int8_t*)current->args);
+	if(len == 0 || len + 1 > nbytes)
+		return -1;
+	memcpy(buf, current->args, len + 1);
+	return 0;
+}
+
+/* 
+ * sys_vidmap
+ *   DESCRIPTION: Maps the text-mode video page of the caller's terminal
+ *                into user space. While the terminal is hidden the page is
+ *                its backing page instead of VGA memory.
+ *   INPUTS: screen_start -- where to store the user address of the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 on a bad pointer
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_vidmap(uint8_t** screen_start)
+{
+	if(bad_userspace_write(screen_start, sizeof(uint8_t*)))
+		return -1;
+	page_dir_vidmap(current->page_dir, current->terminal);
+	current->uses_vidmap = 1;
+	screen_set_mapped(current->terminal, 1);
+	*screen_start = (uint8_t*)VIDMAP_VIRT;
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* process.h - Process control blocks, execute and halt
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PROCESS_H
+#define _PROCESS_H
+
+#include "types.h"
+#include "syscall.h"
+#include "sched.h"
+#include "fpu.h"
+#include "signal.h"
+
+/* Size of the process table */
+#define MAX_PROCESSES	8
+/* Longest argument string getargs can return */
+#define MAX_ARGS		128
+/* Longest program name */
+#define MAX_NAME		32
+
+/* Process states */
+#define PROC_FREE		0
+#define PROC_RUNNABLE	1
+#define PROC_SLEEPING	2
+#define PROC_ZOMBIE		3
+#define PROC_NEW		4	/* claimed, still being set up */
+
+typedef struct pcb pcb_t;
+
+struct pcb {
+	int32_t pid;
+	int32_t state;
+	pcb_t* parent;			/* NULL once nobody will wait for it */
+	int32_t root;			/* a terminal's shell, restarted when it halts */
+	int32_t terminal;		/* terminal the process reads and writes */
+	int32_t cpu;			/* processor it last ran on, whose run queue it joins */
+	int32_t pinned;			/* kernel thread that never leaves that processor */
+	int32_t idle_prio;		/* only runs when nothing else is runnable */
+	pcb_t* rq_next;			/* next process on that run queue */
+	uint32_t ksp;			/* saved kernel stack pointer while switched out */
+	uint32_t kstack_top;	/* loaded into tss.esp0 when it runs */
+	uint32_t* page_dir;
+	uint32_t heap_start;	/* first page after the program image */
+	uint32_t brk;			/* end of the heap; pages below it are demand-zero */
+	int32_t uses_vidmap;
+	int32_t exit_status;
+	uint32_t wake_tick;		/* sleep_on_timeout deadline, 0 if none */
+	wait_queue_t exit_wq;	/* parent waits here for the process to halt */
+	file_t files[MAX_FILES];
+	uint8_t args[MAX_ARGS];
+	int32_t fpu_used;		/* fpu_state holds something worth restoring */
+	uint32_t fpu_restores;	/* times #NM handed it the FPU */
+	int32_t fpu_cpu;		/* processor whose FPU registers hold its state, -1 if none */
+	uint32_t sig_pending;	/* bit per signal raised but not yet acted on */
+	int32_t sig_blocked;	/* a handler is running, until sigreturn */
+	uint32_t sig_handlers[NUM_SIGNALS];	/* user addresses, 0 for the default */
+	uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+};
+
+/* A kernel stack with its owner's PCB at the base. The stacks are
+ * KSTACK_SIZE aligned, which is how current finds the PCB from ESP. */
+typedef union kstack {
+	pcb_t pcb;
+	uint8_t stack[KSTACK_SIZE];
+} kstack_t;
+
+/* Process kernel stacks, indexed by pid; the PCBs are the process table */
+extern kstack_t kernel_stacks[MAX_PROCESSES];
+#define PCB(pid)	(&kernel_stacks[pid].pcb)
+
+/* Idle threads' stacks, one per processor. The bootstrap processor's is
+ * the boot stack. */
+extern kstack_t idle_stacks[NR_CPUS];
+
+/* Starts a terminal's root shell, runnable but not yet running, with a
+ * fresh stdin and stdout. Other processes are forked. */
+extern pcb_t* process_create(const uint8_t* command, int32_t terminal);
+
+/* Ends the current process with a status for its parent; a root shell
+ * starts over instead. Does not return. */
+extern void process_exit(int32_t status);
+
+extern int32_t sys_halt(uint8_t status);
+extern int32_t sys_execute(const uint8_t* command);
+extern int32_t sys_getargs(uint8_t* buf, int32_t nbytes);
+extern int32_t sys_vidmap(uint8_t** screen_start);
+extern int32_t sys_spawn(const uint8_t* command);
+extern int32_t sys_wait(int32_t pid);
+extern int32_t sys_fork(void);
+extern int32_t sys_exec(const uint8_t* command);
+extern int32_t sys_sbrk(int32_t increment);
+
+#endif /* _PROCESS_H */
@@ -2,6 +2,10 @@
 #include "rtc.h"
 #include "lib.h"
 #include "i8259.h"
+#include "sched.h"
+#include "poll.h"
+#include "spinlock.h"
+#include "signal.h"
 //Local Flags
 volatile int rtc_intr_recieved;
 volatile int rtc_pie;
@@ -9,14 +13,26 @@ volatile int rtc_uie;
 //Freqeuncy Decoder
 int rtc_freq;
 int freq[10]={2,4,8,16,32,64,128,256,512,1024};
+//Processes waiting for the next interrupt
+static wait_queue_t rtc_wq;
+//Periodic interrupts since boot
+volatile uint32_t rtc_ticks;
+//Guards the flags above and the RTC_CMD/RTC_DATA register pair, which the
+//handler uses too
+static spinlock_t rtc_lock = SPINLOCK_INIT("rtc");
 /* RTC_INTR
  *Purpose:	Function that allows for external manipulation of local flags
- *Action:	Temp should be contents read from Reg C of RTC on interrupt; 
- *			Function should translate this and clear the appropriate flags
+ *Action:	Reads Reg C of the RTC, which also acknowledges the interrupt;
+ *			translates it and clears the appropriate flags
  *Note: 	Ideally should only be used by RTC handler
 */
-void rtc_intr(uint8_t temp)
+void rtc_intr(void)
 {
+	uint8_t temp;
+
+	spin_lock(&rtc_lock);
+	outb(0x8C,RTC_CMD);
+	temp = inb(RTC_DATA);
 	if(temp==0xC0)
 	{
 		rtc_pie=0;
@@ -30,7 +46,11 @@ void rtc_intr(uint8_t temp)
 		rtc_uie=0;
 		rtc_pie=0;
 	}
+	if(temp&0x40)
+		rtc_ticks++;
 	rtc_intr_recieved=0;
+	wake_up(&rtc_wq);
+	spin_unlock(&rtc_lock);
 }
 /*RTC_OPEN
 *Purpose:	Initialize the RTC w/ a default freqency of 2Hz and enabling PIE & UIE
@@ -38,6 +58,9 @@ void rtc_intr(uint8_t temp)
 */
 int rtc_open()
 {
+	uint32_t flags;
+
+	flags = spin_lock_irqsave(&rtc_lock);
 	//Select Reg A and write 2Hz Freq
 	outb(0x8A,RTC_CMD);
 	outb(0x2f,RTC_DATA);
@@ -46,6 +69,7 @@ int rtc_open()
 	//Select Reg B and enable Periodic Interrupt and Update Ended Interrupt
 	outb(0x8B,RTC_CMD);	
 	outb(0x50,RTC_DATA);
+	spin_unlock_irqrestore(&rtc_lock, flags);
 	return 0;
 }
 /*RTC_WRITE
@@ -56,10 +80,13 @@ int rtc_open()
 */
 int rtc_write(uint8_t* buf, int32_t cnt)
 {
+	uint32_t flags;
+	int ret;
 	int cntr;
 	cntr=0;
 	if(cnt<=10&&cnt>0)
 	{
+		flags = spin_lock_irqsave(&rtc_lock);
 	//Update rtc_freq;
 		rtc_freq=freq[cnt-1];
 	//Calculate new frequency term
@@ -72,42 +99,71 @@ int rtc_write(uint8_t* buf, int32_t cnt)
 	//Select Reg A and write new Freq
 		outb(0x8A,RTC_CMD);
 		outb(temp,RTC_DATA);
-	//Wait for fixed amt of time for UIE
+	//Wait for fixed amt of time for UIE, sleeping between interrupts
 		rtc_intr_recieved=1;
 		while(rtc_uie==1&&cntr<rtc_freq)
 		{
-			while(rtc_intr_recieved==1){}
-				rtc_intr_recieved=1;
-				cntr++;
+			while(rtc_intr_recieved==1)
+				sleep_on_locked(&rtc_wq, 0, &rtc_lock);
+			rtc_intr_recieved=1;
+			cntr++;
 		}
-		if(rtc_uie==0)
-			return 0;
-		else
-			return -1;
+		ret = (rtc_uie==0) ? 0 : -1;
+		spin_unlock_irqrestore(&rtc_lock, flags);
+		return ret;
 	}
 	else 
 		return -1;
 }
 /*RTC_Read
 *Purpose: 	Read from the RTC, Return 0 after PIE
-*Action: 	Returns 0 after PIE
+*Action: 	Sleeps until the next PIE, then returns 0; -1 if a signal
+*			arrives first
 *Note: 		buf & cnt is not used; Arguments are kept the same to match systemcall read
 */
 int rtc_read(uint8_t* buf, int32_t cnt)
 {
+	uint32_t flags;
+
+	flags = spin_lock_irqsave(&rtc_lock);
 	rtc_pie=1;
 	while(rtc_pie==1)
 	{
-		//spin till change
-	}	
+		if(signal_pending(current))
+		{
+			spin_unlock_irqrestore(&rtc_lock, flags);
+			return -1;
+		}
+		sleep_on_locked(&rtc_wq, 0, &rtc_lock);
+	}
+	spin_unlock_irqrestore(&rtc_lock, flags);
 	return 0;
 }
+/*RTC_Poll
+*Purpose:	Readiness check for poll
+*Action:	Registers on the RTC wait queue, which the handler signals on
+*			every interrupt; ready once a periodic interrupt has come
+*			since the caller's last one
+*/
+int rtc_poll(uint32_t last, poll_table_t* pt)
+{
+	int ready;
+
+	spin_lock(&rtc_lock);
+	poll_wait(&rtc_wq, pt);
+	ready = (rtc_ticks != last) ? POLLIN : 0;
+	spin_unlock(&rtc_lock);
+	return ready;
+}
 /*RTC_Close
 *Purpose: 	Disables the RTC for debuggin
 *Action:	Writes to Reg A and B; disabling everything
 */
 int rtc_close()
 {
+	uint32_t flags;
+
+	flags = spin_lock_irqsave(&rtc_lock);
 	//Select Reg A and Disable Oscillator
 	outb(0x8A,RTC_CMD);
 	outb(0x00,RTC_DATA);
@@ -115,6 +171,7 @@ int rtc_close()
 	//Select Reg B and Disable Everything
 	outb(0x8B,RTC_CMD);	
 	outb(0x00,RTC_DATA);
+	spin_unlock_irqrestore(&rtc_lock, flags);
 	return 0;
 }
 
@@ -3,6 +3,7 @@
 #define _RTC_H
 
 #include "types.h"
+#include "syscall.h"
 
 #define	 RTC_CMD	0x70
 #define	 RTC_DATA	0x71
@@ -11,8 +12,12 @@ extern int rtc_open();
 extern int rtc_write(uint8_t* buf, int32_t cnt);
 extern int rtc_read(uint8_t* buf, int32_t cnt);
 extern int rtc_close();
+extern int rtc_poll(uint32_t last, poll_table_t* pt);
+
+//Periodic interrupts since boot
+extern volatile uint32_t rtc_ticks;
 //extern char rtc_intr(char int_data);
 
-extern void rtc_intr(uint8_t temp);
+extern void rtc_intr(void);
 
 #endif
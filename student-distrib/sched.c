@@ -0,0 +1,494 @@
+/* sched.c - Round-robin scheduler with per-processor run queues, and
+ * wait queues
+ * vim:ts=4 noexpandtab
+ */
+
+#include "sched.h"
+#include "process.h"
+#include "paging.h"
+#include "fpu.h"
+#include "x86_desc.h"
+#include "lib.h"
+#include "pit.h"
+#include "smp.h"
+#include "apic.h"
+#include "spinlock.h"
+
+/* 
+ * rq_add
+ *   DESCRIPTION: Puts a process at the back of a processor's run queue,
+ *                or of its idle-priority queue
+ *   INPUTS: cpu -- processor
+ *           p -- runnable process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+rq_add(cpu_t* cpu, pcb_t* p)
+{
+	run_queue_t* rq = p->idle_prio ? &cpu->idle_rq : &cpu->rq;
+
+	p->rq_next = NULL;
+	if(rq->tail == NULL)
+		rq->head = p;
+	else
+		rq->tail->rq_next = p;
+	rq->tail = p;
+	rq->count++;
+}
+
+/* 
+ * rq_pop
+ *   DESCRIPTION: Takes the process at the front of a run queue
+ *   INPUTS: rq -- queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process, NULL if the queue is empty
+ *   SIDE EFFECTS: none
+ */
+static pcb_t*
+rq_pop(run_queue_t* rq)
+{
+	pcb_t* p = rq->head;
+
+	if(p == NULL)
+		return NULL;
+	rq->head = p->rq_next;
+	if(rq->head == NULL)
+		rq->tail = NULL;
+	rq->count--;
+	p->rq_next = NULL;
+	return p;
+}
+
+/* 
+ * rq_pop_unpinned
+ *   DESCRIPTION: Takes the first process on a run queue that may move to
+ *                another processor
+ *   INPUTS: rq -- queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process, NULL if there is none
+ *   SIDE EFFECTS: none
+ */
+static pcb_t*
+rq_pop_unpinned(run_queue_t* rq)
+{
+	pcb_t* prev = NULL;
+	pcb_t* p;
+
+	for(p = rq->head; p != NULL && p->pinned; p = p->rq_next)
+		prev = p;
+	if(p == NULL)
+		return NULL;
+	if(prev == NULL)
+		rq->head = p->rq_next;
+	else
+		prev->rq_next = p->rq_next;
+	if(rq->tail == p)
+		rq->tail = prev;
+	rq->count--;
+	p->rq_next = NULL;
+	return p;
+}
+
+/* 
+ * steal
+ *   DESCRIPTION: Takes a process from the longest run queue of another
+ *                processor, for a processor that has run out of work.
+ *                Threads pinned to their processor stay.
+ *   INPUTS: cpu -- the idle processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process, NULL if every queue is empty
+ *   SIDE EFFECTS: none
+ */
+static pcb_t*
+steal(cpu_t* cpu)
+{
+	cpu_t* busiest = NULL;
+	pcb_t* p;
+	int32_t i;
+
+	for(i = 0; i < ncpus; i++) {
+		if(&cpus[i] != cpu && cpus[i].rq.count > 0 &&
+				(busiest == NULL || cpus[i].rq.count > busiest->rq.count))
+			busiest = &cpus[i];
+	}
+	if(busiest == NULL || (p = rq_pop_unpinned(&busiest->rq)) == NULL)
+		return NULL;
+	cpu->steals++;
+	return p;
+}
+
+/* 
+ * sched_add
+ *   DESCRIPTION: Makes a process runnable on the processor it last ran
+ *                on, waking that processor or an idle one to take it
+ *   INPUTS: p -- process that is not on any run queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+sched_add(pcb_t* p)
+{
+	cpu_t* cpu = &cpus[p->cpu];
+
+	p->state = PROC_RUNNABLE;
+	rq_add(cpu, p);
+	/* An idle-priority thread checks between pieces of work */
+	if(!p->idle_prio && cpu->running != NULL && cpu->running->idle_prio)
+		cpu->need_resched = 1;
+	smp_kick(cpu);
+}
+
+/* 
+ * schedule
+ *   DESCRIPTION: Switches to the next process on this processor's run
+ *                queue, or one taken from another processor's, or an
+ *                idle-priority thread, or the idle thread. The previous process goes to the back of
+ *                the queue if it is still runnable. Returns when the
+ *                caller is picked again, possibly on another processor.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the address space and tss.esp0
+ */
+void
+schedule(void)
+{
+	uint32_t flags;
+	cpu_t* cpu;
+	pcb_t* prev;
+	pcb_t* next;
+
+	cli_and_save(flags);
+	cpu = this_cpu();
+	prev = cpu->running;
+	cpu->need_resched = 0;
+	if(prev != cpu->idle && prev->state == PROC_RUNNABLE)
+		rq_add(cpu, prev);
+	if((next = rq_pop(&cpu->rq)) == NULL && (next = steal(cpu)) == NULL &&
+			(next = rq_pop(&cpu->idle_rq)) == NULL)
+		next = cpu->idle;
+	cpu->quantum_left = QUANTUM;
+
+	if(next != prev) {
+		cpu->running = next;
+		cpu->tss->esp0 = next->kstack_top;
+		/* The TLB here may be stale for a process that ran elsewhere */
+		if(next->cpu != cpu->id)
+			set_page_dir(next->page_dir);
+		else
+			switch_page_dir(next->page_dir);
+		next->cpu = cpu->id;
+		fpu_switch(prev, next);
+		cpu->switches++;
+		context_switch(&prev->ksp, next->ksp);
+		irqoff_restart();
+	}
+	restore_flags(flags);
+}
+
+/* 
+ * cpu_idle
+ *   DESCRIPTION: The idle thread: runs whatever is queued and halts until
+ *                the next interrupt when nothing is
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: called with interrupts disabled and the kernel lock held
+ */
+void
+cpu_idle(void)
+{
+	while(1) {
+		schedule();
+		/* Let the other processors in while this one sleeps */
+		kernel_unlock();
+		wait_for_interrupt();
+		kernel_lock();
+	}
+}
+
+/* 
+ * sched_start
+ *   DESCRIPTION: Starts the local APIC timers and the other processors
+ *                and turns the boot stack into the bootstrap processor's
+ *                idle thread
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+void
+sched_start(void)
+{
+	lapic_timer_calibrate();
+	smp_boot();
+	cli();
+	lapic_timer_start();
+	this_cpu()->running = this_cpu()->idle;
+	kernel_lock();
+	cpu_idle();
+}
+
+/* 
+ * sched_local_tick
+ *   DESCRIPTION: Asks for a reschedule once the process running on this
+ *                processor has used up its quantum
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the local APIC timer handler, or the PIT
+ *                 handler on a machine without one
+ */
+void
+sched_local_tick(void)
+{
+	cpu_t* cpu = this_cpu();
+
+	if(cpu->running != cpu->idle && --cpu->quantum_left <= 0)
+		cpu->need_resched = 1;
+}
+
+/* 
+ * sched_tick
+ *   DESCRIPTION: Wakes sleepers whose timeout has passed. Without local
+ *                APIC timers this is also the quantum clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the timer handler
+ */
+void
+sched_tick(void)
+{
+	int32_t i;
+	pcb_t* p;
+
+	for(i = 0; i < MAX_PROCESSES; i++) {
+		p = PCB(i);
+		if(p->state == PROC_SLEEPING && p->wake_tick != 0 &&
+				(int32_t)(pit_ticks - p->wake_tick) >= 0)
+			sched_add(p);
+	}
+	if(lapic_timer_count == 0 && this_cpu()->running != NULL)
+		sched_local_tick();
+}
+
+/* 
+ * prepare_return_to_user
+ *   DESCRIPTION: Last stop before iret to user mode. Kernel code is never
+ *                preempted; this is where a used-up quantum takes effect,
+ *                and where pending signals are acted on.
+ *   INPUTS: regs -- user state about to be restored
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes
+ */
+void
+prepare_return_to_user(hw_context_t* regs)
+{
+	if(this_cpu()->need_resched)
+		schedule();
+	if(current->sig_pending != 0)
+		signal_deliver(regs);
+}
+
+/* 
+ * cond_resched
+ *   DESCRIPTION: Switches away if the running thread's quantum is up.
+ *                Kernel threads call it between pieces of work.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes
+ */
+void
+cond_resched(void)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(this_cpu()->need_resched)
+		schedule();
+	restore_flags(flags);
+}
+
+/* 
+ * add_wait_queue
+ *   DESCRIPTION: Puts an entry on a wait queue
+ *   INPUTS: q -- queue
+ *           entry -- filled in entry, usually on the caller's stack
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+add_wait_queue(wait_queue_t* q, wait_entry_t* entry)
+{
+	entry->next = q->head;
+	q->head = entry;
+}
+
+/* 
+ * remove_wait_queue
+ *   DESCRIPTION: Takes an entry off a wait queue, if it is on it
+ *   INPUTS: q -- queue
+ *           entry -- entry to remove
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+remove_wait_queue(wait_queue_t* q, wait_entry_t* entry)
+{
+	wait_entry_t** link;
+
+	for(link = &q->head; *link != NULL; link = &(*link)->next) {
+		if(*link == entry) {
+			*link = entry->next;
+			return;
+		}
+	}
+}
+
+/* 
+ * sched_sleep
+ *   DESCRIPTION: Puts the current process to sleep until it is woken or a
+ *                number of ticks pass. Before the first process starts
+ *                this just waits for the next interrupt.
+ *   INPUTS: ticks -- timer ticks to sleep at most, 0 for no limit
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+sched_sleep(uint32_t ticks)
+{
+	uint32_t deadline = pit_ticks + ticks;
+
+	if(this_cpu()->running == NULL) {
+		wait_for_interrupt();
+		return;
+	}
+
+	if(ticks != 0)
+		current->wake_tick = (deadline == 0) ? 1 : deadline;
+	current->state = PROC_SLEEPING;
+	schedule();
+	current->wake_tick = 0;
+}
+
+/* 
+ * wake_process
+ *   DESCRIPTION: Makes a sleeping process runnable
+ *   INPUTS: p -- process to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: safe to call from interrupt handlers
+ */
+void
+wake_process(pcb_t* p)
+{
+	if(p->state == PROC_SLEEPING)
+		sched_add(p);
+}
+
+/* 
+ * sleep_on
+ *   DESCRIPTION: Puts the current process to sleep on a wait queue until
+ *                a wake_up
+ *   INPUTS: q -- queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void
+sleep_on(wait_queue_t* q)
+{
+	wait_entry_t entry;
+
+	entry.pcb = current;
+	entry.func = NULL;
+	entry.data = NULL;
+	add_wait_queue(q, &entry);
+	sched_sleep(0);
+	remove_wait_queue(q, &entry);
+}
+
+/* 
+ * sleep_on_timeout
+ *   DESCRIPTION: Like sleep_on, but gives up after a number of ticks
+ *   INPUTS: q -- queue to sleep on
+ *           ticks -- timer ticks to wait at most
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the time ran out, 1 otherwise
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+int32_t
+sleep_on_timeout(wait_queue_t* q, uint32_t ticks)
+{
+	uint32_t deadline = pit_ticks + ticks;
+	wait_entry_t entry;
+
+	entry.pcb = current;
+	entry.func = NULL;
+	entry.data = NULL;
+	add_wait_queue(q, &entry);
+	sched_sleep(ticks);
+	remove_wait_queue(q, &entry);
+	return (int32_t)(pit_ticks - deadline) < 0;
+}
+
+/* 
+ * sleep_on_locked
+ *   DESCRIPTION: Like sleep_on_timeout, but lets go of a spinlock while
+ *                asleep. The caller took it with spin_lock_irqsave and
+ *                rechecks its condition under it once this returns.
+ *   INPUTS: q -- queue to sleep on
+ *           ticks -- timer ticks to wait at most, 0 for no limit
+ *           lock -- spinlock the caller holds
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the time ran out, 1 otherwise
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+int32_t
+sleep_on_locked(wait_queue_t* q, uint32_t ticks, spinlock_t* lock)
+{
+	uint32_t deadline = pit_ticks + ticks;
+	wait_entry_t entry;
+
+	entry.pcb = current;
+	entry.func = NULL;
+	entry.data = NULL;
+	add_wait_queue(q, &entry);
+	spin_unlock(lock);
+	sched_sleep(ticks);
+	spin_lock(lock);
+	remove_wait_queue(q, &entry);
+	return ticks == 0 || (int32_t)(pit_ticks - deadline) < 0;
+}
+
+/* 
+ * wake_up
+ *   DESCRIPTION: Wakes everything waiting on a queue: entries with a wake
+ *                function get a callback, the rest have their process made
+ *                runnable. Each sleeper takes itself off the queue.
+ *   INPUTS: q -- queue to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: safe to call from interrupt handlers
+ */
+void
+wake_up(wait_queue_t* q)
+{
+	wait_entry_t* entry;
+
+	for(entry = q->head; entry != NULL; entry = entry->next) {
+		if(entry->func != NULL)
+			entry->func(entry);
+		else if(entry->pcb != NULL)
+			wake_process(entry->pcb);
+	}
+}
@@ -0,0 +1,104 @@
+/* sched.h - Round-robin scheduler with per-processor run queues, and
+ * wait queues
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+#include "linkage.h"
+#include "smp.h"
+#include "spinlock.h"
+
+/* Timer ticks a process runs before it is preempted */
+#define QUANTUM		5
+
+struct pcb;
+
+struct wait_entry;
+
+/* Called by wake_up for each entry on the queue */
+typedef void (*wake_fn_t)(struct wait_entry* entry);
+
+/* A sleeping process. Lives on the sleeper's kernel stack. An entry with
+ * a wake function gets a callback instead of its process being made
+ * runnable directly. */
+typedef struct wait_entry {
+	struct pcb* pcb;
+	struct wait_entry* next;
+	wake_fn_t func;
+	void* data;
+} wait_entry_t;
+
+/* Processes waiting for some event */
+typedef struct wait_queue {
+	wait_entry_t* head;
+} wait_queue_t;
+
+/* Process running on this processor, its idle thread if nothing is.
+ * Found from ESP, since each kernel stack has its PCB at the base. */
+static inline struct pcb*
+get_current(void)
+{
+	uint32_t esp;
+
+	asm("movl %%esp, %0" : "=r"(esp));
+	return (struct pcb*)(esp & ~(KSTACK_SIZE - 1));
+}
+#define current		(get_current())
+
+/* Starts the other processors and idles until there is work; never
+ * returns */
+extern void sched_start(void);
+/* Gives up the processor to the next runnable process */
+extern void schedule(void);
+/* Loop each processor's idle thread runs */
+extern void cpu_idle(void);
+/* Makes a process runnable and queues it on the processor it last ran
+ * on; interrupts must be disabled */
+extern void sched_add(struct pcb* p);
+/* Called by the timer handler once per tick */
+extern void sched_tick(void);
+/* Quantum accounting for this processor, once per tick */
+extern void sched_local_tick(void);
+/* Lets a kernel thread give up the processor once its quantum is up,
+ * since kernel code is never preempted */
+extern void cond_resched(void);
+/* Called on the way back to user mode, with interrupts disabled */
+extern void prepare_return_to_user(hw_context_t* regs);
+
+/* Adds and removes entries; interrupts must be disabled */
+extern void add_wait_queue(wait_queue_t* q, wait_entry_t* entry);
+extern void remove_wait_queue(wait_queue_t* q, wait_entry_t* entry);
+/* Puts the current process to sleep until something wakes it or ticks
+ * timer ticks pass (0 for no timeout); interrupts must be disabled */
+extern void sched_sleep(uint32_t ticks);
+/* Makes one sleeping process runnable */
+extern void wake_process(struct pcb* p);
+
+/* Sleeps until woken; the caller rechecks its condition in a loop and
+ * must have interrupts disabled */
+extern void sleep_on(wait_queue_t* q);
+/* Same, but also wakes after ticks timer ticks. Returns 0 on timeout. */
+extern int32_t sleep_on_timeout(wait_queue_t* q, uint32_t ticks);
+/* Same, but drops lock, taken with spin_lock_irqsave, while asleep; 0
+ * ticks for no timeout */
+extern int32_t sleep_on_locked(wait_queue_t* q, uint32_t ticks, spinlock_t* lock);
+/* Wakes every entry on q, through its wake function if it has one */
+extern void wake_up(wait_queue_t* q);
+
+/* What context_switch pops off a kernel stack, lowest address first */
+typedef struct switch_frame {
+	uint32_t eflags;
+	uint32_t edi;
+	uint32_t esi;
+	uint32_t ebx;
+	uint32_t ebp;
+	uint32_t ret;
+} switch_frame_t;
+
+/* Switches kernel stacks, saving the old stack pointer in *prev_ksp */
+extern void context_switch(uint32_t* prev_ksp, uint32_t next_ksp);
+
+#endif /* _SCHED_H */
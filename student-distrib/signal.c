@@ -0,0 +1,256 @@
+/* signal.c - Signals: set_handler, sigreturn and delivery to user mode
+ * vim:ts=4 noexpandtab
+ */
+
+#include "signal.h"
+#include "process.h"
+#include "sched.h"
+#include "mm.h"
+#include "pit.h"
+#include "x86_desc.h"
+#include "lib.h"
+
+#define SIG_BIT(signum)		(1 << (signum))
+/* Signals a program can't get past by returning from its handler */
+#define SIG_FAULTS			(SIG_BIT(SIG_DIV_ZERO) | SIG_BIT(SIG_SEGFAULT))
+/* Signals whose default action kills; the others are ignored */
+#define SIG_DEFAULT_KILL	(SIG_FAULTS | SIG_BIT(SIG_INTERRUPT))
+
+/* EFLAGS bits sigreturn takes from the saved frame: the arithmetic
+ * flags and DF. IF is always set. */
+#define EFLAGS_USER_MASK	0x0CD5
+#define EFLAGS_IF			0x200
+
+/* movl $SYS_SIGRETURN, %eax; int $0x80; nop */
+static const uint8_t trampoline[8] = {
+	0xB8, SYS_SIGRETURN, 0x00, 0x00, 0x00, 0xCD, SYSCALL_VECTOR, 0x90
+};
+
+/* What delivery pushes on the user stack, lowest address first. The
+ * handler sees signum as its argument and returns into the trampoline,
+ * which calls sigreturn with ESP at signum. */
+typedef struct sig_frame {
+	uint32_t ret;
+	int32_t signum;
+	hw_context_t regs;		/* user state to go back to */
+	uint8_t trampoline[8];
+} sig_frame_t;
+
+/*
+ * signal_pending
+ *   DESCRIPTION: Tells whether delivery has something to do for a
+ *                process: a pending signal that runs a handler or kills
+ *                it, and that a running handler isn't holding back.
+ *                Ignored signals don't count.
+ *   INPUTS: p -- user process
+ *   OUTPUTS: none
+ *   RETURN VALUE: nonzero if so
+ *   SIDE EFFECTS: none
+ */
+int32_t
+signal_pending(pcb_t* p)
+{
+	uint32_t pending = p->sig_pending;
+	int32_t signum;
+
+	if(p->sig_blocked)
+		pending &= SIG_FAULTS;
+	for(signum = 0; signum < NUM_SIGNALS; signum++) {
+		if((pending & SIG_BIT(signum)) && (p->sig_handlers[signum] != 0 ||
+				(SIG_BIT(signum) & SIG_DEFAULT_KILL)))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * signal_raise
+ *   DESCRIPTION: Marks a signal pending for a process, and wakes it if it
+ *                is asleep in a system call so the call can give up and
+ *                the signal be acted on
+ *   INPUTS: p -- user process
+ *           signum -- signal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: safe to call from interrupt handlers
+ */
+void
+signal_raise(pcb_t* p, int32_t signum)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	p->sig_pending |= SIG_BIT(signum);
+	if(signal_pending(p))
+		wake_process(p);
+	restore_flags(flags);
+}
+
+/*
+ * signal_raise_terminal
+ *   DESCRIPTION: Raises a signal in the programs running on a terminal,
+ *                leaving its root shell alone
+ *   INPUTS: terminal -- terminal number
+ *           signum -- signal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: safe to call from interrupt handlers
+ */
+void
+signal_raise_terminal(int32_t terminal, int32_t signum)
+{
+	int32_t i;
+	pcb_t* p;
+
+	for(i = 0; i < MAX_PROCESSES; i++) {
+		p = PCB(i);
+		if((p->state == PROC_RUNNABLE || p->state == PROC_SLEEPING) &&
+				p->terminal == terminal && !p->root)
+			signal_raise(p, signum);
+	}
+}
+
+/*
+ * signal_tick
+ *   DESCRIPTION: Raises ALARM in every user process each ALARM_SECONDS
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called from the PIT handler
+ */
+void
+signal_tick(void)
+{
+	int32_t i;
+
+	if(pit_ticks % (ALARM_SECONDS * PIT_HZ) != 0)
+		return;
+	for(i = 0; i < MAX_PROCESSES; i++) {
+		if(PCB(i)->state == PROC_RUNNABLE || PCB(i)->state == PROC_SLEEPING)
+			signal_raise(PCB(i), SIG_ALARM);
+	}
+}
+
+/*
+ * setup_frame
+ *   DESCRIPTION: Pushes a signal frame on the user stack and points the
+ *                user state at the handler
+ *   INPUTS: p -- current process
+ *           regs -- its user state, about to be restored
+ *           signum -- signal being delivered
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the user stack is unusable
+ *   SIDE EFFECTS: signals are blocked until sigreturn
+ */
+static int32_t
+setup_frame(pcb_t* p, hw_context_t* regs, int32_t signum)
+{
+	sig_frame_t* frame = (sig_frame_t*)((regs->esp - sizeof(sig_frame_t)) & ~3);
+
+	/* also refuses a stack pointed at read-only text or an mmap'd file,
+	 * which the kernel would fault writing to */
+	if(bad_userspace_write(frame, sizeof(sig_frame_t)))
+		return -1;
+	memcpy(frame->trampoline, trampoline, sizeof(trampoline));
+	frame->regs = *regs;
+	frame->signum = signum;
+	frame->ret = (uint32_t)frame->trampoline;
+
+	regs->esp = (uint32_t)frame;
+	regs->eip = p->sig_handlers[signum];
+	p->sig_blocked = 1;
+	return 0;
+}
+
+/*
+ * signal_deliver
+ *   DESCRIPTION: Acts on the lowest pending signal with a handler, or
+ *                on every pending one that has none: ALARM and USER1 are
+ *                ignored and the rest kill the process. While a handler
+ *                runs other signals wait, except a fault, which can't.
+ *   INPUTS: regs -- the current process's user state
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with interrupts disabled; does not return if
+ *                 the process is killed
+ */
+void
+signal_deliver(hw_context_t* regs)
+{
+	pcb_t* p = current;
+	int32_t signum;
+	uint32_t bit;
+
+	for(signum = 0; signum < NUM_SIGNALS && p->sig_pending != 0; signum++) {
+		bit = SIG_BIT(signum);
+		if(!(p->sig_pending & bit))
+			continue;
+		if(p->sig_blocked && !(bit & SIG_FAULTS))
+			continue;
+		p->sig_pending &= ~bit;
+		if(p->sig_handlers[signum] != 0 && !p->sig_blocked) {
+			if(setup_frame(p, regs, signum) == 0)
+				return;
+		} else if(!(bit & SIG_DEFAULT_KILL) && !p->sig_blocked) {
+			continue;
+		}
+		sti();
+		process_exit(SIG_KILL_STATUS);
+	}
+}
+
+/*
+ * sys_set_handler
+ *   DESCRIPTION: Sets the user function a signal runs, or restores the
+ *                default action
+ *   INPUTS: signum -- signal
+ *           handler_address -- user function, NULL for the default
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 for a bad signal or address
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_set_handler(int32_t signum, void* handler_address)
+{
+	if(signum < 0 || signum >= NUM_SIGNALS ||
+			(handler_address != NULL && bad_userspace_addr(handler_address, 1)))
+		return -1;
+	current->sig_handlers[signum] = (uint32_t)handler_address;
+	return 0;
+}
+
+/*
+ * sys_sigreturn
+ *   DESCRIPTION: Called by the trampoline once a handler returns: puts
+ *                back the user state saved in the signal frame, including
+ *                any changes the handler made to it, and unblocks signals
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the saved EAX, since the system call exit stores the
+ *                 return value there; -1 if no handler is running
+ *   SIDE EFFECTS: segment registers and privileged flags are not taken
+ *                 from the frame
+ */
+int32_t
+sys_sigreturn(void)
+{
+	pcb_t* p = current;
+	hw_context_t* regs = (hw_context_t*)p->kstack_top - 1;
+	hw_context_t* saved = (hw_context_t*)(regs->esp + sizeof(int32_t));
+
+	if(!p->sig_blocked || bad_userspace_addr(saved, sizeof(hw_context_t)))
+		return -1;
+	regs->ebx = saved->ebx;
+	regs->ecx = saved->ecx;
+	regs->edx = saved->edx;
+	regs->esi = saved->esi;
+	regs->edi = saved->edi;
+	regs->ebp = saved->ebp;
+	regs->eax = saved->eax;
+	regs->eip = saved->eip;
+	regs->esp = saved->esp;
+	regs->eflags = (regs->eflags & ~EFLAGS_USER_MASK) |
+			(saved->eflags & EFLAGS_USER_MASK) | EFLAGS_IF;
+	p->sig_blocked = 0;
+	return regs->eax;
+}
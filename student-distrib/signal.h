@@ -0,0 +1,43 @@
+/* signal.h - Signals: set_handler, sigreturn and delivery to user mode
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SIGNAL_H
+#define _SIGNAL_H
+
+#include "types.h"
+#include "linkage.h"
+
+/* Signal numbers, must match syscalls/ece391syscall.h */
+#define SIG_DIV_ZERO	0
+#define SIG_SEGFAULT	1
+#define SIG_INTERRUPT	2
+#define SIG_ALARM		3
+#define SIG_USER1		4
+#define NUM_SIGNALS		5
+
+/* Exit status of a process a signal killed */
+#define SIG_KILL_STATUS	256
+/* Seconds between ALARMs */
+#define ALARM_SECONDS	10
+
+struct pcb;
+
+/* Marks a signal pending; it is acted on when p next returns to user
+ * mode. A sleeping p is woken. Safe from interrupt handlers. */
+extern void signal_raise(struct pcb* p, int32_t signum);
+/* Nonzero if p has a pending signal that runs a handler or kills it.
+ * System calls that sleep give up with -1 when the caller has one. */
+extern int32_t signal_pending(struct pcb* p);
+/* Raises signum in every process on a terminal but its root shell */
+extern void signal_raise_terminal(int32_t terminal, int32_t signum);
+/* Sends ALARM every ALARM_SECONDS; called once per PIT tick */
+extern void signal_tick(void);
+/* Runs the handler of, or takes the default action for, the current
+ * process's pending signals; called on the way back to user mode */
+extern void signal_deliver(hw_context_t* regs);
+
+extern int32_t sys_set_handler(int32_t signum, void* handler_address);
+extern int32_t sys_sigreturn(void);
+
+#endif /* _SIGNAL_H */
@@ -0,0 +1,571 @@
+/* smp.c - Processors, per-CPU data and the kernel lock
+ * vim:ts=4 noexpandtab
+ */
+
+#include "smp.h"
+#include "apic.h"
+#include "process.h"
+#include "paging.h"
+#include "mm.h"
+#include "fpu.h"
+#include "pit.h"
+#include "lib.h"
+
+/* Where the firmware tables can be: the last KB of base memory (where
+ * the EBDA normally starts) and the BIOS ROM */
+#define EBDA_SCAN_START		0x9FC00
+#define EBDA_SCAN_END		0xA0000
+#define BIOS_SCAN_START		0xE0000
+#define BIOS_SCAN_END		0x100000
+
+/* ACPI MADT entry types */
+#define MADT_LAPIC			0
+#define MADT_IOAPIC			1
+#define MADT_OVERRIDE		2
+#define MADT_LAPIC_ENABLED	0x1
+/* MP configuration table entry types and sizes */
+#define MP_PROCESSOR		0
+#define MP_BUS				1
+#define MP_IOAPIC			2
+#define MP_INTERRUPT		3
+#define MP_PROCESSOR_LEN	20
+#define MP_OTHER_LEN		8
+#define MP_CPU_ENABLED		0x1
+#define MP_IOAPIC_ENABLED	0x1
+#define MP_INT_VECTORED		0	/* MP_INTERRUPT type for an ordinary IRQ */
+
+/* Timer ticks to wait between the INIT and STARTUP IPIs, and for an
+ * application processor to come up (PIT_HZ is 100) */
+#define INIT_DELAY_TICKS	1
+#define SIPI_DELAY_TICKS	1
+#define AP_WAIT_TICKS		10
+
+cpu_t cpus[NR_CPUS] __attribute__((aligned(8)));
+int32_t ncpus;
+
+/* Idle threads, each at the base of its stack; boot.S starts on the
+ * bootstrap processor's. The application processors' TSSs, since the
+ * bootstrap processor keeps the one from x86_desc.S. */
+kstack_t idle_stacks[NR_CPUS] __attribute__((aligned(KSTACK_SIZE)));
+static tss_t ap_tss[NR_CPUS];
+
+/* The bootstrap processor's GDT, copied by each application processor */
+static struct {
+	uint16_t size;
+	uint32_t addr;
+} __attribute__((packed)) bsp_gdt;
+
+static uint32_t lapic_base;
+
+/* The kernel lock, and the page of the latest TLB shootdown with its
+ * number; a processor has carried it out once its invlpg_done matches */
+static volatile uint32_t kernel_lock_word;
+static volatile uint32_t invlpg_addr;
+static volatile uint32_t invlpg_seq;
+
+/* Real-mode startup code in ap_boot.S, copied to AP_TRAMPOLINE */
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_stack_top[];
+
+/*
+ * this_cpu
+ *   DESCRIPTION: Finds the calling processor's per-CPU data through the
+ *                running thread's PCB, whose cpu schedule() sets before
+ *                switching to it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into cpus[]
+ *   SIDE EFFECTS: none
+ */
+cpu_t*
+this_cpu(void)
+{
+	return &cpus[current->cpu];
+}
+
+/*
+ * invlpg_check
+ *   DESCRIPTION: Carries out the latest TLB shootdown on this processor
+ *                if it hasn't yet, and acknowledges it
+ *   INPUTS: cpu -- the calling processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+invlpg_check(cpu_t* cpu)
+{
+	uint32_t seq = invlpg_seq;
+
+	if(cpu->invlpg_done != seq) {
+		tlb_flush_page(invlpg_addr);
+		cpu->invlpg_done = seq;
+	}
+}
+
+/*
+ * kernel_lock
+ *   DESCRIPTION: Takes the kernel lock, or nests if this processor
+ *                already holds it. While it spins, shootdowns are carried
+ *                out here: the holder may be waiting on one, and with
+ *                interrupts off the IPI can't get through.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be disabled
+ */
+void
+kernel_lock(void)
+{
+	cpu_t* cpu = this_cpu();
+	uint32_t taken;
+
+	if(cpu->lock_depth++ > 0)
+		return;
+	while(1) {
+		taken = 1;
+		asm volatile("xchgl %0, %1" : "+r"(taken), "+m"(kernel_lock_word) : : "memory");
+		if(taken == 0)
+			return;
+		while(kernel_lock_word) {
+			invlpg_check(cpu);
+			asm volatile("pause");
+		}
+	}
+}
+
+/*
+ * kernel_unlock
+ *   DESCRIPTION: Undoes one kernel_lock, letting go at the outermost
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be disabled
+ */
+void
+kernel_unlock(void)
+{
+	cpu_t* cpu = this_cpu();
+
+	if(--cpu->lock_depth == 0) {
+		asm volatile("" : : : "memory");
+		kernel_lock_word = 0;
+	}
+}
+
+/*
+ * checksum
+ *   DESCRIPTION: Adds up the bytes of a firmware table
+ *   INPUTS: p -- start of the table
+ *           len -- length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the sum, 0 for a valid table
+ *   SIDE EFFECTS: none
+ */
+static uint8_t
+checksum(const uint8_t* p, uint32_t len)
+{
+	uint8_t sum = 0;
+
+	while(len-- > 0)
+		sum += *p++;
+	return sum;
+}
+
+/*
+ * scan
+ *   DESCRIPTION: Looks for a signature on a 16 byte boundary in the
+ *                places the firmware tables can be
+ *   INPUTS: sig -- signature
+ *           len -- signature length
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the match, NULL if none
+ *   SIDE EFFECTS: none
+ */
+static uint8_t*
+scan(const int8_t* sig, uint32_t len)
+{
+	uint32_t addr;
+
+	for(addr = EBDA_SCAN_START; addr < EBDA_SCAN_END; addr += 16) {
+		if(strncmp((int8_t*)addr, sig, len) == 0)
+			return (uint8_t*)addr;
+	}
+	for(addr = BIOS_SCAN_START; addr < BIOS_SCAN_END; addr += 16) {
+		if(strncmp((int8_t*)addr, sig, len) == 0)
+			return (uint8_t*)addr;
+	}
+	return NULL;
+}
+
+/*
+ * acpi_parse
+ *   DESCRIPTION: Collects processor APIC IDs from the ACPI MADT, and
+ *                the I/O APIC and how the ISA IRQs are wired to it
+ *   INPUTS: none
+ *   OUTPUTS: ids -- enabled processors' APIC IDs
+ *            count -- number of IDs
+ *   RETURN VALUE: 0, -1 if there is no usable MADT
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+acpi_parse(uint8_t* ids, int32_t* count)
+{
+	uint8_t* rsdp = scan((int8_t*)"RSD PTR ", 8);
+	uint8_t* rsdt;
+	uint8_t* madt;
+	uint8_t* entry;
+	uint32_t len, i;
+
+	if(rsdp == NULL || checksum(rsdp, 20) != 0)
+		return -1;
+	/* Only tables the kernel has mapped can be read */
+	rsdt = (uint8_t*)*(uint32_t*)(rsdp + 16);
+	if((uint32_t)rsdt >= FRAME_LIMIT || strncmp((int8_t*)rsdt, (int8_t*)"RSDT", 4) != 0)
+		return -1;
+	len = *(uint32_t*)(rsdt + 4);
+
+	for(i = 36; i + 4 <= len; i += 4) {
+		madt = (uint8_t*)*(uint32_t*)(rsdt + i);
+		if((uint32_t)madt >= FRAME_LIMIT || strncmp((int8_t*)madt, (int8_t*)"APIC", 4) != 0)
+			continue;
+		lapic_base = *(uint32_t*)(madt + 36);
+		/* Entries follow the local APIC address and flags */
+		for(entry = madt + 44; entry < madt + *(uint32_t*)(madt + 4); entry += entry[1]) {
+			if(entry[1] == 0)
+				break;
+			if(entry[0] == MADT_LAPIC && (*(uint32_t*)(entry + 4) & MADT_LAPIC_ENABLED) &&
+					*count < NR_CPUS)
+				ids[(*count)++] = entry[3];
+			else if(entry[0] == MADT_IOAPIC && *(uint32_t*)(entry + 8) == 0)
+				ioapic_found(*(uint32_t*)(entry + 4));
+			else if(entry[0] == MADT_OVERRIDE && entry[2] == 0)
+				ioapic_override(entry[3], *(uint32_t*)(entry + 4), *(uint16_t*)(entry + 8));
+		}
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * mp_parse
+ *   DESCRIPTION: Collects processor APIC IDs from the Intel MP table, and
+ *                the I/O APIC and how the ISA IRQs are wired to it
+ *   INPUTS: none
+ *   OUTPUTS: ids -- enabled processors' APIC IDs
+ *            count -- number of IDs
+ *   RETURN VALUE: 0, -1 if there is no configuration table
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+mp_parse(uint8_t* ids, int32_t* count)
+{
+	uint8_t* mpf = scan((int8_t*)"_MP_", 4);
+	uint8_t* conf;
+	uint8_t* entry;
+	uint32_t n;
+	uint32_t isa_buses = 0;	/* bit per bus ID */
+
+	if(mpf == NULL || checksum(mpf, 16) != 0)
+		return -1;
+	conf = (uint8_t*)*(uint32_t*)(mpf + 4);
+	if(conf == NULL || (uint32_t)conf >= FRAME_LIMIT ||
+			strncmp((int8_t*)conf, (int8_t*)"PCMP", 4) != 0)
+		return -1;
+	lapic_base = *(uint32_t*)(conf + 36);
+
+	entry = conf + 44;
+	for(n = *(uint16_t*)(conf + 34); n > 0; n--) {
+		if(entry[0] == MP_PROCESSOR) {
+			if((entry[3] & MP_CPU_ENABLED) && *count < NR_CPUS)
+				ids[(*count)++] = entry[1];
+			entry += MP_PROCESSOR_LEN;
+			continue;
+		}
+		if(entry[0] == MP_BUS && strncmp((int8_t*)entry + 2, (int8_t*)"ISA", 3) == 0 &&
+				entry[1] < 32)
+			isa_buses |= 1 << entry[1];
+		else if(entry[0] == MP_IOAPIC && (entry[3] & MP_IOAPIC_ENABLED))
+			ioapic_found(*(uint32_t*)(entry + 4));
+		else if(entry[0] == MP_INTERRUPT && entry[1] == MP_INT_VECTORED &&
+				entry[4] < 32 && (isa_buses & (1 << entry[4])))
+			ioapic_override(entry[5], entry[7], *(uint16_t*)(entry + 2));
+		entry += MP_OTHER_LEN;
+	}
+	return 0;
+}
+
+/*
+ * cpu_setup
+ *   DESCRIPTION: Fills in a processor's per-CPU data and idle thread
+ *   INPUTS: id -- index in cpus[]
+ *           apic_id -- its local APIC ID
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+cpu_setup(int32_t id, uint32_t apic_id)
+{
+	cpu_t* cpu = &cpus[id];
+	pcb_t* idle = &idle_stacks[id].pcb;
+
+	cpu->id = id;
+	cpu->apic_id = apic_id;
+	cpu->tss = (id == 0) ? &tss : &ap_tss[id];
+	cpu->quantum_left = 0;
+
+	idle->pid = -1;
+	idle->state = PROC_RUNNABLE;
+	idle->cpu = id;
+	idle->page_dir = (uint32_t*)KERNEL_PAGE_DIR;
+	idle->kstack_top = (uint32_t)(&idle_stacks[id] + 1);
+	cpu->idle = idle;
+}
+
+/*
+ * smp_init
+ *   DESCRIPTION: Finds the processors, preferring ACPI to the MP table,
+ *                and enables the bootstrap processor's local APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs before mm_init, while the tables are untouched
+ */
+void
+smp_init(void)
+{
+	uint8_t ids[NR_CPUS];
+	int32_t count = 0, i;
+	uint32_t bsp;
+
+	lapic_base = LAPIC_DEFAULT_BASE;
+	if(acpi_parse(ids, &count) == -1) {
+		count = 0;
+		mp_parse(ids, &count);
+	}
+
+	ncpus = 1;
+	if(count == 0 || (lapic_base & 0xFFC00000) != APIC_MMIO_BASE) {
+		cpu_setup(0, 0);
+		return;
+	}
+
+	lapic_init(lapic_base);
+	bsp = lapic_id();
+	cpu_setup(0, bsp);
+	for(i = 0; i < count; i++) {
+		if(ids[i] != bsp)
+			cpu_setup(ncpus++, ids[i]);
+	}
+	asm volatile("sgdt %0" : "=m"(bsp_gdt));
+}
+
+/*
+ * cpu_load_gdt
+ *   DESCRIPTION: Gives an application processor its own copy of the GDT
+ *                with a TSS descriptor for its own TSS, and loads both
+ *   INPUTS: cpu -- the calling processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+cpu_load_gdt(cpu_t* cpu)
+{
+	struct {
+		uint16_t size;
+		uint32_t addr;
+	} __attribute__((packed)) gdtr;
+	seg_desc_t tss_desc;
+
+	memcpy(cpu->gdt, (void*)bsp_gdt.addr, sizeof(cpu->gdt));
+	tss_desc = cpu->gdt[KERNEL_TSS >> 3];
+	tss_desc.type = 0x9;	/* the bootstrap processor's is marked busy */
+	SET_TSS_PARAMS(tss_desc, cpu->tss, tss_size);
+	cpu->gdt[KERNEL_TSS >> 3] = tss_desc;
+
+	cpu->tss->ldt_segment_selector = KERNEL_LDT;
+	cpu->tss->ss0 = KERNEL_DS;
+	cpu->tss->esp0 = cpu->idle->kstack_top;
+
+	gdtr.size = sizeof(cpu->gdt) - 1;
+	gdtr.addr = (uint32_t)cpu->gdt;
+	asm volatile("lgdt %0" : : "m"(gdtr) : "memory");
+	lldt(KERNEL_LDT);
+	ltr(KERNEL_TSS);
+}
+
+/*
+ * ap_main
+ *   DESCRIPTION: Where an application processor lands after the
+ *                trampoline turned on protected mode and paging: loads
+ *                the IDT, its GDT and TSS, enables its APIC and FPU, then
+ *                idles until there is work
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: none
+ */
+void
+ap_main(void)
+{
+	cpu_t* cpu = this_cpu();
+
+	lidt(idt_desc_ptr);
+	cpu_load_gdt(cpu);
+	lapic_init(lapic_base);
+	lapic_timer_start();
+	fpu_cpu_init();
+	cpu->running = cpu->idle;
+	cpu->online = 1;
+
+	kernel_lock();
+	cpu_idle();
+}
+
+/*
+ * delay_ticks
+ *   DESCRIPTION: Busy-waits for timer ticks
+ *   INPUTS: n -- ticks
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be enabled
+ */
+static void
+delay_ticks(uint32_t n)
+{
+	uint32_t start = pit_ticks;
+
+	while(pit_ticks - start < n)
+		asm volatile("pause");
+}
+
+/*
+ * smp_boot
+ *   DESCRIPTION: Starts each application processor with INIT, STARTUP,
+ *                STARTUP, giving it a stack through the trampoline
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts must be enabled, for the PIT delays
+ */
+void
+smp_boot(void)
+{
+	uint32_t* stack_top = (uint32_t*)(AP_TRAMPOLINE + (ap_stack_top - ap_trampoline));
+	uint32_t start;
+	int32_t i;
+
+	cpus[0].online = 1;
+	if(ncpus <= 1)
+		return;
+	memcpy((void*)AP_TRAMPOLINE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+	for(i = 1; i < ncpus; i++) {
+		*stack_top = cpus[i].idle->kstack_top;
+		lapic_send_ipi(cpus[i].apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+		delay_ticks(INIT_DELAY_TICKS);
+		lapic_send_ipi(cpus[i].apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+		delay_ticks(SIPI_DELAY_TICKS);
+		if(!cpus[i].online)
+			lapic_send_ipi(cpus[i].apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+
+		/* The next processor reuses the trampoline's stack slot */
+		start = pit_ticks;
+		while(!cpus[i].online && pit_ticks - start < AP_WAIT_TICKS)
+			asm volatile("pause");
+		if(!cpus[i].online)
+			printf("CPU %d (APIC %d) did not start\n", i, cpus[i].apic_id);
+	}
+}
+
+/* Whether another processor is online with nothing better to do than
+ * its idle thread or an idle-priority one */
+static int32_t
+cpu_idle_other(cpu_t* cpu, cpu_t* self)
+{
+	return cpu != self && cpu->online &&
+			(cpu->running == cpu->idle || cpu->running->idle_prio);
+}
+
+/*
+ * smp_kick
+ *   DESCRIPTION: Called after work was queued for a processor. If it is
+ *                idle it is woken to run it; if it is busy an idle one is
+ *                woken instead, to steal it.
+ *   INPUTS: cpu -- processor the work was queued on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+smp_kick(cpu_t* cpu)
+{
+	cpu_t* self = this_cpu();
+	int32_t i;
+
+	if(ncpus <= 1)
+		return;
+	if(cpu_idle_other(cpu, self)) {
+		cpu->need_resched = 1;
+		lapic_send_ipi(cpu->apic_id, IPI_RESCHED_VECTOR);
+		return;
+	}
+	for(i = 0; i < ncpus; i++) {
+		if(cpu_idle_other(&cpus[i], self)) {
+			cpus[i].need_resched = 1;
+			lapic_send_ipi(cpus[i].apic_id, IPI_RESCHED_VECTOR);
+			return;
+		}
+	}
+}
+
+/*
+ * smp_flush_page_others
+ *   DESCRIPTION: Asks every other processor to invalidate a page and
+ *                spins until each one has acknowledged it, so no stale
+ *                translation is left once this returns. A user program
+ *                running elsewhere can otherwise keep writing through
+ *                the old mapping.
+ *   INPUTS: vaddr -- page to invalidate
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called with the kernel lock held, which also keeps
+ *                 shootdowns one at a time
+ */
+void
+smp_flush_page_others(uint32_t vaddr)
+{
+	cpu_t* self = this_cpu();
+	uint32_t seq;
+	int32_t i;
+
+	invlpg_addr = vaddr;
+	seq = ++invlpg_seq;
+	self->invlpg_done = seq;
+	for(i = 0; i < ncpus; i++) {
+		if(&cpus[i] != self && cpus[i].online)
+			lapic_send_ipi(cpus[i].apic_id, IPI_INVLPG_VECTOR);
+	}
+	for(i = 0; i < ncpus; i++) {
+		while(&cpus[i] != self && cpus[i].online && cpus[i].invlpg_done != seq)
+			asm volatile("pause");
+	}
+}
+
+/* Reschedule IPI: the idle loop checks the run queues once it returns */
+void
+ipi_resched(void)
+{
+	lapic_eoi();
+}
+
+/* TLB shootdown of one page, acknowledged to the waiting sender */
+void
+ipi_invlpg(void)
+{
+	lapic_eoi();
+	invlpg_check(this_cpu());
+}
@@ -0,0 +1,88 @@
+/* smp.h - Processors, per-CPU data and the kernel lock
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+/* Real-mode page the application processors start in */
+#define AP_TRAMPOLINE	0x7000
+/* Size of every kernel stack, processes' and idle threads'. Stacks are
+ * aligned to it. */
+#define KSTACK_SIZE		8192
+
+#ifndef ASM
+
+#include "types.h"
+#include "x86_desc.h"
+
+/* Most processors brought up */
+#define NR_CPUS			8
+/* Entries in each processor's GDT, the same layout as x86_desc.S */
+#define GDT_ENTRIES		8
+
+struct pcb;
+
+/* Processes ready to run on one processor, in FIFO order */
+typedef struct run_queue {
+	struct pcb* head;
+	struct pcb* tail;
+	uint32_t count;
+} run_queue_t;
+
+typedef struct cpu {
+	seg_desc_t gdt[GDT_ENTRIES];	/* application processors only */
+	tss_t* tss;					/* tss.esp0 follows the running process */
+	int32_t id;					/* index in cpus[] */
+	uint32_t apic_id;
+	volatile int32_t online;
+	struct pcb* running;		/* current process, idle if none */
+	struct pcb* idle;			/* runs when the run queue is empty */
+	run_queue_t rq;
+	run_queue_t idle_rq;		/* idle-priority threads, run when rq is empty */
+	volatile int32_t need_resched;
+	int32_t quantum_left;
+	int32_t lock_depth;			/* kernel lock nesting on this processor */
+	volatile uint32_t invlpg_done;	/* last TLB shootdown it carried out */
+	struct pcb* fpu_owner;		/* whose state is in this FPU's registers */
+	uint32_t steals;			/* processes taken from other run queues */
+	uint32_t switches;
+	uint32_t irqoff_since;		/* TSC when irqsave last disabled interrupts */
+	void* irqoff_from;			/* and who called it */
+} cpu_t;
+
+extern cpu_t cpus[NR_CPUS];
+/* Processors found, brought up or not */
+extern int32_t ncpus;
+
+/* The calling processor */
+extern cpu_t* this_cpu(void);
+
+/* Finds the processors in the ACPI MADT or the MP table and enables the
+ * bootstrap processor's local APIC; one processor if neither exists */
+extern void smp_init(void);
+/* Starts the application processors; they idle until given work */
+extern void smp_boot(void);
+
+/* Interrupts another processor so it looks at its run queue */
+extern void smp_kick(cpu_t* cpu);
+/* Invalidates a page on every other processor and waits until they all
+ * have. The caller holds the kernel lock. */
+extern void smp_flush_page_others(uint32_t vaddr);
+
+/* IPI handlers, entered through linkage.S. ipi_invlpg runs without the
+ * kernel lock, since the processor that sent it holds the lock while it
+ * waits. */
+extern void ipi_resched(void);
+extern void ipi_invlpg(void);
+
+/* The kernel lock. Kernel code runs on one processor at a time: every
+ * entry from an interrupt, exception or system call takes it, and the
+ * way back out drops it. It nests, and a processor keeps holding it
+ * across a context switch. Interrupts must be disabled. */
+extern void kernel_lock(void);
+extern void kernel_unlock(void);
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
@@ -0,0 +1,191 @@
+/* spinlock.c - Ticket spinlocks and interrupt state helpers
+ * vim:ts=4 noexpandtab
+ */
+
+#include "spinlock.h"
+#include "smp.h"
+#include "lib.h"
+
+#define EFLAGS_IF	0x200
+
+#if LOCK_STATS
+/* Longest stretch between an irqsave that turned interrupts off and the
+ * irqrestore that turned them back on, and the code that opened it */
+static uint32_t irqoff_max;
+static void* irqoff_max_from;
+/* Locks taken at least once, for the report */
+static spinlock_t* lock_list;
+#endif
+
+/*
+ * irqsave_from
+ *   DESCRIPTION: Disables interrupts and, if they were on, opens an
+ *                interrupts-off window
+ *   INPUTS: from -- caller to blame for the window
+ *   OUTPUTS: none
+ *   RETURN VALUE: EFLAGS before
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+irqsave_from(void* from)
+{
+	uint32_t flags;
+#if LOCK_STATS
+	cpu_t* cpu;
+#endif
+
+	cli_and_save(flags);
+#if LOCK_STATS
+	if(flags & EFLAGS_IF) {
+		cpu = this_cpu();
+		rdtsc(cpu->irqoff_since);
+		cpu->irqoff_from = from;
+	}
+#endif
+	return flags;
+}
+
+/* Disables interrupts, returning the EFLAGS to give irqrestore */
+uint32_t
+irqsave(void)
+{
+	return irqsave_from(__builtin_return_address(0));
+}
+
+/*
+ * irqrestore
+ *   DESCRIPTION: Restores EFLAGS, closing the interrupts-off window if
+ *                this turns them back on
+ *   INPUTS: flags -- value irqsave returned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+irqrestore(uint32_t flags)
+{
+#if LOCK_STATS
+	cpu_t* cpu;
+	uint32_t len;
+
+	if(flags & EFLAGS_IF) {
+		cpu = this_cpu();
+		rdtsc(len);
+		len -= cpu->irqoff_since;
+		if(len > irqoff_max) {
+			irqoff_max = len;
+			irqoff_max_from = cpu->irqoff_from;
+		}
+	}
+#endif
+	restore_flags(flags);
+}
+
+/* Restarts this processor's window; called by schedule() */
+void
+irqoff_restart(void)
+{
+#if LOCK_STATS
+	rdtsc(this_cpu()->irqoff_since);
+#endif
+}
+
+/*
+ * spin_lock
+ *   DESCRIPTION: Takes a ticket and spins until it is served
+ *   INPUTS: lock -- lock to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+spin_lock(spinlock_t* lock)
+{
+	uint16_t ticket = 1;
+
+	asm volatile("lock xaddw %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+#if LOCK_STATS
+	if(lock->owner != ticket)
+		lock->contended++;
+#endif
+	while(lock->owner != ticket)
+		asm volatile("pause" : : : "memory");
+#if LOCK_STATS
+	rdtsc(lock->acquired);
+	lock->locks++;
+	if(!lock->listed) {
+		/* Other processors may be listing other locks */
+		lock->listed = 1;
+		do {
+			lock->stats_next = lock_list;
+		} while(!__sync_bool_compare_and_swap(&lock_list, lock->stats_next, lock));
+	}
+#endif
+}
+
+/*
+ * spin_unlock
+ *   DESCRIPTION: Serves the next ticket
+ *   INPUTS: lock -- lock held by the caller
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+spin_unlock(spinlock_t* lock)
+{
+#if LOCK_STATS
+	uint32_t held;
+
+	rdtsc(held);
+	held -= lock->acquired;
+	if(held > lock->max_hold)
+		lock->max_hold = held;
+#endif
+	/* Only the holder writes owner, so a plain increment will do once
+	 * the stores inside the critical section are out */
+	asm volatile("" : : : "memory");
+	lock->owner++;
+}
+
+/* Disables interrupts, then takes the lock */
+uint32_t
+spin_lock_irqsave(spinlock_t* lock)
+{
+	uint32_t flags = irqsave_from(__builtin_return_address(0));
+
+	spin_lock(lock);
+	return flags;
+}
+
+/* Drops the lock, then restores interrupts */
+void
+spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags)
+{
+	spin_unlock(lock);
+	irqrestore(flags);
+}
+
+/*
+ * lock_stats_print
+ *   DESCRIPTION: Prints the longest interrupts-off window and, for each
+ *                lock taken so far, how often it was taken and contended
+ *                and its longest hold
+ *   INPUTS: none
+ *   OUTPUTS: the report, on the current screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+lock_stats_print(void)
+{
+#if LOCK_STATS
+	spinlock_t* lock;
+
+	printf("irqs off: longest %u cycles, from 0x%x\n", irqoff_max, (uint32_t)irqoff_max_from);
+	for(lock = lock_list; lock != NULL; lock = lock->stats_next) {
+		printf("lock %s: %u locks, %u contended, longest hold %u cycles\n",
+				lock->name, lock->locks, lock->contended, lock->max_hold);
+	}
+#endif
+}
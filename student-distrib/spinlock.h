@@ -0,0 +1,52 @@
+/* spinlock.h - Ticket spinlocks and interrupt state helpers
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+
+/* Set to 0 to compile out the hold time and interrupts-off accounting */
+#ifndef LOCK_STATS
+#define LOCK_STATS	1
+#endif
+
+/* A ticket lock: lockers take the next ticket and spin until it is
+ * served, so the processors get the lock in the order they asked */
+typedef struct spinlock {
+	volatile uint16_t next;		/* ticket the next locker takes */
+	volatile uint16_t owner;	/* ticket being served */
+	const int8_t* name;
+#if LOCK_STATS
+	uint32_t acquired;			/* TSC when it was taken */
+	uint32_t max_hold;			/* longest hold, in TSC cycles */
+	uint32_t locks;
+	uint32_t contended;			/* locks that had to spin */
+	struct spinlock* stats_next;
+	int32_t listed;				/* on the list lock_stats_print walks */
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(name)	{ 0, 0, (int8_t*)(name) }
+
+/* Disables interrupts, returning the EFLAGS to give irqrestore */
+extern uint32_t irqsave(void);
+/* Puts EFLAGS.IF back the way irqsave found it */
+extern void irqrestore(uint32_t flags);
+
+/* Plain lock and unlock, for code that already runs with interrupts
+ * off or whose lock no interrupt handler takes */
+extern void spin_lock(spinlock_t* lock);
+extern void spin_unlock(spinlock_t* lock);
+/* Same with irqsave/irqrestore around it */
+extern uint32_t spin_lock_irqsave(spinlock_t* lock);
+extern void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags);
+
+/* Starts a fresh interrupts-off window after a context switch, since
+ * the one open before it belongs to another process */
+extern void irqoff_restart(void);
+/* Prints the longest interrupts-off window and each lock's counters */
+extern void lock_stats_print(void);
+
+#endif /* _SPINLOCK_H */
@@ -0,0 +1,55 @@
+/* stats.c - Kernel counters report
+ * vim:ts=4 noexpandtab
+ */
+
+#include "stats.h"
+#include "mm.h"
+#include "pagecache.h"
+#include "execcache.h"
+#include "dcache.h"
+#include "bcache.h"
+#include "paging.h"
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "lib.h"
+
+/*
+ * stats_print
+ *   DESCRIPTION: Prints one line per subsystem with its counters
+ *   INPUTS: none
+ *   OUTPUTS: the report, on the current screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+stats_print(void)
+{
+	int32_t i;
+
+	printf("\nmemory: %u frames free, %u shared\n", frames_free, frames_shared());
+	printf("zero pool: %u frames, %u hits, %u misses, %u zeroed at %u cycles each\n",
+			zero_pool_frames, zero_pool_hits, zero_pool_misses, zero_pool_zeroed,
+			zero_pool_zeroed ? zero_pool_cycles / zero_pool_zeroed : 0);
+	printf("page cache: %u pages, %u hits, %u misses\n",
+			pcache_pages(), pcache_hits, pcache_misses);
+	printf("exec cache: %u hits, %u misses\n", exec_cache_hits, exec_cache_misses);
+	printf("dentry cache: %u hits, %u misses\n", dcache_hits, dcache_misses);
+	printf("block cache: %u hits, %u misses\n", bcache_hits, bcache_misses);
+	printf("tlb: %u full flushes, %u pages invalidated, %u switches kept the tlb\n",
+			tlb_flushes, tlb_page_flushes, tlb_switches_skipped);
+	printf("fpu restores:");
+	for(i = 0; i < MAX_PROCESSES; i++) {
+		if(PCB(i)->state != PROC_FREE)
+			printf(" %d:%u", PCB(i)->pid, PCB(i)->fpu_restores);
+	}
+	printf("\n");
+	for(i = 0; i < ncpus; i++) {
+		printf("cpu %d: %s, %u queued, %u switches, %u steals, %u work done, %u dropped\n", i,
+				cpus[i].online ? "online" : "offline",
+				cpus[i].rq.count, cpus[i].switches, cpus[i].steals,
+				work_queues[i].done, work_queues[i].dropped);
+	}
+	lock_stats_print();
+}
@@ -0,0 +1,11 @@
+/* stats.h - Kernel counters report
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+/* Prints the kernel's counters on the current screen (F9) */
+extern void stats_print(void);
+
+#endif /* _STATS_H */
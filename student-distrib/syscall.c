@@ -0,0 +1,540 @@
+/* syscall.c - System call dispatch and the file descriptor table
+ * vim:ts=4 noexpandtab
+ */
+
+#include "syscall.h"
+#include "lib.h"
+#include "terminal.h"
+#include "rtc.h"
+#include "filesys.h"
+#include "process.h"
+#include "mm.h"
+#include "pagecache.h"
+#include "poll.h"
+#include "pipe.h"
+
+typedef int32_t (*syscall_t)();
+
+/******************************** Terminal ************************************/
+
+static int32_t
+tty_open(file_t* file, const uint8_t* fname)
+{
+	/* The inode field holds the terminal number */
+	file->mode = 0; // canonical
+	return 0;
+}
+
+static int32_t
+tty_read(file_t* file, void* buf, int32_t nbytes)
+{
+	return terminal_read(file->inode, file->mode, buf, nbytes);
+}
+
+static int32_t
+tty_write(file_t* file, const void* buf, int32_t nbytes)
+{
+	return terminal_write(file->inode, buf, nbytes);
+}
+
+static int32_t
+tty_close(file_t* file)
+{
+	return terminal_close();
+}
+
+static int32_t
+tty_ioctl(file_t* file, uint32_t cmd, uint32_t arg)
+{
+	return terminal_ioctl(&file->mode, cmd, arg);
+}
+
+static int32_t
+tty_poll(file_t* file, poll_table_t* pt)
+{
+	return terminal_poll(file->inode, file->mode, pt);
+}
+
+static file_ops_t tty_ops = { tty_open, tty_read, tty_write, tty_close, tty_ioctl, tty_poll, NULL };
+
+/*********************************** RTC **************************************/
+
+/* The fd's pos holds the interrupt count it last saw, so a read after
+ * poll reported the RTC ready returns without waiting again. */
+static int32_t
+rtc_fopen(file_t* file, const uint8_t* fname)
+{
+	file->pos = rtc_ticks;
+	return rtc_open();
+}
+
+static int32_t
+rtc_fread(file_t* file, void* buf, int32_t nbytes)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if(file->pos == rtc_ticks)
+		rtc_read(buf, nbytes);
+	file->pos = rtc_ticks;
+	restore_flags(flags);
+	return 0;
+}
+
+/* Takes a 4-byte frequency in Hz, which must be a power of two. */
+static int32_t
+rtc_fwrite(file_t* file, const void* buf, int32_t nbytes)
+{
+	int32_t freq, exp;
+
+	if(nbytes != 4)
+		return -1;
+	freq = *(const int32_t*)buf;
+	if(freq < 2 || (freq & (freq - 1)) != 0)
+		return -1;
+	for(exp = 0; (1 << exp) < freq; exp++);
+	return rtc_write(NULL, exp);
+}
+
+static int32_t
+rtc_fclose(file_t* file)
+{
+	return 0;
+}
+
+static int32_t
+rtc_fpoll(file_t* file, poll_table_t* pt)
+{
+	return rtc_poll(file->pos, pt);
+}
+
+static file_ops_t rtc_ops = { rtc_fopen, rtc_fread, rtc_fwrite, rtc_fclose, NULL, rtc_fpoll, NULL };
+
+/***************************** Files and directories **************************/
+
+static int32_t
+file_open(file_t* file, const uint8_t* fname)
+{
+	return 0;
+}
+
+/* Each fd keeps its own position, so processes reading the same file
+ * don't disturb each other. */
+static int32_t
+file_read(file_t* file, void* buf, int32_t nbytes)
+{
+	int32_t cnt = read_data(file->inode, file->pos, buf, nbytes);
+	if(cnt > 0)
+		file->pos += cnt;
+	return cnt;
+}
+
+/* In append mode every write starts at the current end of the file */
+static int32_t
+file_write(file_t* file, const void* buf, int32_t nbytes)
+{
+	int32_t cnt;
+
+	if(file->mode & FILE_APPEND)
+		file->pos = inode_length(file->inode);
+	cnt = write_data(file->inode, file->pos, buf, nbytes);
+	if(cnt > 0)
+		file->pos += cnt;
+	return cnt;
+}
+
+static int32_t
+file_close(file_t* file)
+{
+	return 0;
+}
+
+static int32_t
+file_ioctl(file_t* file, uint32_t cmd, uint32_t arg)
+{
+	if(cmd != FILE_SETAPPEND)
+		return -1;
+	if(arg)
+		file->mode |= FILE_APPEND;
+	else
+		file->mode &= ~FILE_APPEND;
+	return 0;
+}
+
+static file_ops_t file_ops = { file_open, file_read, file_write, file_close, file_ioctl, NULL, NULL };
+
+/* A directory fd's position is the next entry it reads */
+static int32_t
+dir_fopen(file_t* file, const uint8_t* fname)
+{
+	file->pos = DIR_FIRST;
+	return dir_open((uint8_t*)fname);
+}
+
+static int32_t
+dir_fread(file_t* file, void* buf, int32_t nbytes)
+{
+	return dir_read(file->inode, &file->pos, buf, nbytes);
+}
+
+static int32_t
+dir_fwrite(file_t* file, const void* buf, int32_t nbytes)
+{
+	return dir_write(file->inode, buf, nbytes);
+}
+
+static int32_t
+dir_fclose(file_t* file)
+{
+	return 0;
+}
+
+static file_ops_t dir_ops = { dir_fopen, dir_fread, dir_fwrite, dir_fclose, NULL, NULL, NULL };
+
+/******************************* System calls *********************************/
+
+/* 
+ * get_file
+ *   DESCRIPTION: Looks up an open fd
+ *   INPUTS: fd -- file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the file, or NULL if fd is out of range or not open
+ *   SIDE EFFECTS: none
+ */
+file_t*
+get_file(int32_t fd)
+{
+	if(fd < 0 || fd >= MAX_FILES || !(current->files[fd].flags & FD_IN_USE))
+		return NULL;
+	return &current->files[fd];
+}
+
+/* 
+ * alloc_fd
+ *   DESCRIPTION: Finds a free fd of the current process
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: lowest free fd above stdin and stdout, -1 if full
+ *   SIDE EFFECTS: none
+ */
+int32_t
+alloc_fd(void)
+{
+	int32_t fd;
+	for(fd = 2; fd < MAX_FILES; fd++) {
+		if(!(current->files[fd].flags & FD_IN_USE))
+			return fd;
+	}
+	return -1;
+}
+
+int32_t
+sys_read(int32_t fd, void* buf, int32_t nbytes)
+{
+	file_t* file = get_file(fd);
+	if(file == NULL || nbytes < 0 || bad_userspace_write(buf, nbytes))
+		return -1;
+	return file->ops->read(file, buf, nbytes);
+}
+
+int32_t
+sys_write(int32_t fd, const void* buf, int32_t nbytes)
+{
+	file_t* file = get_file(fd);
+	if(file == NULL || nbytes < 0 || bad_userspace_addr(buf, nbytes))
+		return -1;
+	return file->ops->write(file, buf, nbytes);
+}
+
+int32_t
+sys_open(const uint8_t* filename)
+{
+	dentry_t dentry;
+	file_t* file;
+	int32_t fd;
+
+	if(bad_userspace_str(filename) || read_dentry_by_name(filename, &dentry) == -1)
+		return -1;
+
+	if((fd = alloc_fd()) == -1)
+		return -1;
+
+	file = &current->files[fd];
+	switch(dentry.type) {
+		case TYPE_RTC:
+		file->ops = &rtc_ops;
+		break;
+
+		case TYPE_DIR:
+		file->ops = &dir_ops;
+		break;
+
+		case TYPE_FILE:
+		file->ops = &file_ops;
+		break;
+
+		default:
+		return -1;
+	}
+	file->inode = dentry.inode_num;
+	file->pos = 0;
+	file->mode = 0;
+	file->data = NULL;
+	if(file->ops->open(file, filename) == -1)
+		return -1;
+	file->flags = FD_IN_USE;
+	return fd;
+}
+
+/* 
+ * sys_create
+ *   DESCRIPTION: Creates an empty file and opens it
+ *   INPUTS: filename -- name of the new file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the fd, -1 if the name is taken, the file system is
+ *                 read only or full, or no fd is free
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_create(const uint8_t* filename)
+{
+	dentry_t dentry;
+	file_t* file;
+	int32_t fd;
+
+	if(bad_userspace_str(filename) || (fd = alloc_fd()) == -1 ||
+			fs_create(filename, &dentry) == -1)
+		return -1;
+
+	file = &current->files[fd];
+	file->ops = &file_ops;
+	file->inode = dentry.inode_num;
+	file->pos = 0;
+	file->mode = 0;
+	file->data = NULL;
+	file->flags = FD_IN_USE;
+	return fd;
+}
+
+/* 
+ * sys_getdents
+ *   DESCRIPTION: Reads as many entries of an open directory as fit in
+ *                the buffer, as dirent_t records
+ *   INPUTS: fd -- directory fd
+ *           buf -- where the records go
+ *           nbytes -- its size
+ *   OUTPUTS: records to buf
+ *   RETURN VALUE: bytes filled, 0 at the end of the directory, -1 for a
+ *                 bad fd or buffer or if one record doesn't fit
+ *   SIDE EFFECTS: the fd moves past the entries returned
+ */
+int32_t
+sys_getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+	file_t* file = get_file(fd);
+	if(file == NULL || file->ops != &dir_ops || nbytes < 0 || bad_userspace_write(buf, nbytes))
+		return -1;
+	return dir_getdents(file->inode, &file->pos, buf, nbytes);
+}
+
+/* 
+ * sys_mmap
+ *   DESCRIPTION: Maps part of an open file read-only at the break, which
+ *                moves past it, so moving the break back gives the
+ *                mapping up. Whole blocks are the image's own pages, with
+ *                nothing copied; the page the file ends in comes from the
+ *                page cache with its tail zeroed, and pages past the end
+ *                are left to demand-zero faults.
+ *   INPUTS: fd -- open file
+ *           offset -- where in the file to start, page aligned
+ *           len -- bytes to map
+ *   OUTPUTS: none
+ *   RETURN VALUE: user address of the mapping, -1 for a bad fd or offset,
+ *                 if len is 0 or too big for the heap, or if out of memory
+ *   SIDE EFFECTS: writes to the file show through blocks mapped in place;
+ *                 the pages are neither writable nor copy-on-write, so
+ *                 bad_userspace_write keeps read and the like off them
+ */
+int32_t
+sys_mmap(int32_t fd, uint32_t offset, uint32_t len)
+{
+	file_t* file = get_file(fd);
+	pcb_t* p = current;
+	uint32_t start = PAGE_ROUND_UP(p->brk);
+	uint32_t end, vaddr, frame, index;
+	int32_t n;
+
+	if(file == NULL || file->ops != &file_ops || offset % PAGE_SIZE != 0 ||
+			len == 0 || len > USER_STACK_LIMIT - start)
+		return -1;
+	end = start + PAGE_ROUND_UP(len);
+
+	index = offset / PAGE_SIZE;
+	for(vaddr = start; vaddr < end; vaddr += PAGE_SIZE, index++) {
+		if((frame = inode_block_addr(file->inode, index)) != 0) {
+			user_map(p->page_dir, vaddr, frame, PTE_PRESENT | PTE_USER | PTE_IMAGE);
+			continue;
+		}
+		if((n = pcache_get(file->inode, index, &frame)) == 0)
+			break;
+		if(n == -1) {
+			while(vaddr > start) {
+				vaddr -= PAGE_SIZE;
+				user_unmap(p->page_dir, vaddr);
+				tlb_flush_page(vaddr);
+			}
+			return -1;
+		}
+		user_map(p->page_dir, vaddr, frame, PTE_PRESENT | PTE_USER);
+	}
+	p->brk = end;
+	return start;
+}
+
+int32_t
+sys_close(int32_t fd)
+{
+	file_t* file;
+
+	/* stdin and stdout stay open */
+	if(fd < 2 || (file = get_file(fd)) == NULL)
+		return -1;
+	file->flags = 0;
+	return file->ops->close(file);
+}
+
+int32_t
+sys_ioctl(int32_t fd, uint32_t cmd, uint32_t arg)
+{
+	file_t* file = get_file(fd);
+	if(file == NULL || file->ops->ioctl == NULL)
+		return -1;
+	return file->ops->ioctl(file, cmd, arg);
+}
+
+/* 
+ * sys_dup2
+ *   DESCRIPTION: Makes newfd a copy of oldfd, closing newfd first if it is
+ *                open. Used by the shell to point stdin and stdout at pipes.
+ *   INPUTS: oldfd -- open fd to copy
+ *           newfd -- fd to replace, may be stdin or stdout
+ *   OUTPUTS: none
+ *   RETURN VALUE: newfd, -1 on a bad fd
+ *   SIDE EFFECTS: none
+ */
+int32_t
+sys_dup2(int32_t oldfd, int32_t newfd)
+{
+	file_t* old = get_file(oldfd);
+	file_t* file;
+
+	if(old == NULL || newfd < 0 || newfd >= MAX_FILES)
+		return -1;
+	if(oldfd == newfd)
+		return newfd;
+
+	file = &current->files[newfd];
+	if(file->flags & FD_IN_USE) {
+		file->flags = 0;
+		file->ops->close(file);
+	}
+	*file = *old;
+	if(file->ops->dup != NULL)
+		file->ops->dup(file);
+	return newfd;
+}
+
+/* Indexed by call number from linkage.S, which range-checks it */
+syscall_t syscall_table[NUM_SYSCALLS + 1] = {
+	NULL,
+	(syscall_t)sys_halt,
+	(syscall_t)sys_execute,
+	(syscall_t)sys_read,
+	(syscall_t)sys_write,
+	(syscall_t)sys_open,
+	(syscall_t)sys_close,
+	(syscall_t)sys_getargs,
+	(syscall_t)sys_vidmap,
+	(syscall_t)sys_set_handler,
+	(syscall_t)sys_sigreturn,
+	(syscall_t)sys_ioctl,
+	(syscall_t)sys_poll,
+	(syscall_t)sys_pipe,
+	(syscall_t)sys_dup2,
+	(syscall_t)sys_spawn,
+	(syscall_t)sys_wait,
+	(syscall_t)sys_fork,
+	(syscall_t)sys_exec,
+	(syscall_t)sys_sbrk,
+	(syscall_t)sys_create,
+	(syscall_t)sys_getdents,
+	(syscall_t)sys_mmap
+};
+
+/* 
+ * files_init
+ *   DESCRIPTION: Sets up a new process's fd table with stdin and stdout
+ *                on its terminal
+ *   INPUTS: files -- fd table
+ *           terminal -- terminal number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fds 0 and 1 in use, the rest free
+ */
+void
+files_init(file_t* files, int32_t terminal)
+{
+	int32_t fd;
+	for(fd = 0; fd < MAX_FILES; fd++)
+		files[fd].flags = 0;
+	for(fd = 0; fd < 2; fd++) {
+		files[fd].ops = &tty_ops;
+		files[fd].inode = terminal;
+		files[fd].pos = 0;
+		files[fd].data = NULL;
+		files[fd].flags = FD_IN_USE;
+		tty_open(&files[fd], NULL);
+	}
+}
+
+/* 
+ * files_inherit
+ *   DESCRIPTION: Copies all of a parent's open fds into a forked child.
+ *                A child that should not hold some of them, like the
+ *                other ends of a pipeline's pipes, closes them itself.
+ *   INPUTS: files -- child's fd table
+ *           parent_files -- parent's fd table
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: shared objects like pipes gain a user per copied fd
+ */
+void
+files_inherit(file_t* files, file_t* parent_files)
+{
+	int32_t fd;
+	for(fd = 0; fd < MAX_FILES; fd++) {
+		files[fd] = parent_files[fd];
+		if((files[fd].flags & FD_IN_USE) && files[fd].ops->dup != NULL)
+			files[fd].ops->dup(&files[fd]);
+	}
+}
+
+/* 
+ * files_close_all
+ *   DESCRIPTION: Closes every open fd of an exiting process
+ *   INPUTS: files -- fd table
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+files_close_all(file_t* files)
+{
+	int32_t fd;
+	for(fd = 0; fd < MAX_FILES; fd++) {
+		if(files[fd].flags & FD_IN_USE) {
+			files[fd].flags = 0;
+			files[fd].ops->close(&files[fd]);
+		}
+	}
+}
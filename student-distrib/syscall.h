@@ -0,0 +1,103 @@
+/* syscall.h - System call dispatch and the file descriptor table
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SYSCALL_H
+#define _SYSCALL_H
+
+/* System call numbers, must match syscalls/ece391sysnum.h */
+#define SYS_HALT		1
+#define SYS_EXECUTE		2
+#define SYS_READ		3
+#define SYS_WRITE		4
+#define SYS_OPEN		5
+#define SYS_CLOSE		6
+#define SYS_GETARGS		7
+#define SYS_VIDMAP		8
+#define SYS_SET_HANDLER	9
+#define SYS_SIGRETURN	10
+#define SYS_IOCTL		11
+#define SYS_POLL		12
+#define SYS_PIPE		13
+#define SYS_DUP2		14
+#define SYS_SPAWN		15
+#define SYS_WAIT		16
+#define SYS_FORK		17
+#define SYS_EXEC		18
+#define SYS_SBRK		19
+#define SYS_CREATE		20
+#define SYS_GETDENTS	21
+#define SYS_MMAP		22
+
+#define NUM_SYSCALLS	22
+
+#ifndef ASM
+
+#include "types.h"
+
+/* Size of the file descriptor table; 0 and 1 are stdin and stdout */
+#define MAX_FILES		8
+
+/* File descriptor flags */
+#define FD_IN_USE		0x1
+
+/* ioctl on a file: arg nonzero makes every write append */
+#define FILE_SETAPPEND	16
+/* File mode bit */
+#define FILE_APPEND		0x1
+
+typedef struct file file_t;
+typedef struct poll_table poll_table_t;
+
+/* Operations jump table for an open file */
+typedef struct file_ops {
+	int32_t (*open)(file_t* file, const uint8_t* fname);
+	int32_t (*read)(file_t* file, void* buf, int32_t nbytes);
+	int32_t (*write)(file_t* file, const void* buf, int32_t nbytes);
+	int32_t (*close)(file_t* file);
+	int32_t (*ioctl)(file_t* file, uint32_t cmd, uint32_t arg);
+	/* Returns the POLL* events ready now and, if pt is not NULL,
+	 * registers pt on the queue that signals a change. NULL means
+	 * always readable and writable. */
+	int32_t (*poll)(file_t* file, poll_table_t* pt);
+	/* Called when the fd is copied by dup2 or into a child, so shared
+	 * objects can count their users. NULL if nothing to do. */
+	void (*dup)(file_t* file);
+} file_ops_t;
+
+/* One entry in the file descriptor table */
+struct file {
+	file_ops_t* ops;
+	uint32_t inode;		/* inode for files, terminal number for ttys */
+	uint32_t pos;
+	uint32_t flags;
+	uint32_t mode;		/* device mode word, e.g. the tty line discipline */
+	void* data;			/* device object, e.g. the pipe */
+};
+
+/* Opens stdin and stdout of a new process */
+extern void files_init(file_t* files, int32_t terminal);
+/* Gives a forked child copies of all its parent's open fds */
+extern void files_inherit(file_t* files, file_t* parent_files);
+/* Closes everything a process left open */
+extern void files_close_all(file_t* files);
+
+extern int32_t sys_read(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t sys_write(int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t sys_open(const uint8_t* filename);
+extern int32_t sys_create(const uint8_t* filename);
+extern int32_t sys_getdents(int32_t fd, void* buf, int32_t nbytes);
+extern int32_t sys_mmap(int32_t fd, uint32_t offset, uint32_t len);
+extern int32_t sys_close(int32_t fd);
+extern int32_t sys_ioctl(int32_t fd, uint32_t cmd, uint32_t arg);
+
+extern int32_t sys_dup2(int32_t oldfd, int32_t newfd);
+
+/* Looks up an open fd of the current process */
+extern file_t* get_file(int32_t fd);
+/* Finds the lowest free fd of the current process, -1 if none */
+extern int32_t alloc_fd(void);
+
+#endif /* ASM */
+
+#endif /* _SYSCALL_H */
@@ -1,21 +1,50 @@
 #include "terminal.h"
 #include "lib.h"
+#include "pit.h"
+#include "sched.h"
+#include "paging.h"
+#include "poll.h"
+#include "stats.h"
+#include "spinlock.h"
+#include "workqueue.h"
+#include "signal.h"
 
-#define VIDEO 0xB8000
-#define SAVED_VIDEO 0xB9000
+#define TERM_BUF_MASK (TERM_BUF_SIZE - 1)
+/* Bytes terminal_write copies in from the caller per trip through
+ * term_lock */
+#define TERM_WRITE_CHUNK 128
 
-static uint8_t typed[1024];
+/* One virtual terminal's input side. Bytes in [head, commit) of the
+ * ring buffer are ready to be read, bytes in [commit, tail) are the line
+ * still being edited in canonical mode. The indices run freely and are
+ * masked on access. */
+typedef struct tty {
+	uint8_t typed[TERM_BUF_SIZE];
+	volatile uint32_t head;
+	volatile uint32_t commit;
+	volatile uint32_t tail;
+	/* Tick of the last keystroke, for the VTIME inter-byte timer */
+	volatile uint32_t last_key_tick;
+	/* 1 if the most recent reader put the terminal in raw mode */
+	int8_t raw;
+	/* Readers waiting for input */
+	wait_queue_t read_wq;
+} tty_t;
 
-/* Keeps track of # of elements in typed */
-static int16_t line_pos;
+static tty_t ttys[NUM_TERMINALS];
+
+/* Guards the ttys, the keyboard state and the screens; the keyboard
+ * handler takes it too, so take it with spin_lock_irqsave */
+static spinlock_t term_lock = SPINLOCK_INIT("terminal");
+
+/* Terminal on the display; gets the keyboard */
+static int32_t active;
 
 // Active high
-static volatile int8_t enter_pressed;
 static int8_t shift;
 static int8_t caps_lock;
 static int8_t ctrl;
-
-static int8_t reading; // 1 if read fn. is running, 0 otherwise
+static int8_t alt;
 
 /* 
  * terminal_open
@@ -28,67 +57,287 @@ static int8_t reading; // 1 if read fn. is running, 0 otherwise
 int32_t
 terminal_open()
 {
+	int32_t i;
+
 	screen_init();
-	line_pos = 0;
+	for(i = 0; i < NUM_TERMINALS; i++) {
+		ttys[i].head = ttys[i].commit = ttys[i].tail = 0;
+		ttys[i].last_key_tick = 0;
+		ttys[i].raw = 0;
+		ttys[i].read_wq.head = NULL;
+	}
+	active = 0;
 	shift = 0;
 	caps_lock = 0;
 	ctrl = 0;
-	reading = 0;
+	alt = 0;
 	return 0;
 }
 
+/*
+ * terminal_switch
+ *   DESCRIPTION: Puts another terminal on the display and gives it the
+ *                keyboard. Programs that mapped video memory are moved
+ *                between VGA memory and backing pages by remapping first,
+ *                so nothing on another processor is still drawing into
+ *                VGA memory while screen_show copies it out.
+ *   INPUTS: term -- terminal to show
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static void
+terminal_switch(int32_t term)
+{
+	if(term < 0 || term >= NUM_TERMINALS || term == active)
+		return;
+	vidmap_show(term);
+	screen_show(term);
+	active = term;
+}
+
+/*
+ * set_raw
+ *   DESCRIPTION: Switches the discipline applied to incoming keystrokes.
+ *                Entering raw mode makes a half-edited line readable.
+ *   INPUTS: t -- terminal
+ *           r -- 1 for raw, 0 for canonical
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static void
+set_raw(tty_t* t, int8_t r)
+{
+	if(r && !t->raw)
+		t->commit = t->tail;
+	t->raw = r;
+}
+
+/*
+ * line_length
+ *   DESCRIPTION: Finds how much of the committed input a canonical read
+ *                returns: up to and including the first newline.
+ *   INPUTS: t -- terminal
+ *           cnt -- size of the caller's buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes to copy out
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+line_length(tty_t* t, int32_t cnt)
+{
+	uint32_t i;
+	for(i = t->head; i != t->commit && (i - t->head) < cnt; i++) {
+		if(t->typed[i & TERM_BUF_MASK] == '\n')
+			return i - t->head + 1;
+	}
+	return i - t->head;
+}
+
+/*
+ * raw_wait
+ *   DESCRIPTION: Blocks according to the VMIN/VTIME settings of a raw read.
+ *                VMIN 0 and VTIME 0 never blocks; VTIME 0 waits for VMIN
+ *                bytes; VMIN 0 waits up to VTIME for any byte; both set
+ *                waits for the first byte and then until VMIN bytes or
+ *                VTIME passes without a keystroke.
+ *   INPUTS: t -- terminal
+ *           mode -- mode word of the fd being read
+ *           cnt -- size of the caller's buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes to copy out, -1 if a signal came first
+ *   SIDE EFFECTS: must be called with term_lock held
+ */
+static int32_t
+raw_wait(tty_t* t, uint32_t mode, int32_t cnt)
+{
+	uint32_t vmin = TTY_VMIN(mode);
+	uint32_t vtime = DECISEC_TO_TICKS(TTY_VTIME(mode));
+	uint32_t start = pit_ticks;
+
+	if(vmin > cnt)
+		vmin = cnt;
+
+	/* Bytes already typed stay in the ring if a signal cuts this short */
+	if(vtime == 0) {
+		while(t->commit - t->head < vmin) {
+			if(signal_pending(current))
+				return -1;
+			sleep_on_locked(&t->read_wq, 0, &term_lock);
+		}
+	} else if(vmin == 0) {
+		while(t->commit == t->head && pit_ticks - start < vtime) {
+			if(signal_pending(current))
+				return -1;
+			sleep_on_locked(&t->read_wq, vtime - (pit_ticks - start), &term_lock);
+		}
+	} else {
+		while(t->commit == t->head) {
+			if(signal_pending(current))
+				return -1;
+			sleep_on_locked(&t->read_wq, 0, &term_lock);
+		}
+		while(t->commit - t->head < vmin && pit_ticks - t->last_key_tick < vtime) {
+			if(signal_pending(current))
+				return -1;
+			sleep_on_locked(&t->read_wq, vtime - (pit_ticks - t->last_key_tick), &term_lock);
+		}
+	}
+
+	if(t->commit - t->head < cnt)
+		return t->commit - t->head;
+	return cnt;
+}
+
+/*
+ * copy_out
+ *   DESCRIPTION: Moves n bytes from the front of the ring to buf in at
+ *                most two spans and frees them.
+ *   INPUTS: t -- terminal
+ *           buf -- destination, a kernel buffer
+ *           n -- bytes to move, no more than are committed
+ *   OUTPUTS: none
+ *   RETURN VALUE: n
+ *   SIDE EFFECTS: must be called with term_lock held
+ */
+static int32_t
+copy_out(tty_t* t, uint8_t* buf, uint32_t n)
+{
+	uint32_t start = t->head & TERM_BUF_MASK;
+	uint32_t first = TERM_BUF_SIZE - start;
+
+	if(first > n)
+		first = n;
+	memcpy(buf, t->typed + start, first);
+	memcpy(buf + first, t->typed, n - first);
+	t->head += n;
+	return n;
+}
 
 /* 
  * terminal_read
- *   DESCRIPTION: Fills in buffer with all keyboard presses once Enter has been pressed.
- *   INPUTS: buf -- character array to be filled in
+ *   DESCRIPTION: Fills in buffer from one terminal's keyboard input. In
+ *                canonical mode waits for Enter and returns one line
+ *                (newline included); in raw mode returns keystrokes as they
+ *                arrive, subject to the VMIN/VTIME settings. Sleeps while
+ *                waiting. The bytes go through a kernel buffer so buf,
+ *                which may fault, is only touched once term_lock is
+ *                dropped.
+ *   INPUTS: term -- terminal number
+ *           mode -- line discipline mode word of the fd being read
+ *           buf -- character array to be filled in
  *           cnt -- number of characters requested
  *   OUTPUTS: none
- *   RETURN VALUE: number of characters written to buffer
+ *   RETURN VALUE: number of characters written to buffer, -1 on bad args
+ *                 or if a signal arrives while it waits
  *   SIDE EFFECTS: none
  */
 int32_t
-terminal_read(uint8_t* buf, int32_t cnt)
+terminal_read(int32_t term, uint32_t mode, uint8_t* buf, int32_t cnt)
 {
-	reading = 1;
-	line_pos = 0; // Nothing in the typed so far.
+	uint8_t line[TERM_BUF_SIZE];
+	uint32_t flags;
+	int32_t rtn_cnt; // Number of characters actually written to buffer.
+	tty_t* t;
 
-	enter_pressed = 0;
-	
-	/* Wait until Enter has been pressed. */
-	while(!enter_pressed) {}
-	
-	int32_t rtn_cnt = 0; // Number of characters actually written to buffer.
-	while((typed[rtn_cnt] != '\n') && (rtn_cnt < cnt))
-	{
-		buf[rtn_cnt] = typed[rtn_cnt];
-		rtn_cnt++;
+	if(term < 0 || term >= NUM_TERMINALS || buf == NULL || cnt < 0)
+		return -1;
+	t = &ttys[term];
+	/* no more than a full ring is ever ready */
+	if(cnt > TERM_BUF_SIZE)
+		cnt = TERM_BUF_SIZE;
+
+	flags = spin_lock_irqsave(&term_lock);
+	set_raw(t, TTY_IS_RAW(mode));
+
+	if(!t->raw) {
+		/* Wait until Enter has been pressed. */
+		rtn_cnt = 0;
+		while(t->commit == t->head && rtn_cnt == 0) {
+			if(signal_pending(current))
+				rtn_cnt = -1;
+			else
+				sleep_on_locked(&t->read_wq, 0, &term_lock);
+		}
+		if(rtn_cnt == 0)
+			rtn_cnt = copy_out(t, line, line_length(t, cnt));
+	} else if((rtn_cnt = raw_wait(t, mode, cnt)) != -1) {
+		rtn_cnt = copy_out(t, line, rtn_cnt);
 	}
 
+	spin_unlock_irqrestore(&term_lock, flags);
+	if(rtn_cnt > 0)
+		memcpy(buf, line, rtn_cnt);
 	return rtn_cnt;
 }
 
 
 /* 
  * terminal_write
- *   DESCRIPTION: Print cnt # of characters in buf to screen.
- *   INPUTS: buf -- character array to be printed
+ *   DESCRIPTION: Print cnt # of characters in buf to a terminal's screen,
+ *                whether or not it is displayed. buf is copied in
+ *                TERM_WRITE_CHUNK bytes at a time with interrupts on, and
+ *                term_lock is only held to print each chunk.
+ *   INPUTS: term -- terminal number
+ *           buf -- character array to be printed
  *           cnt -- number of characters requested to be printed
  *   OUTPUTS: none
  *   RETURN VALUE: number of characters written to screen
  *   SIDE EFFECTS: none
  */
 int32_t
-terminal_write(const uint8_t* buf, int32_t cnt)
+terminal_write(int32_t term, const uint8_t* buf, int32_t cnt)
 {
-	int8_t s[1024];
-	
-	int i;
-	for(i = 0; i < cnt; i++)
-		s[i] = buf[i];
-	s[cnt] = '\0';
+	uint8_t chunk[TERM_WRITE_CHUNK];
+	uint32_t flags;
+	int32_t i, n, done, old;
+
+	if(term < 0 || term >= NUM_TERMINALS || buf == NULL || cnt < 0)
+		return -1;
 
-	return puts(s);
+	for(done = 0; done < cnt; done += n) {
+		n = cnt - done;
+		if(n > TERM_WRITE_CHUNK)
+			n = TERM_WRITE_CHUNK;
+		memcpy(chunk, buf + done, n);
+
+		/* Keep keyboard echo from landing in the middle of a chunk. */
+		flags = spin_lock_irqsave(&term_lock);
+		old = set_screen(term);
+		for(i = 0; i < n; i++)
+			putc(chunk[i]);
+		set_screen(old);
+		spin_unlock_irqrestore(&term_lock, flags);
+	}
+
+	return cnt;
+}
+
+/* 
+ * terminal_poll
+ *   DESCRIPTION: Readiness check for poll. The keyboard handler signals the
+ *                read queue whenever input becomes readable.
+ *   INPUTS: term -- terminal number
+ *           mode -- line discipline mode word of the fd
+ *           pt -- poll call to register, or NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLOUT, plus POLLIN if a read would not block
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+int32_t
+terminal_poll(int32_t term, uint32_t mode, poll_table_t* pt)
+{
+	tty_t* t = &ttys[term];
+	int32_t events = POLLOUT;
+
+	spin_lock(&term_lock);
+	poll_wait(&t->read_wq, pt);
+	set_raw(t, TTY_IS_RAW(mode));
+	if(t->commit != t->head)
+		events |= POLLIN;
+	spin_unlock(&term_lock);
+	return events;
 }
 
 /*
@@ -105,6 +354,34 @@ terminal_close()
 	return 0;
 }
 
+/*
+ * terminal_ioctl
+ *   DESCRIPTION: Selects canonical or raw mode for one fd.
+ *   INPUTS: mode -- mode word of the fd
+ *           cmd -- TTY_SETCANON, TTY_SETRAW or TTY_GETMODE
+ *           arg -- for TTY_SETRAW, VMIN in bits 0-7 and VTIME in bits 8-15
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 (the mode word for TTY_GETMODE), -1 on bad command
+ *   SIDE EFFECTS: takes effect on the next read of that fd
+ */
+int32_t
+terminal_ioctl(uint32_t* mode, uint32_t cmd, uint32_t arg)
+{
+	switch(cmd) {
+		case TTY_SETCANON:
+		*mode = 0;
+		return 0;
+
+		case TTY_SETRAW:
+		*mode = TTY_RAW | ((arg & 0xFF) << 8) | (((arg >> 8) & 0xFF) << 16);
+		return 0;
+
+		case TTY_GETMODE:
+		return *mode;
+	}
+	return -1;
+}
+
 /* Stolen from www.osdever.net/bkerndev/Docs/keyboard.htm */
 /* KBDUS means US Keyboard Layout. This is a scancode table
 *  used to layout a standard US keyboard. I have left some
@@ -193,20 +470,77 @@ static uint8_t shift_chars[128] =
 
 
 /*
- * keyboard_input
- *   DESCRIPTION: Processes all keyboard input. Letters get printed to screen while read fn. is
- *                running, some other keys have special functions.
- *   INPUTS: key -- 8 bit scancode passed in from keyboard handler
+ * buffer_key
+ *   DESCRIPTION: Applies the line discipline to one character: raw mode
+ *                queues it as is, canonical mode edits the pending line
+ *                and echoes it.
+ *   INPUTS: t -- terminal
+ *           c -- translated character
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: called from the keyboard handler
  */
-void
-keyboard_input(uint8_t key)
+static void
+buffer_key(tty_t* t, uint8_t c)
 {
-    // Only process keyboard input if read fn. is executing
-	if(!reading)
+	t->last_key_tick = pit_ticks;
+
+	if(t->raw) {
+		if(t->tail - t->head >= TERM_BUF_SIZE)
+			return;
+		t->typed[t->tail & TERM_BUF_MASK] = c;
+		t->tail++;
+		t->commit = t->tail;
+		wake_up(&t->read_wq);
 		return;
+	}
+
+	if(c == '\b') {
+		// Don't allow backspacing farther than beginning of the line.
+		if(t->tail == t->commit)
+			return;
+		t->tail--;
+	} else if(c == '\n') {
+		if(t->tail - t->head >= TERM_BUF_SIZE)
+			return;
+		t->typed[t->tail & TERM_BUF_MASK] = c;
+		t->tail++;
+		t->commit = t->tail;
+		wake_up(&t->read_wq);
+	}
+	// Printable characters
+	else {
+		// Always leave room for the newline that ends the line.
+		if(t->tail - t->head >= TERM_BUF_SIZE - 1)
+			return;
+		t->typed[t->tail & TERM_BUF_MASK] = c;
+		t->tail++;
+	}
+	putc(c);
+}
+
+/* F9's report is long, so the worker thread prints it instead of the
+ * keyboard handler */
+static void
+stats_work(void* arg)
+{
+	stats_print();
+}
+
+/*
+ * handle_key
+ *   DESCRIPTION: Processes one scancode for the active terminal. Letters go
+ *                through the line discipline, some other keys have special
+ *                functions.
+ *   INPUTS: key -- 8 bit scancode passed in from keyboard handler
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: output goes to the active terminal's screen
+ */
+static void
+handle_key(uint8_t key)
+{
+	tty_t* t = &ttys[active];
 
 	switch(key) {
         // Ctrl pressed
@@ -219,6 +553,24 @@ keyboard_input(uint8_t key)
 		ctrl = 0;
 		return;
 		
+        // Alt pressed
+		case 0x38:
+		alt = 1;
+		return;
+		
+        // Alt released
+		case 0xB8:
+		alt = 0;
+		return;
+		
+        // F1, F2, F3 pressed
+		case 0x3B:
+		case 0x3C:
+		case 0x3D:
+		if(alt)
+			terminal_switch(key - 0x3B);
+		return;
+		
         // Up arrow pressed
 		case 0x48:
 		scroll(-1);
@@ -273,6 +625,11 @@ keyboard_input(uint8_t key)
 		case 0x42:
 		background_color();
 		return;
+
+        // F9 pressed
+		case 0x43:
+		queue_work(stats_work, NULL);
+		return;
 	}
 	
 	uint8_t kbd_data;
@@ -287,8 +644,11 @@ keyboard_input(uint8_t key)
         // Clear screen on <Ctrl + l>
 		if(kbd_data == 'l') {
 			clear();
-			line_pos = 0;
+			t->tail = t->commit; // Throw away the line being edited.
 		}
+		// Interrupt the terminal's programs on <Ctrl + c>
+		else if(kbd_data == 'c')
+			signal_raise_terminal(active, SIG_INTERRUPT);
 		return;
 	}
 	
@@ -297,27 +657,28 @@ keyboard_input(uint8_t key)
 		return;
 	
     // Only process valid characters.
-	if(kbd_data != 0) {
-		if(kbd_data == '\b') {
-            // Don't allow backspacing farther than beginning of typed buffer.
-			if(line_pos == 0)
-				return;
-			line_pos--;
-		} else if(kbd_data == '\n') {
-			reading = 0;
-			typed[line_pos] = '\n';
-			enter_pressed = 1;
-		}
-        // Printable characters
-        else {
-            // Only allow 1024 characters in buffer.
-			if(line_pos >= 10)
-				return;
-			typed[line_pos] = kbd_data;
-			line_pos++;
-		}
-		putc(kbd_data);
-	}
+	if(kbd_data != 0)
+		buffer_key(t, kbd_data);
 }
 
+/*
+ * keyboard_input
+ *   DESCRIPTION: Handles a scancode on behalf of the terminal on the
+ *                display, whichever process happens to be running.
+ *   INPUTS: key -- 8 bit scancode passed in from keyboard handler
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+keyboard_input(uint8_t key)
+{
+	uint32_t flags;
+	int32_t old;
 
+	flags = spin_lock_irqsave(&term_lock);
+	old = set_screen(active);
+	handle_key(key);
+	set_screen(old);
+	spin_unlock_irqrestore(&term_lock, flags);
+}
@@ -2,15 +2,40 @@
 #define TERMINAL_H
 
 #include "types.h"
+#include "lib.h"
+#include "syscall.h"
+
+/* Number of virtual terminals, switched with Alt+F1..F3 */
+#define NUM_TERMINALS	NUM_SCREENS
+
+/* Size of the input ring buffer; must be a power of two. */
+#define TERM_BUF_SIZE	1024
+
+/* Line discipline mode word, kept per fd (file_t.mode).
+ * Bit 0 selects raw mode, bits 8-15 hold VMIN and bits 16-23 hold VTIME
+ * in tenths of a second. A zero word is canonical mode. */
+#define TTY_RAW			0x1
+#define TTY_IS_RAW(m)	((m) & TTY_RAW)
+#define TTY_VMIN(m)		(((m) >> 8) & 0xFF)
+#define TTY_VTIME(m)	(((m) >> 16) & 0xFF)
+
+/* ioctl commands, must match syscalls/ece391syscall.h */
+#define TTY_SETCANON	0	/* line-at-a-time input with echo and editing */
+#define TTY_SETRAW		1	/* arg = VMIN | (VTIME << 8) */
+#define TTY_GETMODE		2	/* returns the mode word */
 
 /* Does nothing, returns 0. */
 extern int32_t terminal_open();
-/* Returns cnt chars (or up to '\n') after Enter has been pressed. */
-extern int32_t terminal_read(uint8_t* buf, int32_t cnt);
-/* Gets keyboard input and modifies the buffer and the screen. */
-extern int32_t terminal_write(const uint8_t* buf, int32_t cnt);
+/* Reads a terminal's input according to the line discipline in mode. */
+extern int32_t terminal_read(int32_t term, uint32_t mode, uint8_t* buf, int32_t cnt);
+/* Prints to a terminal's screen. */
+extern int32_t terminal_write(int32_t term, const uint8_t* buf, int32_t cnt);
 /* Does nothing, returns 0. */
 extern int32_t terminal_close();
+/* Changes the line discipline mode word of an fd. */
+extern int32_t terminal_ioctl(uint32_t* mode, uint32_t cmd, uint32_t arg);
+/* Reports whether a read of the terminal would block. */
+extern int32_t terminal_poll(int32_t term, uint32_t mode, poll_table_t* pt);
 /* Translates keyboard input into letters and calls terminal_write. */
 extern void keyboard_input(uint8_t key);
 
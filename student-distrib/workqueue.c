@@ -0,0 +1,91 @@
+/* workqueue.c - Deferred work run by per-processor kernel threads
+ * vim:ts=4 noexpandtab
+ */
+
+#include "workqueue.h"
+#include "kthread.h"
+#include "lib.h"
+
+work_queue_t work_queues[NR_CPUS];
+
+/* 
+ * worker
+ *   DESCRIPTION: A processor's worker thread: runs queued items in
+ *                order and sleeps while there are none
+ *   INPUTS: arg -- its work_queue_t
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, never returns
+ *   SIDE EFFECTS: none
+ */
+static void
+worker(void* arg)
+{
+	work_queue_t* q = (work_queue_t*)arg;
+	uint32_t flags;
+	work_t w;
+
+	while(1) {
+		flags = spin_lock_irqsave(&q->lock);
+		while(q->head == q->tail)
+			sleep_on_locked(&q->wait, 0, &q->lock);
+		w = q->ring[q->head % WORK_QUEUE_SIZE];
+		q->head++;
+		spin_unlock_irqrestore(&q->lock, flags);
+
+		w.fn(w.arg);
+		q->done++;
+		cond_resched();
+	}
+}
+
+/* 
+ * workqueue_init
+ *   DESCRIPTION: Starts a worker pinned to each processor found
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: called after smp_init
+ */
+void
+workqueue_init(void)
+{
+	int32_t i;
+
+	for(i = 0; i < ncpus; i++) {
+		work_queues[i].lock.name = (int8_t*)"work";
+		if(kthread_create(worker, &work_queues[i], i, KTHREAD_NORMAL) == NULL)
+			printf("No worker thread for CPU %d\n", i);
+	}
+}
+
+/* 
+ * queue_work
+ *   DESCRIPTION: Queues fn(arg) for this processor's worker and asks for
+ *                a reschedule, so the worker gets in on the way back to
+ *                user mode instead of after the quantum
+ *   INPUTS: fn -- function to run
+ *           arg -- its argument
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if the queue is full
+ *   SIDE EFFECTS: safe to call from interrupt handlers
+ */
+int32_t
+queue_work(work_fn_t fn, void* arg)
+{
+	cpu_t* cpu = this_cpu();
+	work_queue_t* q = &work_queues[cpu->id];
+	uint32_t flags = spin_lock_irqsave(&q->lock);
+
+	if(q->tail - q->head >= WORK_QUEUE_SIZE) {
+		q->dropped++;
+		spin_unlock_irqrestore(&q->lock, flags);
+		return -1;
+	}
+	q->ring[q->tail % WORK_QUEUE_SIZE].fn = fn;
+	q->ring[q->tail % WORK_QUEUE_SIZE].arg = arg;
+	q->tail++;
+	wake_up(&q->wait);
+	cpu->need_resched = 1;
+	spin_unlock_irqrestore(&q->lock, flags);
+	return 0;
+}
@@ -0,0 +1,42 @@
+/* workqueue.h - Deferred work run by per-processor kernel threads
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "smp.h"
+#include "sched.h"
+#include "spinlock.h"
+
+/* Work items each processor's queue holds; a power of two */
+#define WORK_QUEUE_SIZE	64
+
+typedef void (*work_fn_t)(void* arg);
+
+typedef struct work {
+	work_fn_t fn;
+	void* arg;
+} work_t;
+
+/* One processor's queue, a ring its worker thread drains in order */
+typedef struct work_queue {
+	spinlock_t lock;
+	work_t ring[WORK_QUEUE_SIZE];
+	uint32_t head;			/* next item to run; both run freely */
+	uint32_t tail;			/* next free slot */
+	wait_queue_t wait;		/* the worker, while the ring is empty */
+	uint32_t done;
+	uint32_t dropped;		/* queue_work calls that found the ring full */
+} work_queue_t;
+
+extern work_queue_t work_queues[NR_CPUS];
+
+/* Starts a worker thread for each processor */
+extern void workqueue_init(void);
+/* Runs fn(arg) later in this processor's worker thread, with interrupts
+ * on. Safe from interrupt handlers. 0, -1 if the queue is full. */
+extern int32_t queue_work(work_fn_t fn, void* arg);
+
+#endif /* _WORKQUEUE_H */
@@ -3,20 +3,20 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+#define NULL 0
 #define BUFSIZE 1024
-#define SBUFSIZE 33
 
+/*
+ * Prints the lines read from fd that contain s, each prefixed with
+ * fname (unless it is NULL).
+ */
 int32_t
-do_one_file (const char* s, const char* fname) 
+do_one_fd (const char* s, int32_t fd, const char* fname)
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
+    int32_t cnt, last, line_start, line_end, check, s_len;
     uint8_t data[BUFSIZE+1];
 
     s_len = ece391_strlen ((uint8_t*)s);
-    if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
-        ece391_fdputs (1, (uint8_t*)"file open failed\n");
-        return -1;
-    }
     last = 0;
     while (1) {
         cnt = ece391_read (fd, data + last, BUFSIZE - last);
@@ -42,8 +42,10 @@ do_one_file (const char* s, const char* fname)
 	    for (check = line_start; check < line_end; check++) {
 		if (s[0] == data[check] && 
 		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
+		    if (NULL != fname) {
+			ece391_fdputs (1, (uint8_t*)fname);
+			ece391_fdputs (1, (uint8_t*)":");
+		    }
 		    ece391_fdputs (1, data + line_start);
 		    ece391_fdputs (1, (uint8_t*)"\n");
 		    break;
@@ -58,6 +60,57 @@ do_one_file (const char* s, const char* fname)
 	if (0 == cnt)
 	    break;
     }
+    return 0;
+}
+
+/*
+ * Prints the lines of the len bytes at data that contain s, each
+ * prefixed with fname.  data is a read-only mapping of the file, so
+ * lines are written out by length instead of being NUL-terminated.
+ */
+void
+do_one_map (const char* s, const uint8_t* data, uint32_t len, const char* fname)
+{
+    uint32_t line_start, line_end, check, s_len;
+
+    s_len = ece391_strlen ((uint8_t*)s);
+    for (line_start = 0; line_start < len; line_start = line_end + 1) {
+	line_end = line_start;
+	while (line_end < len && '\n' != data[line_end])
+	    line_end++;
+	for (check = line_start; check + s_len <= line_end; check++) {
+	    if (s[0] == data[check] &&
+		0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
+		ece391_fdputs (1, (uint8_t*)fname);
+		ece391_fdputs (1, (uint8_t*)":");
+		ece391_write (1, data + line_start, line_end - line_start);
+		ece391_fdputs (1, (uint8_t*)"\n");
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ * Searches a file of size bytes in place through mmap, or with reads
+ * if it can't be mapped.
+ */
+int32_t
+do_one_file (const char* s, const char* fname, uint32_t size)
+{
+    int32_t fd;
+    uint8_t* data;
+
+    if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
+        ece391_fdputs (1, (uint8_t*)"file open failed\n");
+        return -1;
+    }
+    if (0 != size && (void*)-1 != (data = ece391_mmap (fd, 0, size))) {
+	do_one_map (s, data, size, fname);
+	/* moving the break back unmaps the file */
+	ece391_sbrk (data - (uint8_t*)ece391_sbrk (0));
+    } else if (0 != do_one_fd (s, fd, fname))
+        return -1;
     if (-1 == ece391_close (fd)) {
         ece391_fdputs (1, (uint8_t*)"file close failed\n");
         return -1;
@@ -67,30 +120,37 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, off;
+    uint8_t buf[BUFSIZE];
     uint8_t search[BUFSIZE];
+    struct ece391_dirent* d;
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
         return 3;
     }
 
+    /* Anything but the terminal on stdin, e.g. a pipe: search that */
+    if (-1 == ece391_ioctl (0, TTY_GETMODE, 0))
+	return (0 == do_one_fd ((char*)search, 0, NULL)) ? 0 : 3;
+
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, buf, BUFSIZE))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (off = 0; off < cnt; off += d->reclen) {
+	    d = (struct ece391_dirent*)(buf + off);
+	    if (FTYPE_FILE != d->type) /* a directory or the rtc... */
+	        continue;
+	    if (0 != do_one_file ((char*)search, (char*)ECE391_DIRENT_NAME (d), d->size))
+	        return 3;
+	}
     }
 
     return 0;
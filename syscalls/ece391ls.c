@@ -3,25 +3,40 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define BUFSIZE 1024
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, off, len, out;
+    uint8_t buf[BUFSIZE];
+    uint8_t line[BUFSIZE];
+    struct ece391_dirent* d;
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* one getdents and one write for each batch of entries */
+    while (0 != (cnt = ece391_getdents (fd, buf, BUFSIZE))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
+	    out = 0;
+	    for (off = 0; off < cnt; off += d->reclen) {
+	        d = (struct ece391_dirent*)(buf + off);
+	        len = d->namelen;
+	        if (out + len + 1 > BUFSIZE) {
+	            if (-1 == ece391_write (1, line, out))
+	                return 3;
+	            out = 0;
+	        }
+	        ece391_strcpy (line + out, ECE391_DIRENT_NAME (d));
+	        line[out + len] = '\n';
+	        out += len + 1;
+	    }
+	    if (-1 == ece391_write (1, line, out))
 	        return 3;
     }
 
@@ -4,6 +4,91 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
+#define MAXSTAGES 8
+
+/*
+ * Forks a child that points its stdin and stdout at in and out (-1
+ * leaves them alone), closes spare and replaces itself with cmd.  The
+ * fork shares the shell's pages, so only the exec copies anything.
+ * Returns the child's pid, or -1 if the fork failed.  A command that
+ * does not exist is reported by the child.
+ */
+static int32_t
+start_command (uint8_t* cmd, int32_t in, int32_t out, int32_t spare)
+{
+    int32_t pid;
+
+    if (0 != (pid = ece391_fork ()))
+	return pid;
+    if (in >= 0) {
+	ece391_dup2 (in, 0);
+	ece391_close (in);
+    }
+    if (out >= 0) {
+	ece391_dup2 (out, 1);
+	ece391_close (out);
+    }
+    if (spare >= 0)
+	ece391_close (spare);
+    ece391_exec (cmd);
+    ece391_fdputs (1, (uint8_t*)"no such command\n");
+    ece391_halt (0);
+    return -1;
+}
+
+/*
+ * Runs "a | b | c", each stage reading the previous one's output
+ * through a pipe.  Returns the exit status of the last stage, or -1
+ * if any stage could not be forked.
+ */
+static int32_t
+run_pipeline (uint8_t* buf)
+{
+    int32_t pids[MAXSTAGES];
+    int32_t nstages = 0, in = -1, out, i, rval = 0, failed = 0;
+    int32_t fds[2];
+    uint8_t* cmd = buf;
+    uint8_t* bar;
+    uint8_t* end;
+    int32_t last;
+
+    while (1) {
+	for (bar = cmd; '\0' != *bar && '|' != *bar; bar++);
+	last = ('\0' == *bar);
+	for (end = bar; end > cmd && ' ' == end[-1]; end--);
+	*end = '\0';
+	out = -1;
+	if (!last) {
+	    if (nstages + 1 >= MAXSTAGES || -1 == ece391_pipe (fds)) {
+		if (in >= 0)
+		    ece391_close (in);
+		failed = 1;
+		break;
+	    }
+	    out = fds[1];
+	}
+	while (' ' == *cmd)
+	    cmd++;
+
+	if (-1 == (pids[nstages] = start_command (cmd, in, out, last ? -1 : fds[0])))
+	    failed = 1;
+	else
+	    nstages++;
+
+	/* Only the stage given each end as stdin or stdout keeps it open */
+	if (in >= 0)
+	    ece391_close (in);
+	if (out < 0)
+	    break;
+	ece391_close (out);
+	in = fds[0];
+	cmd = bar + 1;
+    }
+
+    for (i = 0; i < nstages; i++)
+	rval = ece391_wait (pids[i]);
+    return failed ? -1 : rval;
+}
 
 int main ()
 {
@@ -23,9 +108,13 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
-	rval = ece391_execute (buf);
+	for (cnt = 0; '\0' != buf[cnt] && '|' != buf[cnt]; cnt++);
+	if ('|' == buf[cnt])
+	    rval = run_pipeline (buf);
+	else if (-1 != (rval = start_command (buf, -1, -1, -1)))
+	    rval = ece391_wait (rval);
 	if (-1 == rval)
-	    ece391_fdputs (1, (uint8_t*)"no such command\n");
+	    ece391_fdputs (1, (uint8_t*)"could not start command\n");
 	else if (256 == rval)
 	    ece391_fdputs (1, (uint8_t*)"program terminated by exception\n");
 	else if (0 != rval)
@@ -21,6 +21,115 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+extern int32_t ece391_ioctl (int32_t fd, uint32_t cmd, uint32_t arg);
+
+/*
+ * Waits until one of nfds file descriptors is ready, or for timeout
+ * milliseconds (0 returns at once, -1 waits forever).  Returns the
+ * number of entries with revents set, 0 on timeout.
+ */
+struct pollfd {
+	int32_t fd;
+	int16_t events;
+	int16_t revents;
+};
+
+enum poll_events {
+	POLLIN = 0x01,
+	POLLOUT = 0x04,
+	POLLERR = 0x08,
+	POLLHUP = 0x10,
+	POLLNVAL = 0x20
+};
+
+extern int32_t ece391_poll (struct pollfd* fds, int32_t nfds, int32_t timeout);
+
+/*
+ * pipe fills in fds[0] (read end) and fds[1] (write end).  dup2 makes
+ * newfd a copy of oldfd, closing newfd first.  spawn starts a program
+ * that inherits the caller's fds and returns its pid without waiting;
+ * wait collects a spawned child's exit status.
+ */
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_dup2 (int32_t oldfd, int32_t newfd);
+extern int32_t ece391_spawn (const uint8_t* command);
+extern int32_t ece391_wait (int32_t pid);
+
+/*
+ * fork starts a copy of the caller that shares its pages until one of
+ * them writes; it returns the child's pid to the parent and 0 to the
+ * child, which must be collected with wait.  exec replaces the
+ * caller's program and only returns (with -1) if it can't be run.
+ */
+extern int32_t ece391_fork (void);
+extern int32_t ece391_exec (const uint8_t* command);
+
+/*
+ * sbrk moves the end of the heap by increment bytes and returns the old
+ * end, or (void*)-1 if there is no room.  New heap pages read as zero.
+ */
+extern void* ece391_sbrk (int32_t increment);
+
+/*
+ * create makes an empty file and returns an fd open on it; it fails if
+ * the name exists or the file system image is read only.  Writes to a
+ * file go at its position and grow it; FILE_SETAPPEND with a nonzero
+ * argument makes every write go at the end instead.
+ */
+extern int32_t ece391_create (const uint8_t* filename);
+
+enum file_cmds {
+	FILE_SETAPPEND = 16
+};
+
+/*
+ * getdents fills buf with as many entries of an open directory as fit
+ * and returns the bytes filled, 0 once every entry has been returned,
+ * or -1 if not even one fits.  Each record is a struct ece391_dirent
+ * followed by the NUL-terminated name; the next record starts reclen
+ * bytes after it.  Types are those of the file system: 0 for the rtc,
+ * 1 for a directory, 2 for a file.
+ */
+struct ece391_dirent {
+	uint32_t inode;
+	uint32_t size;
+	uint16_t reclen;
+	uint8_t type;
+	uint8_t namelen;
+};
+
+#define ECE391_DIRENT_NAME(d) ((uint8_t*)((struct ece391_dirent*)(d) + 1))
+
+enum file_types {
+	FTYPE_RTC = 0,
+	FTYPE_DIR,
+	FTYPE_FILE
+};
+
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+
+/*
+ * mmap maps len bytes of an open file, starting at offset (a multiple
+ * of 4kB), read-only at the end of the heap and returns their address,
+ * or (void*)-1 on failure.  Bytes past the end of the file read as
+ * zero.  The break moves past the mapping; moving it back to the
+ * returned address unmaps it.  System calls that would write into the
+ * mapping, such as read, fail instead.
+ */
+extern void* ece391_mmap (int32_t fd, uint32_t offset, uint32_t len);
+
+/*
+ * Terminal ioctl commands.  Canonical mode (the default) returns one
+ * edited line per read.  Raw mode returns keystrokes as they arrive
+ * without echo: the argument holds VMIN in bits 0-7 and VTIME (tenths
+ * of a second) in bits 8-15, so TTY_SETRAW with 0 gives non-blocking
+ * reads and with 1 gives one key at a time.
+ */
+enum tty_cmds {
+	TTY_SETCANON = 0,
+	TTY_SETRAW,
+	TTY_GETMODE
+};
 
 enum signums {
 	DIV_ZERO = 0,
@@ -11,5 +11,17 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_IOCTL   11
+#define SYS_POLL    12
+#define SYS_PIPE    13
+#define SYS_DUP2    14
+#define SYS_SPAWN   15
+#define SYS_WAIT    16
+#define SYS_FORK    17
+#define SYS_EXEC    18
+#define SYS_SBRK    19
+#define SYS_CREATE  20
+#define SYS_GETDENTS 21
+#define SYS_MMAP    22
 
 #endif /* ECE391SYSNUM_H */